@@ -0,0 +1,127 @@
+// Accept rate of short-lived connections over loopback, with sock_accept()
+// and with sock_async_accept(). The client opens a connection, waits for the
+// server to close it and opens the next one.
+
+#define SOCK_IMPLEMENTATION
+#include "bench.h"
+
+typedef struct {
+    Sock *server;
+    bool async;
+    volatile bool stop;
+    uint64_t accepted;
+    int pending; // Connections still owned by sock_async_accept() threads
+} Acceptor;
+
+static void close_client(Sock *sock, void *user_data)
+{
+    Acceptor *acceptor = (Acceptor*)user_data;
+
+    sock_close(sock);
+    __atomic_fetch_sub(&acceptor->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void *accept_thread(void *data)
+{
+    Acceptor *acceptor = (Acceptor*)data;
+
+    while (!acceptor->stop) {
+        if (acceptor->async) {
+            __atomic_fetch_add(&acceptor->pending, 1, __ATOMIC_RELAXED);
+            if (!sock_async_accept(acceptor->server, close_client, acceptor)) {
+                __atomic_fetch_sub(&acceptor->pending, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        } else {
+            Sock *client = sock_accept(acceptor->server);
+            if (client == NULL) {
+                break;
+            }
+            sock_close(client);
+        }
+        acceptor->accepted++;
+    }
+
+    return NULL;
+}
+
+static bool connect_once(const SockAddr *addr)
+{
+    Sock *sock = sock_create(SOCK_IPV4, SOCK_TCP);
+    if (sock == NULL) {
+        return false;
+    }
+
+    bool ok = sock_connect_addr(sock, addr);
+    if (ok) {
+        // Wait for the server to close first, keeping TIME_WAIT on its side
+        uint8_t byte;
+        sock_recv(sock, &byte, sizeof(byte));
+    }
+
+    sock_close(sock);
+    return ok;
+}
+
+static bool run(bool async, int duration_ms)
+{
+    Acceptor acceptor;
+    memset(&acceptor, 0, sizeof(acceptor));
+    acceptor.async = async;
+    acceptor.server = bench_listen(SOCK_TCP);
+    if (acceptor.server == NULL) {
+        fprintf(stderr, "ERROR: Could not create server: %s\n", strerror(errno));
+        return false;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, accept_thread, &acceptor) != 0) {
+        sock_close(acceptor.server);
+        return false;
+    }
+
+    uint64_t failed = 0;
+    int64_t start = bench_now_ns();
+    int64_t deadline = start + (int64_t)duration_ms * 1000000;
+    int64_t now = start;
+    while (now < deadline) {
+        if (!connect_once(&acceptor.server->addr)) {
+            failed++;
+        }
+        now = bench_now_ns();
+    }
+    double seconds = (double)(now - start) / 1e9;
+
+    // A last connection wakes up the acceptor so that it sees the stop flag
+    acceptor.stop = true;
+    connect_once(&acceptor.server->addr);
+    pthread_join(thread, NULL);
+    while (__atomic_load_n(&acceptor.pending, __ATOMIC_ACQUIRE) > 0) {
+        sched_yield();
+    }
+    sock_close(acceptor.server);
+
+    uint64_t connections = acceptor.accepted - 1;
+
+    bench_begin("accept_rate");
+    bench_field("mode", "\"%s\"", async ? "async_accept" : "accept");
+    bench_field("seconds", "%.3f", seconds);
+    bench_field("connections", "%llu", (unsigned long long)connections);
+    bench_field("failed", "%llu", (unsigned long long)failed);
+    bench_field("connections_per_sec", "%.0f", (double)connections / seconds);
+    bench_end();
+
+    return failed == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int duration_ms = bench_duration_ms(argc, argv);
+
+    if (!run(false, duration_ms) || !run(true, duration_ms)) {
+        fprintf(stderr, "ERROR: Some connections failed\n");
+        return 1;
+    }
+
+    return 0;
+}
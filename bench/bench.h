@@ -0,0 +1,120 @@
+// bench.h - Helpers shared by the loopback benchmarks of sock.h.
+//
+// Every benchmark takes an optional duration in milliseconds as its first
+// argument and prints one JSON object per measurement on stdout, e.g.:
+//
+//     {"bench":"tcp_latency","commit":"1a2b3c4","size":64,...}
+//
+// The commit field is read from the BENCH_COMMIT environment variable, which
+// `make bench` sets, so that results of different commits can be compared.
+// Diagnostics are printed on stderr.
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "sock.h"
+
+#define BENCH_DEFAULT_DURATION_MS 1000
+
+// Returns the current time of a monotonic clock in nanoseconds
+static inline int64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns the duration requested on the command line
+static inline int bench_duration_ms(int argc, char **argv)
+{
+    int duration = argc > 1 ? atoi(argv[1]) : 0;
+    return duration > 0 ? duration : BENCH_DEFAULT_DURATION_MS;
+}
+
+// Raises the soft limit of open files to the hard one
+static inline void bench_raise_fd_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Creates a sock bound to an ephemeral port of the loopback interface,
+// listening if it is a TCP sock. Its addr field holds the actual port.
+static inline Sock *bench_listen(SockType type)
+{
+    Sock *sock = sock_create(SOCK_IPV4, type);
+    if (sock == NULL) {
+        return NULL;
+    }
+
+    if (!sock_bind(sock, sock_addr("127.0.0.1", 0))
+            || (type == SOCK_TCP && !sock_listen(sock))) {
+        sock_close(sock);
+        return NULL;
+    }
+
+    SockAddr *addr = &sock->addr;
+    addr->len = sizeof(addr->ipv4);
+    if (getsockname(sock->fd, &addr->sockaddr, &addr->len) < 0) {
+        sock_close(sock);
+        return NULL;
+    }
+    addr->port = ntohs(addr->ipv4.sin_port);
+
+    return sock;
+}
+
+// Prints the start of a result line, to be continued with bench_field() and
+// ended with bench_end()
+static inline void bench_begin(const char *name)
+{
+    const char *commit = getenv("BENCH_COMMIT");
+    printf("{\"bench\":\"%s\",\"commit\":\"%s\"", name,
+           commit != NULL ? commit : "");
+}
+
+// Prints a field of a result line, value being formatted with fmt
+static inline void bench_field(const char *key, const char *fmt, ...)
+{
+    printf(",\"%s\":", key);
+
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+static inline void bench_end(void)
+{
+    printf("}\n");
+    fflush(stdout);
+}
+
+static inline int bench_compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the percentile, between 0 and 100, of sorted samples
+static inline int64_t bench_percentile(const int64_t *sorted, size_t count,
+                                       double percentile)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t index = (size_t)(percentile / 100.0 * (double)(count - 1) + 0.5);
+    return sorted[index < count ? index : count - 1];
+}
+
+#endif // BENCH_H_
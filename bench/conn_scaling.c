@@ -0,0 +1,199 @@
+// Request rate over loopback as the number of concurrent connections grows.
+// Both sides run a SockLoop: every client connection keeps one request in
+// flight and sends the next one as soon as the echo of the previous one came
+// back.
+
+#define SOCK_IMPLEMENTATION
+#include "bench.h"
+
+#define REQUEST_SIZE 64
+
+static const size_t connection_counts[] = { 1, 16, 128, 512 };
+
+typedef struct {
+    Sock *sock;
+    size_t received; // Bytes of the current echo received so far
+} Conn;
+
+typedef struct {
+    SockLoop *loop;
+    Sock *server;
+    int accepted; // Connections accepted so far
+    int open;     // Accepted connections not closed yet
+} Server;
+
+static uint64_t completed = 0;
+static uint8_t request[REQUEST_SIZE];
+
+static void handle_echo(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    (void) events;
+    Server *server = (Server*)user_data;
+
+    // A single request is in flight, so the echo always fits in the socket
+    // buffer and a non-blocking send is enough
+    uint8_t buffer[REQUEST_SIZE];
+    ssize_t n = sock_recv(sock, buffer, sizeof(buffer));
+    if (n > 0) {
+        sock_send(sock, buffer, n);
+        return;
+    }
+    if (n < 0 && sock->last_errno == EAGAIN) {
+        return;
+    }
+
+    sock_loop_remove(loop, sock);
+    sock_close(sock);
+    __atomic_fetch_sub(&server->open, 1, __ATOMIC_RELEASE);
+}
+
+static void handle_accept(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    (void) events;
+    Server *server = (Server*)user_data;
+
+    Sock *clients[SOCK_BATCH_MAX];
+    ssize_t count = sock_accept_batch(sock, clients, SOCK_BATCH_MAX,
+                                      SOCK_BATCH_NONBLOCK | SOCK_BATCH_NO_ADDR_STR);
+    for (ssize_t i = 0; i < count; ++i) {
+        sock_set_nodelay(clients[i], true);
+        if (!sock_loop_add(loop, clients[i], SOCK_EVENT_READ, handle_echo, server)) {
+            sock_close(clients[i]);
+            continue;
+        }
+        __atomic_fetch_add(&server->open, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&server->accepted, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void *server_thread(void *data)
+{
+    Server *server = (Server*)data;
+    sock_loop_run(server->loop);
+    return NULL;
+}
+
+static void handle_response(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    (void) loop;
+    (void) events;
+    Conn *conn = (Conn*)user_data;
+
+    uint8_t buffer[REQUEST_SIZE];
+    ssize_t n = sock_recv(sock, buffer, REQUEST_SIZE - conn->received);
+    if (n <= 0) {
+        return;
+    }
+
+    conn->received += n;
+    if (conn->received == REQUEST_SIZE) {
+        conn->received = 0;
+        completed++;
+        sock_send(sock, request, sizeof(request));
+    }
+}
+
+static void stop_loop(SockTimer *timer, void *user_data)
+{
+    (void) timer;
+    sock_loop_stop((SockLoop*)user_data);
+}
+
+static bool run(size_t count, int duration_ms)
+{
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.server = bench_listen(SOCK_TCP);
+    server.loop = sock_loop_create();
+    if (server.server == NULL || server.loop == NULL
+            || !sock_set_nonblocking(server.server, true)
+            || !sock_loop_add(server.loop, server.server, SOCK_EVENT_READ,
+                              handle_accept, &server)) {
+        fprintf(stderr, "ERROR: Could not create server: %s\n", strerror(errno));
+        return false;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, server_thread, &server) != 0) {
+        fprintf(stderr, "ERROR: Could not create server thread\n");
+        return false;
+    }
+
+    SockLoop *loop = sock_loop_create();
+    Conn *conns = (Conn*)calloc(count, sizeof(*conns));
+    if (loop == NULL || conns == NULL) {
+        fprintf(stderr, "ERROR: Could not create client loop\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Sock *sock = sock_create(SOCK_IPV4, SOCK_TCP);
+        if (sock == NULL || !sock_connect(sock, server.server->addr)
+                || !sock_set_nonblocking(sock, true)
+                || !sock_loop_add(loop, sock, SOCK_EVENT_READ, handle_response,
+                                  &conns[i])) {
+            fprintf(stderr, "ERROR: Could not open connection %zu: %s\n", i,
+                    strerror(errno));
+            return false;
+        }
+        sock_set_nodelay(sock, true);
+        conns[i].sock = sock;
+    }
+
+    SockTimer timer;
+    sock_timer_init(&timer, stop_loop, loop);
+    sock_loop_add_timer(loop, &timer, duration_ms);
+
+    completed = 0;
+    int64_t start = bench_now_ns();
+    for (size_t i = 0; i < count; ++i) {
+        sock_send(conns[i].sock, request, sizeof(request));
+    }
+    bool ok = sock_loop_run(loop);
+    double seconds = (double)(bench_now_ns() - start) / 1e9;
+
+    for (size_t i = 0; i < count; ++i) {
+        sock_loop_remove(loop, conns[i].sock);
+        sock_close(conns[i].sock);
+    }
+    sock_loop_destroy(loop);
+    free(conns);
+
+    // Wait for the server to see every connection closed
+    while (__atomic_load_n(&server.accepted, __ATOMIC_ACQUIRE) < (int)count
+            || __atomic_load_n(&server.open, __ATOMIC_ACQUIRE) > 0) {
+        sched_yield();
+    }
+    sock_loop_stop(server.loop);
+    pthread_join(thread, NULL);
+    sock_loop_remove(server.loop, server.server);
+    sock_loop_destroy(server.loop);
+    sock_close(server.server);
+
+    bench_begin("conn_scaling");
+    bench_field("connections", "%zu", count);
+    bench_field("seconds", "%.3f", seconds);
+    bench_field("requests", "%llu", (unsigned long long)completed);
+    bench_field("requests_per_sec", "%.0f", (double)completed / seconds);
+    bench_field("mean_latency_us", "%.2f",
+                completed > 0 ? (double)count * seconds * 1e6 / completed : 0.0);
+    bench_end();
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int duration_ms = bench_duration_ms(argc, argv);
+
+    bench_raise_fd_limit();
+    memset(request, 'x', sizeof(request));
+
+    for (size_t i = 0; i < sizeof(connection_counts) / sizeof(connection_counts[0]); ++i) {
+        if (!run(connection_counts[i], duration_ms)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
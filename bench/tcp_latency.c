@@ -0,0 +1,113 @@
+// TCP request/response latency over loopback: a single connection sends a
+// request and waits for its echo before sending the next one.
+
+#define SOCK_IMPLEMENTATION
+#include "bench.h"
+
+#define REQUEST_SIZE 64
+#define WARMUP_REQUESTS 1000
+#define MAX_SAMPLES (4 * 1024 * 1024)
+
+static void *echo_server(void *data)
+{
+    Sock *server = (Sock*)data;
+
+    Sock *client = sock_accept(server);
+    if (client == NULL) {
+        return NULL;
+    }
+    sock_set_nodelay(client, true);
+
+    uint8_t buffer[REQUEST_SIZE];
+    while (sock_recv_all(client, buffer, sizeof(buffer)) == sizeof(buffer)) {
+        if (sock_send_all(client, buffer, sizeof(buffer)) < 0) {
+            break;
+        }
+    }
+
+    sock_close(client);
+    return NULL;
+}
+
+static bool round_trip(Sock *sock)
+{
+    uint8_t buffer[REQUEST_SIZE];
+    memset(buffer, 'x', sizeof(buffer));
+
+    return sock_send_all(sock, buffer, sizeof(buffer)) == sizeof(buffer)
+        && sock_recv_all(sock, buffer, sizeof(buffer)) == sizeof(buffer);
+}
+
+int main(int argc, char **argv)
+{
+    int duration_ms = bench_duration_ms(argc, argv);
+
+    Sock *server = bench_listen(SOCK_TCP);
+    if (server == NULL) {
+        fprintf(stderr, "ERROR: Could not create server: %s\n", strerror(errno));
+        return 1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, echo_server, server) != 0) {
+        fprintf(stderr, "ERROR: Could not create server thread\n");
+        return 1;
+    }
+
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    if (client == NULL || !sock_connect(client, server->addr)) {
+        fprintf(stderr, "ERROR: Could not connect: %s\n", strerror(errno));
+        return 1;
+    }
+    sock_set_nodelay(client, true);
+
+    for (int i = 0; i < WARMUP_REQUESTS; ++i) {
+        if (!round_trip(client)) {
+            fprintf(stderr, "ERROR: Warmup failed\n");
+            return 1;
+        }
+    }
+
+    int64_t *samples = (int64_t*)malloc(MAX_SAMPLES * sizeof(*samples));
+    if (samples == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate samples\n");
+        return 1;
+    }
+
+    size_t count = 0;
+    int64_t start = bench_now_ns();
+    int64_t deadline = start + (int64_t)duration_ms * 1000000;
+    int64_t now = start;
+
+    while (now < deadline && count < MAX_SAMPLES) {
+        int64_t sent = now;
+        if (!round_trip(client)) {
+            fprintf(stderr, "ERROR: Request failed\n");
+            return 1;
+        }
+        now = bench_now_ns();
+        samples[count++] = now - sent;
+    }
+    double seconds = (double)(now - start) / 1e9;
+
+    sock_close(client);
+    pthread_join(thread, NULL);
+    sock_close(server);
+
+    qsort(samples, count, sizeof(*samples), bench_compare_i64);
+
+    bench_begin("tcp_latency");
+    bench_field("size", "%d", REQUEST_SIZE);
+    bench_field("seconds", "%.3f", seconds);
+    bench_field("requests", "%zu", count);
+    bench_field("requests_per_sec", "%.0f", (double)count / seconds);
+    bench_field("p50_us", "%.2f", bench_percentile(samples, count, 50) / 1e3);
+    bench_field("p90_us", "%.2f", bench_percentile(samples, count, 90) / 1e3);
+    bench_field("p99_us", "%.2f", bench_percentile(samples, count, 99) / 1e3);
+    bench_field("p999_us", "%.2f", bench_percentile(samples, count, 99.9) / 1e3);
+    bench_field("max_us", "%.2f", samples[count - 1] / 1e3);
+    bench_end();
+
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,133 @@
+// TCP echo throughput over loopback at several message sizes. A writer
+// thread streams messages for the duration of the run while the main thread
+// reads the echoed data back.
+
+#define SOCK_IMPLEMENTATION
+#include "bench.h"
+
+#define MAX_MESSAGE_SIZE (64 * 1024)
+
+static const size_t message_sizes[] = { 64, 1024, 16 * 1024, 64 * 1024 };
+
+typedef struct {
+    Sock *sock;
+    size_t size;
+    int64_t deadline_ns;
+    uint64_t messages;
+} Writer;
+
+static void *echo_server(void *data)
+{
+    Sock *server = (Sock*)data;
+
+    Sock *client = sock_accept(server);
+    if (client == NULL) {
+        return NULL;
+    }
+
+    static uint8_t buffer[MAX_MESSAGE_SIZE];
+    while (true) {
+        ssize_t n = sock_recv(client, buffer, sizeof(buffer));
+        if (n <= 0 || sock_send_all(client, buffer, n) < 0) {
+            break;
+        }
+    }
+
+    sock_close(client);
+    return NULL;
+}
+
+static void *writer_thread(void *data)
+{
+    Writer *writer = (Writer*)data;
+
+    static uint8_t message[MAX_MESSAGE_SIZE];
+    memset(message, 'x', sizeof(message));
+
+    while (bench_now_ns() < writer->deadline_ns) {
+        if (sock_send_all(writer->sock, message, writer->size) < 0) {
+            break;
+        }
+        writer->messages++;
+    }
+
+    // Let the server finish echoing and close the connection
+    shutdown(writer->sock->fd, SHUT_WR);
+    return NULL;
+}
+
+static bool run(size_t size, int duration_ms)
+{
+    Sock *server = bench_listen(SOCK_TCP);
+    if (server == NULL) {
+        fprintf(stderr, "ERROR: Could not create server: %s\n", strerror(errno));
+        return false;
+    }
+
+    pthread_t server_thread;
+    if (pthread_create(&server_thread, NULL, echo_server, server) != 0) {
+        sock_close(server);
+        return false;
+    }
+
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    if (client == NULL || !sock_connect(client, server->addr)) {
+        fprintf(stderr, "ERROR: Could not connect: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int64_t start = bench_now_ns();
+    Writer writer = {
+        .sock = client,
+        .size = size,
+        .deadline_ns = start + (int64_t)duration_ms * 1000000,
+        .messages = 0,
+    };
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer_thread, &writer) != 0) {
+        fprintf(stderr, "ERROR: Could not create writer thread\n");
+        exit(1);
+    }
+
+    static uint8_t buffer[MAX_MESSAGE_SIZE];
+    uint64_t received = 0;
+    while (true) {
+        ssize_t n = sock_recv(client, buffer, sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+        received += n;
+    }
+    double seconds = (double)(bench_now_ns() - start) / 1e9;
+
+    pthread_join(thread, NULL);
+    pthread_join(server_thread, NULL);
+    sock_close(client);
+    sock_close(server);
+
+    bench_begin("tcp_throughput");
+    bench_field("size", "%zu", size);
+    bench_field("seconds", "%.3f", seconds);
+    bench_field("messages", "%llu", (unsigned long long)writer.messages);
+    bench_field("bytes", "%llu", (unsigned long long)received);
+    bench_field("messages_per_sec", "%.0f", (double)received / size / seconds);
+    bench_field("mib_per_sec", "%.2f", (double)received / (1024 * 1024) / seconds);
+    bench_end();
+
+    return received == writer.messages * size;
+}
+
+int main(int argc, char **argv)
+{
+    int duration_ms = bench_duration_ms(argc, argv);
+
+    for (size_t i = 0; i < sizeof(message_sizes) / sizeof(message_sizes[0]); ++i) {
+        if (!run(message_sizes[i], duration_ms)) {
+            fprintf(stderr, "ERROR: Echoed data is incomplete\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
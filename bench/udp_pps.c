@@ -0,0 +1,119 @@
+// UDP packets per second over loopback with sock_sendto() and
+// sock_recvfrom(). Packets that do not fit in the receive buffer of the
+// receiver are dropped by the kernel and reported as lost.
+
+#define SOCK_IMPLEMENTATION
+#include "bench.h"
+
+#define MAX_PACKET_SIZE 1472
+#define RECV_POLL_MS 50
+
+static const size_t packet_sizes[] = { 64, 512, MAX_PACKET_SIZE };
+
+typedef struct {
+    Sock *sock;
+    volatile bool stop;
+    uint64_t packets;
+    uint64_t bytes;
+} Receiver;
+
+static void *receiver_thread(void *data)
+{
+    Receiver *receiver = (Receiver*)data;
+
+    uint8_t buffer[MAX_PACKET_SIZE];
+    SockAddr from;
+    struct pollfd pfd = { .fd = receiver->sock->fd, .events = POLLIN, .revents = 0 };
+
+    // Drain what is queued, then give up once the sender stopped
+    while (true) {
+        ssize_t n = sock_recvfrom(receiver->sock, buffer, sizeof(buffer), &from);
+        if (n >= 0) {
+            receiver->packets++;
+            receiver->bytes += n;
+            continue;
+        }
+        if (receiver->sock->last_errno != EAGAIN) {
+            break;
+        }
+        if (poll(&pfd, 1, RECV_POLL_MS) == 0 && receiver->stop) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static bool run(size_t size, int duration_ms)
+{
+    Receiver receiver;
+    memset(&receiver, 0, sizeof(receiver));
+    receiver.sock = bench_listen(SOCK_UDP);
+    if (receiver.sock == NULL || !sock_set_nonblocking(receiver.sock, true)) {
+        fprintf(stderr, "ERROR: Could not create receiver: %s\n", strerror(errno));
+        return false;
+    }
+    // Formatting the sender address would dominate the receive cost
+    sock_set_lazy_addr(receiver.sock, true);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, receiver_thread, &receiver) != 0) {
+        sock_close(receiver.sock);
+        return false;
+    }
+
+    Sock *sender = sock_create(SOCK_IPV4, SOCK_UDP);
+    if (sender == NULL) {
+        fprintf(stderr, "ERROR: Could not create sender: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    uint8_t packet[MAX_PACKET_SIZE];
+    memset(packet, 'x', sizeof(packet));
+
+    uint64_t sent = 0;
+    int64_t start = bench_now_ns();
+    int64_t deadline = start + (int64_t)duration_ms * 1000000;
+    int64_t now = start;
+    while (now < deadline) {
+        // Check the clock every few packets, it costs as much as a send
+        for (int i = 0; i < 16; ++i) {
+            if (sock_sendto_addr(sender, packet, size, &receiver.sock->addr) == (ssize_t)size) {
+                sent++;
+            }
+        }
+        now = bench_now_ns();
+    }
+    double seconds = (double)(now - start) / 1e9;
+
+    receiver.stop = true;
+    pthread_join(thread, NULL);
+    sock_close(sender);
+    sock_close(receiver.sock);
+
+    bench_begin("udp_pps");
+    bench_field("size", "%zu", size);
+    bench_field("seconds", "%.3f", seconds);
+    bench_field("sent", "%llu", (unsigned long long)sent);
+    bench_field("received", "%llu", (unsigned long long)receiver.packets);
+    bench_field("lost", "%llu", (unsigned long long)(sent - receiver.packets));
+    bench_field("sent_per_sec", "%.0f", (double)sent / seconds);
+    bench_field("received_per_sec", "%.0f", (double)receiver.packets / seconds);
+    bench_field("mib_per_sec", "%.2f", (double)receiver.bytes / (1024 * 1024) / seconds);
+    bench_end();
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int duration_ms = bench_duration_ms(argc, argv);
+
+    for (size_t i = 0; i < sizeof(packet_sizes) / sizeof(packet_sizes[0]); ++i) {
+        if (!run(packet_sizes[i], duration_ms)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
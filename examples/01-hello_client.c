@@ -25,6 +25,7 @@ int main(void)
 
 defer:
     sock_close(socket);
+    sock_freelist_trim();
     fprintf(stderr, "ERROR: %s: %s\n", err, strerror(errno));
 
     return 0;
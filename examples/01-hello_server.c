@@ -30,6 +30,7 @@ int main(void)
 
 defer:
     sock_close(server);
+    sock_freelist_trim();
     fprintf(stderr, "ERROR: %s: %s\n", err, strerror(errno));
 
     return 0;
@@ -27,6 +27,7 @@ int main(void)
 defer:
     if (err) sock_log_error(s);
     sock_close(s);
+    sock_freelist_trim();
 
     return 0;
 }
@@ -24,5 +24,6 @@ int main(void)
     printf("Sent message: %s\n", msg);
 
     sock_close(client);
+    sock_freelist_trim();
     return 0;
 }
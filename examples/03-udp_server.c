@@ -39,5 +39,6 @@ int main(void)
     }
 
     sock_close(server);
+    sock_freelist_trim();
     return 0;
 }
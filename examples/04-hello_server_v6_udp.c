@@ -27,6 +27,7 @@ int main(void)
 close:
     if (err) sock_log_error(server);
     sock_close(server);
+    sock_freelist_trim();
 
     return 0;
 }
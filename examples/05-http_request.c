@@ -6,30 +6,21 @@
 int main(void)
 {
     const char *domain_name = "example.com";
-    SockAddrList addr_list = sock_dns(domain_name, 80, SOCK_IPV4, SOCK_TCP);
+    SockAddrList addr_list = sock_dns(domain_name, 80, 0, SOCK_TCP);
     if (addr_list.count == 0) {
         fprintf(stderr, "ERROR: Could not resolve address %s\n", domain_name);
         return 1;
     }
 
-    SockAddr addr = addr_list.items[0];
+    Sock *s = sock_connect_any(&addr_list, 5000);
     sock_addr_list_free(&addr_list);
-
-    printf("%s:%d\n", addr.str, addr.port);
-
-    Sock *s = sock_create(addr.type, SOCK_TCP);
     if (s == NULL) {
-        fprintf(stderr, "sock_create: ");
+        fprintf(stderr, "sock_connect_any: ");
         sock_log_error(s);
         return 1;
     }
 
-    if (!sock_connect(s, addr)) {
-        fprintf(stderr, "sock_connect: ");
-        sock_log_error(s);
-        sock_close(s);
-        return 1;
-    }
+    printf("%s:%d\n", s->addr.str, s->addr.port);
 
     const char *req =
         "GET / HTTP/1.1\r\n"
@@ -47,6 +38,7 @@ int main(void)
     }
 
     sock_close(s);
+    sock_freelist_trim();
 
     return 0;
 }
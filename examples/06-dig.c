@@ -6,14 +6,34 @@ int main(int argc, char **argv)
     const char *program_name = argv[0];
 
     if (argc <= 1) {
-        fprintf(stderr, "USAGE: %s <address>\n", program_name);
+        fprintf(stderr, "USAGE: %s <address> [@server] [port]\n", program_name);
         fprintf(stderr, "ERROR: No address was provided\n");
         return 1;
     }
 
     const char *arg_address = argv[1];
 
-    SockAddrList addrs = sock_dns(arg_address, 0, 0, SOCK_TCP);
+    SockDnsConfig config;
+    sock_dns_config_load(&config, NULL);
+
+    // Query a specific name server instead of the ones of resolv.conf
+    if (argc > 2 && argv[2][0] == '@') {
+        int port = argc > 3 ? atoi(argv[3]) : SOCK_DNS_PORT;
+        SockAddr server = sock_addr(argv[2] + 1, port);
+        if (server.type == SOCK_ADDR_INVALID) {
+            fprintf(stderr, "ERROR: Invalid server address `%s`\n", argv[2] + 1);
+            sock_dns_config_free(&config);
+            return 1;
+        }
+        config.servers.items[0] = server;
+        config.servers.count = 1;
+    }
+
+    SockAddrList addrs = sock_dns_query(arg_address, 0, 0, &config);
+    if (addrs.count == 0) {
+        fprintf(stderr, "ERROR: Could not resolve `%s`: %s\n", arg_address,
+                strerror(errno));
+    }
 
     for (size_t i = 0; i < addrs.count; ++i) {
         SockAddr it = addrs.items[i];
@@ -21,6 +41,8 @@ int main(int argc, char **argv)
     }
 
     sock_addr_list_free(&addrs);
+    sock_dns_config_free(&config);
+    sock_freelist_trim();
 
     return 0;
 }
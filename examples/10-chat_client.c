@@ -68,6 +68,7 @@ int main(int argc, char **argv)
     }
 
     sock_close(client);
+    sock_freelist_trim();
     printf("INFO: Closed socket\n");
 
     return EXIT_SUCCESS;
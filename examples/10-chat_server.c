@@ -1,7 +1,5 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
 
 #define SOCK_IMPLEMENTATION
 #include "sock.h"
@@ -10,114 +8,195 @@
 #define POOL_CAPACITY 16
 #define BUFFER_CAPACITY 4096
 #define USERNAME_CAPACITY 16
+#define QUEUE_CAPACITY 256
+#define CLOSE_TIMEOUT_MS 1000
+#define IDLE_TIMEOUT_MS (10 * 60 * 1000)
 
-Sock *socket_pool[POOL_CAPACITY];
-pthread_mutex_t pool_lock;
+typedef struct {
+    Sock *sock;
+    SockSubscriber *sub; // NULL until the client logged in
+    char username[USERNAME_CAPACITY];
+    size_t username_length; // Zero until the client logged in
+} Client;
+
+Client client_pool[POOL_CAPACITY];
+
+// Messages are queued on every client and sent when it can take them, so a
+// slow client does not hold the others back. A client whose queue is full is
+// disconnected.
+SockFanout *fanout = NULL;
+SockTopic *chat = NULL;
 
-bool add_client(Sock *sock)
+Client *add_client(Sock *sock)
 {
-    bool added = false;
-    pthread_mutex_lock(&pool_lock);
     for (size_t i = 0; i < POOL_CAPACITY; ++i) {
-        if (socket_pool[i] == NULL) {
-            socket_pool[i] = sock;
-            added = true;
-            break;
+        if (client_pool[i].sock == NULL) {
+            memset(&client_pool[i], 0, sizeof(client_pool[i]));
+            client_pool[i].sock = sock;
+            return &client_pool[i];
         }
     }
-    pthread_mutex_unlock(&pool_lock);
 
-    return added;
+    return NULL;
 }
 
-bool remove_client(Sock *sock) {
-    bool removed = false;
-    pthread_mutex_lock(&pool_lock);
-    for (size_t i = 0; i < POOL_CAPACITY; ++i) {
-        if (socket_pool[i] == sock) {
-            socket_pool[i] = NULL;
-            removed = true;
-            break;
-        }
+void remove_client(Client *client)
+{
+    memset(client, 0, sizeof(*client));
+}
+
+void broadcast(const Client *from, const char *msg, size_t msg_len)
+{
+    SockMessage *message = sock_message_create(msg, msg_len);
+    if (message == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate message\n");
+        return;
     }
-    pthread_mutex_unlock(&pool_lock);
 
-    return removed;
+    sock_fanout_publish(chat, message, from != NULL ? from->sock : NULL);
+    sock_message_unref(message);
 }
 
-void broadcast(const Sock *from, const char *msg, size_t msg_len)
+void disconnect_client(SockLoop *loop, Client *client)
 {
-    pthread_mutex_lock(&pool_lock);
-    for (size_t i = 0; i < POOL_CAPACITY; ++i) {
-        Sock *r = socket_pool[i];
-        if (r != NULL && r != from) {
-            sock_send(r, msg, msg_len);
-        }
+    char username[USERNAME_CAPACITY];
+    size_t username_length = client->username_length;
+    memcpy(username, client->username, username_length);
+
+    sock_loop_remove(loop, client->sock);
+    sock_fanout_unsubscribe(client->sub);
+    sock_close_async(client->sock, CLOSE_TIMEOUT_MS);
+    remove_client(client);
+
+    if (username_length == 0) {
+        printf("INFO: Client disconnected before logging in\n");
+        return;
     }
-    pthread_mutex_unlock(&pool_lock);
+
+    printf("INFO: Client `%.*s` disconnected\n", (int)username_length,
+            username);
+
+    char buffer[BUFFER_CAPACITY];
+    int n = snprintf(buffer, sizeof(buffer), "[Server] `%.*s` left the chat",
+                     (int)username_length, username);
+    broadcast(NULL, buffer, n);
 }
 
-void handle_client(Sock *client, void *user_data)
+void handle_client(SockLoop *loop, Sock *sock, int events, void *user_data)
 {
-    (void) user_data;
+    (void) sock;
+    Client *client = (Client*)user_data;
 
-    if (!add_client(client)) {
-        fprintf(stderr, "ERROR: TCP_Socket pool buffer is full (%d)\n",
-                POOL_CAPACITY);
-        sock_close(client);
+    if (events & SOCK_EVENT_TIMEOUT) {
+        printf("INFO: Client idle for too long\n");
+        disconnect_client(loop, client);
         return;
     }
 
-    printf("INFO: New client connected from %s:%d\n", client->addr.str,
-            client->addr.port);
+    if (events & SOCK_EVENT_WRITE) {
+        sock_subscriber_flush(client->sub);
+    }
+
+    // Hung up, failed or too slow to keep up with the chat
+    if (!(events & (SOCK_EVENT_READ | SOCK_EVENT_WRITE))) {
+        disconnect_client(loop, client);
+        return;
+    }
+
+    if (!(events & SOCK_EVENT_READ)) {
+        return;
+    }
 
-    ssize_t received = 0;
     char buffer[BUFFER_CAPACITY];
-    memset(buffer, 0, sizeof(buffer));
+    ssize_t received = 0;
 
-    char username[USERNAME_CAPACITY];
-    size_t username_length = 0;
-    memset(username, 0, sizeof(username));
+    if (client->username_length == 0) {
+        received = sock_recv(client->sock, client->username,
+                             sizeof(client->username));
+        if (received < 0 && client->sock->last_errno == EAGAIN) {
+            return;
+        }
+        if (received <= 0) {
+            disconnect_client(loop, client);
+            return;
+        }
+        client->username_length = received;
 
-    const char *username_prompt = "username:";
-    size_t prompt_length = strlen(username_prompt);
-    memcpy(buffer, "username: ", prompt_length);
-    sock_send(client, buffer, prompt_length);
-    received = sock_recv(client, username, sizeof(username));
-    if (received < 0) {
-        goto disconnect;
-    }
-    username_length = received;
+        client->sub = sock_fanout_subscribe(chat, client->sock);
+        if (client->sub == NULL) {
+            fprintf(stderr, "ERROR: Could not subscribe client\n");
+            disconnect_client(loop, client);
+            return;
+        }
 
-    printf("INFO: Client login with username `%.*s`\n", (int)username_length,
-            username);
-    received = snprintf(buffer, sizeof(buffer), "[Server] `%.*s` joined the chat",
-                        (int)username_length, username);
-    broadcast(client, buffer, received);
+        printf("INFO: Client login with username `%.*s`\n",
+                (int)client->username_length, client->username);
+        received = snprintf(buffer, sizeof(buffer),
+                            "[Server] `%.*s` joined the chat",
+                            (int)client->username_length, client->username);
+        broadcast(client, buffer, received);
+        return;
+    }
 
-    memcpy(buffer, username, username_length);
-    buffer[username_length] = ':';
-    buffer[username_length + 1] = ' ';
-    size_t prefix_len = username_length + 2;
+    memcpy(buffer, client->username, client->username_length);
+    buffer[client->username_length] = ':';
+    buffer[client->username_length + 1] = ' ';
+    size_t prefix_len = client->username_length + 2;
 
     size_t read_len = sizeof(buffer) - prefix_len;
     char *read_buf = buffer + prefix_len;
 
-    while ((received = sock_recv(client, read_buf, read_len)) > 0) {
-        printf("INFO: %.*s: %.*s\n", (int)username_length, username,
-                (int)received, read_buf);
-        broadcast(client, buffer, received + prefix_len);
+    received = sock_recv(client->sock, read_buf, read_len);
+    if (received < 0 && client->sock->last_errno == EAGAIN) {
+        return;
+    }
+    if (received <= 0) {
+        disconnect_client(loop, client);
+        return;
     }
 
-disconnect:
-    sock_close(client);
-    remove_client(client);
+    printf("INFO: %.*s: %.*s\n", (int)client->username_length,
+            client->username, (int)received, read_buf);
+    broadcast(client, buffer, received + prefix_len);
+}
 
-    printf("INFO: Client `%.*s` disconnected\n", (int)username_length,
-            username);
-    received = snprintf(buffer, sizeof(buffer), "[Server] `%.*s` left the chat",
-            (int)username_length, username);
-    broadcast(client, buffer, received);
+void handle_server(SockLoop *loop, Sock *server, int events, void *user_data)
+{
+    (void) events;
+    (void) user_data;
+
+    Sock *sock = sock_accept(server);
+    if (sock == NULL) {
+        if (server->last_errno != EAGAIN) {
+            fprintf(stderr, "ERROR: Could not accept client\n");
+        }
+        return;
+    }
+
+    Client *client = add_client(sock);
+    if (client == NULL) {
+        fprintf(stderr, "ERROR: Client pool buffer is full (%d)\n",
+                POOL_CAPACITY);
+        sock_close(sock);
+        return;
+    }
+
+    if (!sock_loop_add(loop, sock, SOCK_EVENT_READ, handle_client, client)) {
+        fprintf(stderr, "ERROR: Could not register client: ");
+        sock_log_error(sock);
+        sock_close(sock);
+        remove_client(client);
+        return;
+    }
+
+    // Idle clients would hold their slot of the pool forever
+    sock_loop_set_timeout(loop, sock, IDLE_TIMEOUT_MS);
+
+    printf("INFO: New client connected from %s:%d\n", sock->addr.str,
+            sock->addr.port);
+
+    const char *username_prompt = "username:";
+    sock_send(sock, username_prompt, strlen(username_prompt));
 }
 
 int main(void)
@@ -146,14 +225,40 @@ int main(void)
 
     printf("INFO: Listen socket\n");
 
-    while (true) {
-        if (!sock_async_accept(server, handle_client, NULL)) {
-            fprintf(stderr, "ERROR: Could not accept client\n");
-            continue;
-        }
+    SockLoop *loop = sock_loop_create();
+    if (loop == NULL) {
+        fprintf(stderr, "ERROR: Could not create event loop\n");
+        sock_close(server);
+        return EXIT_FAILURE;
+    }
+
+    fanout = sock_fanout_create(QUEUE_CAPACITY, SOCK_FANOUT_DISCONNECT);
+    if (fanout == NULL || !sock_fanout_attach(fanout, loop)
+            || (chat = sock_fanout_topic(fanout, "chat")) == NULL) {
+        fprintf(stderr, "ERROR: Could not create fanout\n");
+        sock_fanout_destroy(fanout);
+        sock_loop_destroy(loop);
+        sock_close(server);
+        return EXIT_FAILURE;
+    }
+
+    if (!sock_loop_add(loop, server, SOCK_EVENT_READ, handle_server, NULL)) {
+        fprintf(stderr, "ERROR: Could not register server socket\n");
+        sock_fanout_destroy(fanout);
+        sock_loop_destroy(loop);
+        sock_close(server);
+        return EXIT_FAILURE;
+    }
+
+    if (!sock_loop_run(loop)) {
+        fprintf(stderr, "ERROR: Event loop failed\n");
     }
 
+    sock_loop_remove(loop, server);
+    sock_fanout_destroy(fanout);
+    sock_loop_destroy(loop);
     sock_close(server);
+    sock_freelist_trim();
     printf("INFO: Closed socket\n");
 
     return EXIT_SUCCESS;
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SOCK_IO_URING
+#define SOCK_IMPLEMENTATION
+#include "sock.h"
+
+#define PORT 6969
+
+typedef struct {
+    Sock *sock;
+    size_t sends;  // Sends that did not complete yet
+    bool finished; // Whether the client stopped receiving
+} Client;
+
+typedef struct {
+    Client *client;
+    char data[];
+} Echo;
+
+void client_release(Client *client)
+{
+    // A sock must not be closed while operations are pending on it
+    if (client->finished && client->sends == 0) {
+        sock_close(client->sock);
+        free(client);
+    }
+}
+
+void on_send(SockUring *ring, const SockUringCompletion *c, void *user_data)
+{
+    (void) ring;
+    (void) c;
+
+    Echo *echo = (Echo*)user_data;
+    Client *client = echo->client;
+    free(echo);
+
+    client->sends--;
+    client_release(client);
+}
+
+void on_recv(SockUring *ring, const SockUringCompletion *c, void *user_data)
+{
+    Client *client = (Client*)user_data;
+
+    if (c->size == 0) {
+        if (c->error != 0 && c->error != ECANCELED) {
+            fprintf(stderr, "ERROR: recv: %s\n", strerror(c->error));
+        }
+        if (!c->more) {
+            printf("INFO: Client %s:%d disconnected\n", c->sock->addr.str,
+                    c->sock->addr.port);
+            client->finished = true;
+            client_release(client);
+        }
+        return;
+    }
+
+    // Received data is only valid during the callback
+    Echo *echo = (Echo*)malloc(sizeof(*echo) + c->size);
+    if (echo == NULL) {
+        return;
+    }
+    echo->client = client;
+    memcpy(echo->data, c->buf, c->size);
+
+    if (!sock_uring_send(ring, c->sock, echo->data, c->size, on_send, echo)) {
+        free(echo);
+        return;
+    }
+    client->sends++;
+}
+
+void on_accept(SockUring *ring, const SockUringCompletion *c, void *user_data)
+{
+    (void) user_data;
+
+    if (c->error != 0) {
+        fprintf(stderr, "ERROR: accept: %s\n", strerror(c->error));
+        return;
+    }
+
+    printf("INFO: New client connected from %s:%d\n", c->client->addr.str,
+            c->client->addr.port);
+
+    Client *client = (Client*)calloc(1, sizeof(*client));
+    if (client == NULL) {
+        sock_close(c->client);
+        return;
+    }
+    client->sock = c->client;
+
+    if (!sock_uring_recv(ring, c->client, on_recv, client)) {
+        sock_log_error(c->client);
+        sock_close(c->client);
+        free(client);
+    }
+}
+
+int main(void)
+{
+    Sock *server = sock_create(SOCK_IPV4, SOCK_TCP);
+    if (server == NULL) {
+        fprintf(stderr, "ERROR: Could not create socket\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!sock_bind(server, sock_addr("0.0.0.0", PORT))
+            || !sock_listen(server)) {
+        sock_log_error(server);
+        sock_close(server);
+        return EXIT_FAILURE;
+    }
+
+    SockUring *ring = sock_uring_create(0, 0, 0);
+    if (ring == NULL) {
+        fprintf(stderr, "ERROR: Could not create ring\n");
+        sock_close(server);
+        return EXIT_FAILURE;
+    }
+
+    printf("INFO: Using %s backend\n",
+           sock_uring_native(ring) ? "io_uring" : "epoll");
+
+    if (!sock_uring_accept(ring, server, on_accept, NULL)) {
+        sock_log_error(server);
+        sock_uring_destroy(ring);
+        sock_close(server);
+        return EXIT_FAILURE;
+    }
+
+    if (!sock_uring_run(ring)) {
+        fprintf(stderr, "ERROR: Ring failed\n");
+    }
+
+    sock_uring_destroy(ring);
+    sock_close(server);
+    sock_freelist_trim();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SOCK_IMPLEMENTATION
+#include "sock.h"
+
+#define PORT 6969
+#define SEGMENT_SIZE 1200
+#define SEGMENTS 40
+
+int main(void)
+{
+    Sock *server = sock_create(SOCK_IPV4, SOCK_UDP);
+    Sock *client = sock_create(SOCK_IPV4, SOCK_UDP);
+    if (server == NULL || client == NULL) {
+        fprintf(stderr, "ERROR: Could not create sockets\n");
+        return EXIT_FAILURE;
+    }
+
+    SockAddr server_addr = sock_addr("127.0.0.1", PORT);
+    if (!sock_bind(server, server_addr)) {
+        sock_log_error(server);
+        return EXIT_FAILURE;
+    }
+
+    if (!sock_set_gro(server, true)) {
+        fprintf(stderr, "WARNING: UDP_GRO is not supported: ");
+        sock_log_error(server);
+    }
+
+    static uint8_t payload[SEGMENT_SIZE * SEGMENTS];
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)(i / SEGMENT_SIZE);
+    }
+
+    ssize_t sent = sock_sendto_gso(client, payload, sizeof(payload),
+                                   SEGMENT_SIZE, server_addr);
+    if (sent < 0) {
+        sock_log_error(client);
+        return EXIT_FAILURE;
+    }
+    printf("Sent %zd bytes as %d datagrams of %d bytes\n", sent, SEGMENTS,
+           SEGMENT_SIZE);
+
+    static uint8_t buffer[65535];
+    size_t received = 0;
+    while (received < sizeof(payload)) {
+        size_t segment_size = 0;
+        SockAddr from;
+        ssize_t n = sock_recvfrom_gro(server, buffer, sizeof(buffer), &from,
+                                      &segment_size);
+        if (n < 0) {
+            sock_log_error(server);
+            return EXIT_FAILURE;
+        }
+
+        if (memcmp(buffer, payload + received, n) != 0) {
+            fprintf(stderr, "ERROR: Received data does not match\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("Received %zd bytes in segments of %zu bytes from %s:%d\n",
+               n, segment_size, from.str, from.port);
+        received += n;
+    }
+
+    sock_close(client);
+    sock_close(server);
+    sock_freelist_trim();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// The counters of the library are printed along with the results
+#define SOCK_STATS
+#define SOCK_IMPLEMENTATION
+#include "sock.h"
+
+#define DEFAULT_THREADS 2
+#define DEFAULT_CONNECTIONS 10
+#define DEFAULT_DURATION_S 10
+#define CONNECT_TIMEOUT_MS 5000
+#define READER_CAPACITY (64 * 1024)
+#define REQUEST_CAPACITY 4096
+
+// Latencies are recorded in microseconds in a log-linear histogram: values
+// below 2 * LATENCY_SUB_BUCKETS are exact, larger ones are rounded to a
+// LATENCY_SUB_BUCKETS-th of their power of two, that is 1.5% at worst
+#define LATENCY_SUB_BITS 6
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (40 * LATENCY_SUB_BUCKETS)
+
+typedef struct Worker Worker;
+
+typedef struct {
+    Worker *worker;
+    Sock *sock;
+    SockReader *reader;
+    SockWriter *writer;
+    int64_t *pending;       // Intended send times of the requests in flight
+    size_t head;            // Oldest request in flight
+    size_t count;           // Number of requests in flight
+    int64_t next_ns;        // Intended send time of the next request
+    int64_t body_remaining; // HTTP body left to read, -1 while in headers
+    bool writing;           // Whether SOCK_EVENT_WRITE is requested
+} Conn;
+
+struct Worker {
+    pthread_t thread;
+    SockLoop *loop;
+    SockTimer tick;
+    Conn *conns;
+    size_t conn_count;
+    uint64_t completed;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t histogram[LATENCY_BUCKETS];
+};
+
+typedef struct {
+    SockAddr addr;
+    size_t threads;
+    size_t connections; // Per thread
+    int duration_s;
+    double rate;        // Total requests per second, 0 for a closed loop
+    size_t depth;       // Requests in flight per connection
+    char request[REQUEST_CAPACITY];
+    size_t request_size;
+    bool http;
+    size_t response_size; // Raw TCP only
+    int64_t interval_ns;  // Time between two requests of a connection
+    int64_t start_ns;
+    int64_t end_ns;
+} Config;
+
+Config config;
+
+int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+size_t latency_bucket(uint64_t us)
+{
+    if (us < 2 * LATENCY_SUB_BUCKETS) {
+        return us;
+    }
+
+    size_t shift = 63 - __builtin_clzll(us) - LATENCY_SUB_BITS;
+    size_t bucket = (shift << LATENCY_SUB_BITS) + (us >> shift);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+// Returns the middle of the values counted by a bucket
+double latency_value(size_t bucket)
+{
+    if (bucket < 2 * LATENCY_SUB_BUCKETS) {
+        return (double)bucket;
+    }
+
+    size_t shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(bucket - (shift << LATENCY_SUB_BITS)) << shift;
+    return (double)low + (double)((uint64_t)1 << shift) / 2.0;
+}
+
+double latency_percentile(const uint64_t *histogram, uint64_t count,
+                          double percentile)
+{
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return latency_value(i);
+        }
+    }
+
+    return latency_value(LATENCY_BUCKETS - 1);
+}
+
+void conn_close(Conn *conn)
+{
+    conn->worker->errors++;
+    sock_loop_remove(conn->worker->loop, conn->sock);
+    sock_reader_destroy(conn->reader);
+    sock_writer_destroy(conn->writer);
+    sock_close(conn->sock);
+    conn->sock = NULL;
+}
+
+// Sends the requests that are due, as long as the pipeline is not full
+bool conn_pump(Conn *conn, int64_t now)
+{
+    while (conn->count < config.depth && now < config.end_ns) {
+        int64_t intended = now;
+        if (config.rate > 0) {
+            if (conn->next_ns > now) {
+                break;
+            }
+            // Latency is measured from when the request should have been
+            // sent, not from when a busy connection could send it, to avoid
+            // coordinated omission
+            intended = conn->next_ns;
+            conn->next_ns += config.interval_ns;
+        }
+
+        size_t tail = (conn->head + conn->count) % config.depth;
+        conn->pending[tail] = intended;
+        conn->count++;
+
+        if (sock_write(conn->writer, config.request, config.request_size)
+                != (ssize_t)config.request_size) {
+            return false;
+        }
+    }
+
+    bool flushed = sock_flush(conn->writer);
+    if (!flushed && conn->sock->last_errno != EAGAIN) {
+        return false;
+    }
+
+    // Wait for the peer to take the rest of the requests
+    if (flushed == conn->writing) {
+        int events = SOCK_EVENT_READ | (flushed ? 0 : SOCK_EVENT_WRITE);
+        if (!sock_loop_modify(conn->worker->loop, conn->sock, events)) {
+            return false;
+        }
+        conn->writing = !flushed;
+    }
+
+    return true;
+}
+
+// Returns the Content-Length of HTTP response headers, or -1 if the body is
+// chunked, which is not supported
+int64_t http_content_length(const char *headers, size_t size)
+{
+    const char *end = headers + size;
+    const char *line = headers;
+
+    while (line < end) {
+        const char *eol = line;
+        while (eol < end && *eol != '\n') {
+            eol++;
+        }
+
+        size_t len = eol - line;
+        if (len > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+            return strtoll(line + 15, NULL, 10);
+        }
+        if (len > 18 && strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            return -1;
+        }
+
+        line = eol + 1;
+    }
+
+    return 0;
+}
+
+// Reads a complete response. Returns 1 when one was read, 0 when more data is
+// needed and -1 on error.
+int conn_read_response(Conn *conn)
+{
+    const void *data = NULL;
+    ssize_t n = 0;
+
+    if (!config.http) {
+        n = sock_read_exact(conn->reader, config.response_size, &data);
+        if (n < 0) {
+            return conn->sock->last_errno == EAGAIN ? 0 : -1;
+        }
+        conn->worker->bytes += n;
+        return 1;
+    }
+
+    if (conn->body_remaining < 0) {
+        n = sock_read_until(conn->reader, "\r\n\r\n", &data);
+        if (n < 0) {
+            return conn->sock->last_errno == EAGAIN ? 0 : -1;
+        }
+        conn->worker->bytes += n;
+        conn->body_remaining = http_content_length((const char*)data, n);
+        if (conn->body_remaining < 0) {
+            fprintf(stderr, "ERROR: Chunked responses are not supported\n");
+            return -1;
+        }
+    }
+
+    // The body is read in pieces, it may not fit in the reader
+    while (conn->body_remaining > 0) {
+        size_t size = conn->body_remaining < READER_CAPACITY / 2
+                    ? (size_t)conn->body_remaining : READER_CAPACITY / 2;
+        n = sock_read_exact(conn->reader, size, &data);
+        if (n < 0) {
+            return conn->sock->last_errno == EAGAIN ? 0 : -1;
+        }
+        conn->worker->bytes += n;
+        conn->body_remaining -= n;
+    }
+
+    conn->body_remaining = -1;
+    return 1;
+}
+
+void handle_conn(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    (void) loop;
+    (void) sock;
+    Conn *conn = (Conn*)user_data;
+    Worker *worker = conn->worker;
+
+    if (!(events & (SOCK_EVENT_READ | SOCK_EVENT_WRITE))) {
+        conn_close(conn);
+        return;
+    }
+
+    if (events & SOCK_EVENT_READ) {
+        while (true) {
+            int res = conn_read_response(conn);
+            if (res == 0) {
+                break;
+            }
+            if (res < 0 || conn->count == 0) {
+                conn_close(conn);
+                return;
+            }
+
+            int64_t latency_us = (now_ns() - conn->pending[conn->head]) / 1000;
+            conn->head = (conn->head + 1) % config.depth;
+            conn->count--;
+
+            worker->completed++;
+            worker->histogram[latency_bucket(latency_us > 0 ? latency_us : 0)]++;
+        }
+    }
+
+    if (!conn_pump(conn, now_ns())) {
+        conn_close(conn);
+    }
+}
+
+// Sends the requests that became due. The timers of a SockLoop have a
+// resolution of a millisecond, so with a target rate the requests may leave up
+// to a millisecond late, which the corrected latencies account for.
+void handle_tick(SockTimer *timer, void *user_data)
+{
+    Worker *worker = (Worker*)user_data;
+
+    int64_t now = now_ns();
+    if (now >= config.end_ns) {
+        sock_loop_stop(worker->loop);
+        return;
+    }
+
+    for (size_t i = 0; i < worker->conn_count; ++i) {
+        Conn *conn = &worker->conns[i];
+        if (conn->sock != NULL && !conn_pump(conn, now)) {
+            conn_close(conn);
+        }
+    }
+
+    // A closed loop only needs the tick to end the test
+    int timeout_ms = 1;
+    if (config.rate <= 0) {
+        timeout_ms = (int)((config.end_ns - now + 999999) / 1000000);
+    }
+    sock_loop_add_timer(worker->loop, timer, timeout_ms);
+}
+
+void *worker_thread(void *data)
+{
+    Worker *worker = (Worker*)data;
+
+    for (size_t i = 0; i < worker->conn_count; ++i) {
+        Conn *conn = &worker->conns[i];
+        if (conn->sock != NULL && !conn_pump(conn, now_ns())) {
+            conn_close(conn);
+        }
+    }
+
+    sock_timer_init(&worker->tick, handle_tick, worker);
+    handle_tick(&worker->tick, worker);
+
+    if (!sock_loop_run(worker->loop)) {
+        fprintf(stderr, "ERROR: Event loop failed\n");
+    }
+
+    return NULL;
+}
+
+bool worker_init(Worker *worker, size_t index)
+{
+    memset(worker, 0, sizeof(*worker));
+
+    worker->loop = sock_loop_create();
+    worker->conns = (Conn*)calloc(config.connections, sizeof(Conn));
+    if (worker->loop == NULL || worker->conns == NULL) {
+        return false;
+    }
+    worker->conn_count = config.connections;
+
+    size_t total = config.threads * config.connections;
+    for (size_t i = 0; i < config.connections; ++i) {
+        Conn *conn = &worker->conns[i];
+        conn->worker = worker;
+        conn->body_remaining = -1;
+        conn->pending = (int64_t*)calloc(config.depth, sizeof(int64_t));
+        if (conn->pending == NULL) {
+            return false;
+        }
+
+        // Spread the first requests of all connections over an interval,
+        // relative to the start of the test
+        size_t rank = index * config.connections + i;
+        conn->next_ns = config.interval_ns * rank / total;
+
+        conn->sock = sock_create(config.addr.type, SOCK_TCP);
+        if (conn->sock == NULL) {
+            return false;
+        }
+        if (!sock_connect_timeout(conn->sock, config.addr, CONNECT_TIMEOUT_MS)) {
+            fprintf(stderr, "ERROR: Could not connect: ");
+            sock_log_error(conn->sock);
+            return false;
+        }
+        sock_set_nodelay(conn->sock, true);
+
+        conn->reader = sock_reader_create(conn->sock, READER_CAPACITY);
+        conn->writer = sock_writer_create(conn->sock, 0);
+        if (conn->reader == NULL || conn->writer == NULL
+                || !sock_loop_add(worker->loop, conn->sock, SOCK_EVENT_READ,
+                                  handle_conn, conn)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void worker_destroy(Worker *worker)
+{
+    for (size_t i = 0; worker->conns != NULL && i < worker->conn_count; ++i) {
+        Conn *conn = &worker->conns[i];
+        if (conn->sock != NULL) {
+            sock_loop_remove(worker->loop, conn->sock);
+            sock_reader_destroy(conn->reader);
+            sock_writer_destroy(conn->writer);
+            sock_close(conn->sock);
+        }
+        free(conn->pending);
+    }
+
+    free(worker->conns);
+    sock_loop_destroy(worker->loop);
+}
+
+void usage(const char *program_name)
+{
+    fprintf(stderr, "USAGE: %s [options] <address> <port>\n", program_name);
+    fprintf(stderr, "    -t <threads>      Number of threads (default %d)\n",
+            DEFAULT_THREADS);
+    fprintf(stderr, "    -c <connections>  Connections per thread (default %d)\n",
+            DEFAULT_CONNECTIONS);
+    fprintf(stderr, "    -d <seconds>      Duration of the test (default %d)\n",
+            DEFAULT_DURATION_S);
+    fprintf(stderr, "    -R <rate>         Total requests per second, 0 sends as fast as\n");
+    fprintf(stderr, "                      possible (default 0)\n");
+    fprintf(stderr, "    -p <depth>        Requests in flight per connection (default 1)\n");
+    fprintf(stderr, "    -P <path>         Path of the HTTP/1.1 GET requests (default /)\n");
+    fprintf(stderr, "    -m <message>      Send a raw TCP message instead of HTTP requests\n");
+    fprintf(stderr, "    -r <size>         Size of the raw TCP responses (default: the\n");
+    fprintf(stderr, "                      size of the message, as for an echo server)\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *program_name = argv[0];
+    const char *path = "/";
+    const char *message = NULL;
+    long response_size = 0;
+
+    config.threads = DEFAULT_THREADS;
+    config.connections = DEFAULT_CONNECTIONS;
+    config.duration_s = DEFAULT_DURATION_S;
+    config.depth = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:R:p:P:m:r:")) != -1) {
+        switch (opt) {
+        case 't': config.threads = strtoul(optarg, NULL, 10); break;
+        case 'c': config.connections = strtoul(optarg, NULL, 10); break;
+        case 'd': config.duration_s = atoi(optarg); break;
+        case 'R': config.rate = atof(optarg); break;
+        case 'p': config.depth = strtoul(optarg, NULL, 10); break;
+        case 'P': path = optarg; break;
+        case 'm': message = optarg; break;
+        case 'r': response_size = atol(optarg); break;
+        default:
+            usage(program_name);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 2 || config.threads == 0 || config.connections == 0
+            || config.duration_s <= 0 || config.depth == 0 || config.rate < 0) {
+        usage(program_name);
+        return 1;
+    }
+
+    const char *arg_address = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    SockAddrList addrs = sock_dns(arg_address, port, 0, SOCK_TCP);
+    if (addrs.count == 0) {
+        fprintf(stderr, "ERROR: Could not resolve `%s`\n", arg_address);
+        return 1;
+    }
+    config.addr = addrs.items[0];
+    sock_addr_list_free(&addrs);
+
+    int n = 0;
+    if (message != NULL) {
+        n = snprintf(config.request, sizeof(config.request), "%s", message);
+        config.response_size = response_size > 0 ? (size_t)response_size : (size_t)n;
+    } else {
+        config.http = true;
+        n = snprintf(config.request, sizeof(config.request),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s:%d\r\n"
+                     "\r\n", path, arg_address, port);
+    }
+    if (n <= 0 || (size_t)n >= sizeof(config.request)
+            || config.response_size > READER_CAPACITY) {
+        fprintf(stderr, "ERROR: Request or response too large\n");
+        return 1;
+    }
+    config.request_size = n;
+
+    size_t total = config.threads * config.connections;
+    if (config.rate > 0) {
+        config.interval_ns = (int64_t)(1e9 * (double)total / config.rate);
+    }
+
+    Worker *workers = (Worker*)calloc(config.threads, sizeof(Worker));
+    if (workers == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate workers\n");
+        return 1;
+    }
+
+    printf("Running %ds test @ %s:%d\n", config.duration_s, config.addr.str,
+           config.addr.port);
+    printf("  %zu threads and %zu connections, pipeline depth %zu\n",
+           config.threads, total, config.depth);
+    if (config.rate > 0) {
+        printf("  Target rate: %.0f requests/s\n", config.rate);
+    }
+
+    for (size_t i = 0; i < config.threads; ++i) {
+        if (!worker_init(&workers[i], i)) {
+            fprintf(stderr, "ERROR: Could not initialize thread %zu\n", i);
+            return 1;
+        }
+    }
+
+    // Start the schedule now that every connection is open
+    config.start_ns = now_ns();
+    config.end_ns = config.start_ns + (int64_t)config.duration_s * 1000000000;
+    for (size_t i = 0; i < config.threads; ++i) {
+        for (size_t j = 0; j < workers[i].conn_count; ++j) {
+            workers[i].conns[j].next_ns += config.start_ns;
+        }
+    }
+
+    for (size_t i = 0; i < config.threads; ++i) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "ERROR: Could not create thread %zu\n", i);
+            return 1;
+        }
+    }
+
+    uint64_t completed = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    static uint64_t histogram[LATENCY_BUCKETS];
+
+    for (size_t i = 0; i < config.threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        completed += workers[i].completed;
+        bytes += workers[i].bytes;
+        errors += workers[i].errors;
+        for (size_t j = 0; j < LATENCY_BUCKETS; ++j) {
+            histogram[j] += workers[i].histogram[j];
+        }
+        worker_destroy(&workers[i]);
+    }
+    free(workers);
+
+    double seconds = (double)config.duration_s;
+    printf("  %llu requests in %.2fs, %.2f MiB read\n",
+           (unsigned long long)completed, seconds,
+           (double)bytes / (1024 * 1024));
+    printf("Requests/sec: %.2f\n", (double)completed / seconds);
+    printf("Transfer/sec: %.2f MiB\n", (double)bytes / (1024 * 1024) / seconds);
+    if (errors > 0) {
+        printf("Connection errors: %llu\n", (unsigned long long)errors);
+    }
+
+    if (completed > 0) {
+        static const double percentiles[] = { 50, 75, 90, 99, 99.9, 99.99, 100 };
+        printf("Latency distribution%s:\n",
+               config.rate > 0 ? " (corrected for coordinated omission)" : "");
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+            printf("  %7.3f%%  %10.3fms\n", percentiles[i],
+                   latency_percentile(histogram, completed, percentiles[i]) / 1000.0);
+        }
+    }
+
+    SockGlobalStats stats = sock_global_stats();
+    printf("Library: %llu receives, %llu EAGAIN, %llu connects (p99 under %lluus)\n",
+           (unsigned long long)stats.io.recv_calls,
+           (unsigned long long)stats.io.eagain,
+           (unsigned long long)stats.io.connects,
+           (unsigned long long)sock_histogram_percentile(&stats.connect_latency, 99));
+
+    return 0;
+}
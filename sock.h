@@ -4,7 +4,7 @@
     #              @@@@@@                                           #
     #              @    @                                           #
     #              @====@                                           #
-    #              @    @           sock.h - v1.7.3                 #
+    #              @    @           sock.h - v1.30.0                #
     #              @    @             MIT License                   #
     #            @@% .@ @                                           #
     #         @@     @  @    https://github.com/seajee/sock.h       #
@@ -31,6 +31,45 @@
 //         #define SOCK_IMPLEMENTATION
 //         #include "sock.h"
 //
+// [Memory allocation]
+//
+//     All of the memory of the library is allocated with the SOCK_MALLOC,
+//     SOCK_REALLOC and SOCK_FREE macros, which default to the functions of the
+//     C standard library. They can be overridden, all three at once, before
+//     including the implementation:
+//
+//         #define SOCK_MALLOC(size) my_malloc(size)
+//         #define SOCK_REALLOC(ptr, size) my_realloc(ptr, size)
+//         #define SOCK_FREE(ptr) my_free(ptr)
+//         #define SOCK_IMPLEMENTATION
+//         #include "sock.h"
+//
+//     Released Sock objects are kept by each thread in a freelist of up to
+//     SOCK_FREELIST_CAPACITY entries and reused by the next sock_create() or
+//     sock_accept() of the same thread, which avoids the allocator under high
+//     connection churn. Define SOCK_FREELIST_CAPACITY to 0 to disable it.
+//     The freelist of a thread is released when it exits, except for the main
+//     thread, which can release its own with sock_freelist_trim().
+//
+// [Statistics]
+//
+//     When SOCK_STATS is defined before including the implementation, the
+//     library counts the calls and bytes of sock_send(), sock_recv(),
+//     sock_sendto() and sock_recvfrom(), the system calls retried after EINTR,
+//     the calls that failed with EAGAIN, the partial sends of sock_send_all()
+//     and the connects and accepts, successful or not. The durations of the
+//     connects and accepts are also recorded in histograms.
+//
+//         #define SOCK_STATS
+//         #define SOCK_IMPLEMENTATION
+//         #include "sock.h"
+//
+//     Counters are kept in each Sock and in a block owned by each thread, so
+//     counting never takes a lock nor writes memory shared with other
+//     threads. The blocks are only merged when sock_global_stats() is called.
+//     Without SOCK_STATS no counting code is compiled and the snapshots are
+//     empty.
+//
 // [Structure documentation]
 //
 //     Sock:         can be treated as a normal socket
@@ -72,6 +111,10 @@
 //
 // Binds a sock to the specified address. Returns false on error.
 //
+//     bool sock_bind_addr(Sock *sock, const SockAddr *addr)
+//
+// Same as sock_bind() but takes the address by pointer.
+//
 //     bool sock_listen(Sock *sock)
 //
 // Makes a sock listen for incoming connections. Returns false on error.
@@ -90,11 +133,73 @@
 //     void callback(Sock *sock, void *user_data)
 // Returns false on error.
 //
+//     bool sock_pool_accept(Sock *sock, SockThreadPool *pool,
+//                           SockThreadCallback fn, void *user_data)
+//
+// Same as sock_async_accept() but hands the client sock to a worker of the
+// specified SockThreadPool instead of creating a new thread. If the pool
+// rejects the job the client sock is closed and last_errno is set to EBUSY.
+// Returns false on error.
+//
+//     ssize_t sock_accept_batch(Sock *sock, Sock **clients, size_t count,
+//                               int flags)
+//
+// Accepts up to count connections in one go with accept4(), storing the new
+// socks in clients. It waits for the first connection if the sock is
+// blocking and then drains the ones already pending in the backlog. The
+// accepted socks are close-on-exec. If flags contains SOCK_BATCH_NONBLOCK
+// they are non-blocking, ready to be added to a SockLoop, and with
+// SOCK_BATCH_NO_ADDR_STR the str field of their address is left empty. On
+// success returns the number of accepted socks. On error a negative number
+// shall be returned, with last_errno set to EAGAIN when a non-blocking sock
+// has no pending connection.
+//
+//     SockShardedListener *sock_listen_sharded(SockAddr addr, size_t count,
+//                                              SockThreadCallback fn,
+//                                              void *user_data)
+//
+// Creates count listening socks on the same address with SO_REUSEPORT, so
+// the kernel spreads the incoming connections between them, each one owned
+// by a thread pinned to its own CPU. When count is 0 a sock is created per
+// online CPU. Each thread accepts connections with sock_accept_batch() and
+// calls fn with every new client sock, which the callback owns: it runs in
+// the accepting thread, so long jobs should be handed to a SockThreadPool.
+// If the port of addr is 0 the port picked by the kernel is stored in the
+// addr field of the returned SockShardedListener. Returns NULL on error.
+//
+//     void sock_sharded_listener_destroy(SockShardedListener *listener)
+//
+// Stops the threads of a SockShardedListener, closes its socks and releases
+// its memory.
+//
 //     bool sock_connect(Sock *sock, SockAddr addr)
 //
 // Connects a sock on a connection-mode sock (e.g. TCP). Returns false on
 // error.
 //
+//     bool sock_connect_addr(Sock *sock, const SockAddr *addr)
+//
+// Same as sock_connect() but takes the address by pointer.
+//
+//     Sock *sock_connect_any(const SockAddrList *list, int timeout_ms)
+//
+// Connects to the first reachable address of a list, like the ones returned
+// by sock_dns(), following the Happy Eyeballs algorithm (RFC 8305): IPv6 and
+// IPv4 addresses are interleaved and a new non-blocking connection attempt is
+// started every SOCK_CONNECT_ATTEMPT_DELAY_MS milliseconds, or as soon as the
+// previous attempt fails, until one of them succeeds. The other attempts are
+// then closed. The timeout_ms parameter limits the whole operation, -1 waits
+// indefinitely. Returns a new connected TCP sock in blocking mode, or NULL on
+// error with errno set to the reason of the last failure (ETIMEDOUT if the
+// timeout expired).
+//
+//     bool sock_connect_timeout(Sock *sock, SockAddr addr, int timeout_ms)
+//
+// Same as sock_connect() but gives up after timeout_ms milliseconds, in which
+// case last_errno is set to ETIMEDOUT. A negative timeout_ms waits indefinitely
+// like sock_connect(). A sock that timed out should be closed. Returns false on
+// error.
+//
 //     ssize_t sock_send(Sock *sock, const void *buf, size_t size)
 //
 // Same as send() but with socks: sends the content of buf to the specified
@@ -106,6 +211,83 @@
 // Same as sock_send() but ensures that all of the content of buf will be
 // sent. On error a negative value is returned.
 //
+//     ssize_t sock_send_all_until(Sock *sock, const void *buf, size_t size,
+//                                 int64_t deadline)
+//
+// Same as sock_send_all() but stops at deadline, an absolute time in
+// milliseconds as returned by sock_now_ms(). The sock is polled between
+// non-blocking sends, so a slow peer cannot hold the caller past the deadline.
+// The last_errno of the sock is reset when the call starts. Returns the number
+// of bytes sent: if it is less than size the deadline expired and last_errno
+// is set to ETIMEDOUT. On error a negative value is returned.
+//
+//     ssize_t sock_sendv(Sock *sock, const struct iovec *iov, size_t count)
+//
+// Same as sock_send() but gathers the data to send from count buffers
+// described by iov, like writev(). At most SOCK_IOV_MAX buffers are sent in a
+// single call. On success returns the number of bytes sent. On error a
+// negative number shall be returned.
+//
+//     ssize_t sock_sendv_all(Sock *sock, const struct iovec *iov,
+//                            size_t count)
+//
+// Same as sock_sendv() but ensures that all of the content of the buffers
+// will be sent, resuming from the right buffer after a partial send. The iov
+// array is not modified. On error a negative value is returned.
+//
+//     bool sock_set_zerocopy(Sock *sock, bool enable)
+//
+// Enables or disables zero-copy transmissions (SO_ZEROCOPY) on a sock. The
+// copied sends made while it was disabled must have been reported by
+// sock_zerocopy_poll() before enabling it again, otherwise the function fails
+// with last_errno set to EBUSY. Returns false on error, for example when the
+// kernel does not support it.
+//
+//     ssize_t sock_send_zerocopy(Sock *sock, const void *buf, size_t size,
+//                                uint32_t *id)
+//
+// Same as sock_send() but the kernel sends the pages of buf directly instead
+// of copying them. The buffer must not be modified or freed until the kernel
+// releases it, which is reported by sock_zerocopy_poll(). Every successful
+// call is identified by a number stored in id, sequential as long as
+// zero-copy is not toggled and unique among the sends not released yet. If
+// zero-copy was not enabled with sock_set_zerocopy() the data is copied as
+// with sock_send() and the send is reported as released right away. When the
+// kernel cannot pin more pages the function fails with last_errno set to
+// ENOBUFS: poll the completions and try again. On success returns the number
+// of bytes sent. On error a negative number shall be returned.
+//
+//     ssize_t sock_zerocopy_poll(Sock *sock, SockZerocopyRange *ranges,
+//                                size_t count)
+//
+// Reads the zero-copy completions from the error queue of a sock without
+// blocking. Each SockZerocopyRange covers the inclusive range of send ids
+// [lo, hi] whose buffers may be reused; copied is true if the kernel ended up
+// copying the data, in which case zero-copy is not worth it for that
+// destination. A SockLoop reports pending completions with SOCK_EVENT_ERROR.
+// On success returns the number of ranges stored. On error a negative number
+// shall be returned.
+//
+//     ssize_t sock_sendfile(Sock *sock, int file_fd, off_t offset,
+//                           size_t count)
+//
+// Sends up to count bytes of the file referred by file_fd, starting at
+// offset, without copying them through user space. A negative offset sends
+// from the current file position and advances it. Regular files are sent with
+// sendfile(); other kinds of files, like pipes, are moved with splice(). Pipes
+// cannot seek, so their offset must be negative, otherwise last_errno is set
+// to ESPIPE. Other files that cannot seek, like character devices, can only be
+// sent to blocking socks, otherwise last_errno is set to EINVAL. On success
+// returns the number of bytes sent, 0 at the end of the file. On error a
+// negative number shall be returned.
+//
+//     ssize_t sock_sendfile_all(Sock *sock, int file_fd, off_t offset,
+//                               size_t count)
+//
+// Same as sock_sendfile() but keeps sending until count bytes were sent or
+// the end of the file is reached. Returns the number of bytes sent. On error
+// a negative value is returned.
+//
 //     ssize_t sock_recv(Sock *sock, void *buf, size_t size)
 //
 // Same as recv() but with socks: receives a message from sock end writes it
@@ -117,27 +299,689 @@
 // Same as sock_recv() but ensures that the specified size of bytes will be
 // received. On error a negative value is returned.
 //
+//     ssize_t sock_recv_all_until(Sock *sock, void *buf, size_t size,
+//                                 int64_t deadline)
+//
+// Same as sock_recv_all() but stops at deadline, like sock_send_all_until().
+// The last_errno of the sock is reset when the call starts. Returns the number
+// of bytes received: if it is less than size either the peer closed the
+// connection or the deadline expired, in which case last_errno is set to
+// ETIMEDOUT. On error a negative value is returned.
+//
+//     ssize_t sock_recvv(Sock *sock, const struct iovec *iov, size_t count)
+//
+// Same as sock_recv() but scatters the received data into count buffers
+// described by iov, like readv(). On success returns the number of bytes
+// received. On error a negative number shall be returned.
+//
 //     ssize_t sock_sendto(Sock *sock, const void *buf, size_t size, SockAddr addr)
 //
 // Same as sendto() but with socks: the return value works the same way as
 // sock_send(). The addr parameter specifies the address to send the message
 // to.
 //
+//     ssize_t sock_sendto_addr(Sock *sock, const void *buf, size_t size,
+//                              const SockAddr *addr)
+//
+// Same as sock_sendto() but takes the address by pointer, which avoids
+// copying the whole SockAddr for every datagram.
+//
 //     ssize_t sock_recvfrom(Sock *sock, void *buf, size_t size, SockAddr *addr)
 //
 // Same as recvfrom() but with socks: the return value works the same way as
 // sock_recv(). The addr parameter will be filled with the address information
 // of the sender.
 //
+//     void sock_set_lazy_addr(Sock *sock, bool enable)
+//
+// When enabled, the addresses filled by sock_recvfrom(), sock_recvfrom_gro(),
+// sock_recvfrom_batch() and sock_accept() on this sock are not formatted:
+// their str field is left empty until sock_addr_str() is called. Socks
+// accepted from a lazy sock are lazy as well.
+//
+//     ssize_t sock_sendto_batch(Sock *sock, SockMsg *msgs, size_t count)
+//
+// Sends count datagrams with as few system calls as possible using
+// sendmmsg(). Each SockMsg holds the data to send (buf and size) and its
+// destination address (addr). On return the len field of every sent message
+// contains the number of bytes sent. On success returns the number of
+// messages sent, which may be less than count. On error a negative number
+// shall be returned.
+//
+//     ssize_t sock_recvfrom_batch(Sock *sock, SockMsg *msgs, size_t count,
+//                                 int flags)
+//
+// Receives up to count datagrams (at most SOCK_BATCH_MAX) with a single
+// recvmmsg() call. It waits for the first datagram and then returns all of
+// the ones that are immediately available. Each SockMsg shall provide a
+// buffer (buf) and its capacity (size), on return len contains the size of
+// the datagram and addr the address of its sender. If flags contains
+// SOCK_BATCH_NO_ADDR_STR the str field of the addresses is left empty,
+// skipping its formatting. On success returns the number of messages
+// received. On error a negative number shall be returned.
+//
+//     ssize_t sock_sendto_gso(Sock *sock, const void *buf, size_t size,
+//                             size_t segment_size, SockAddr addr)
+//
+// Sends buf to addr as a sequence of datagrams of segment_size bytes each,
+// the last one may be shorter. With UDP segmentation offload (UDP_SEGMENT)
+// the kernel splits the buffer, so up to SOCK_GSO_MAX_SEGMENTS datagrams cost
+// a single system call. If the kernel or the route does not support it, the
+// buffer is split manually and sent with sock_sendto_batch(). On success
+// returns the number of bytes sent. On error a negative number shall be
+// returned.
+//
+//     bool sock_set_gro(Sock *sock, bool enable)
+//
+// Enables or disables UDP receive offload (UDP_GRO) on a sock, allowing the
+// kernel to coalesce consecutive datagrams from the same sender. Returns false
+// on error, for example when the kernel does not support it.
+//
+//     ssize_t sock_recvfrom_gro(Sock *sock, void *buf, size_t size,
+//                               SockAddr *addr, size_t *segment_size)
+//
+// Same as sock_recvfrom() but buf may receive multiple coalesced datagrams.
+// The segment_size parameter will be filled with the size of each datagram,
+// except for the last one that may be shorter. When nothing was coalesced it
+// is the size of the only datagram received. The buffer should be at least
+// 65535 bytes long to not truncate coalesced datagrams.
+//
 //     void sock_close(Sock *sock);
 //
-// Closes a sock and releases its memory.
+// Closes a sock and releases its memory. The connection of a TCP sock is shut
+// down gracefully: the data sent by the peer is discarded until it closes the
+// connection too, which blocks until then.
+//
+//     void sock_close_async(Sock *sock, int timeout_ms)
+//
+// Same as sock_close() but does not block: the memory of the sock is released
+// right away while a background thread discards the data of the peer and
+// closes the connection when the peer closes it, or after timeout_ms
+// milliseconds. A sock registered in a SockLoop or SockUring must be removed
+// from it first.
+//
+//     void sock_close_abort(Sock *sock)
+//
+// Closes a sock without a graceful shutdown: the connection is reset and the
+// data not sent yet is lost. Meant to shed load quickly.
+//
+//     void sock_freelist_trim(void)
+//
+// Releases the memory of the socks kept in the freelist of the calling thread.
+// Other threads release theirs when they exit, but the main thread does not,
+// so it should call this before exiting to leave nothing behind for leak
+// checkers.
 //
 //     void sock_log_error(const Sock *sock)
 //
 // Prints the last error message of the specified Sock in stderr. This
 // functions uses errno to get the error message.
 //
+//     int64_t sock_now_ms(void)
+//
+// Returns the current time of a monotonic clock in milliseconds. Deadlines
+// taken by the *_until() functions are expressed with this clock, e.g.
+// sock_now_ms() + 500 is half a second from now.
+//
+//     bool sock_set_nonblocking(Sock *sock, bool enable)
+//
+// Enables or disables non-blocking mode on a sock. When enabled, I/O
+// functions that would block return an error with last_errno set to EAGAIN.
+// Returns false on error.
+//
+//     bool sock_set_cork(Sock *sock, bool enable)
+//
+// Enables or disables TCP_CORK on a sock: while enabled, partial segments are
+// held until the sock is uncorked, which also covers data sent with
+// sock_sendfile(). Returns false on error.
+//
+//     int sock_set_nodelay(Sock *sock, bool enable)
+//     int sock_set_quickack(Sock *sock, bool enable)
+//     int sock_set_send_buffer(Sock *sock, int size)
+//     int sock_set_recv_buffer(Sock *sock, int size)
+//     int sock_set_busy_poll(Sock *sock, int usec)
+//     int sock_set_notsent_lowat(Sock *sock, int size)
+//
+// Set TCP_NODELAY, TCP_QUICKACK, SO_SNDBUF, SO_RCVBUF, SO_BUSY_POLL and
+// TCP_NOTSENT_LOWAT on a sock. They return the value applied by the kernel,
+// which may differ from the requested one: the buffer sizes are doubled and
+// clamped by the system limits. Setting a buffer size disables its automatic
+// tuning by the kernel. Raising SO_BUSY_POLL above the system default
+// requires CAP_NET_ADMIN. On error a negative number shall be returned.
+//
+//     bool sock_set_keepalive(Sock *sock, int idle_s, int interval_s,
+//                             int count)
+//
+// Enables TCP keepalive probes on a sock: the first one is sent after idle_s
+// seconds without traffic, then every interval_s seconds, and the connection
+// is dropped after count unanswered probes. Zero keeps the system default of
+// interval_s and count, and an idle_s of 0 disables keepalive. Returns false
+// on error.
+//
+//     bool sock_set_profile(Sock *sock, int profile, SockTuning *applied)
+//
+// Tunes a sock for a class of service, profile being a combination of:
+//
+//     SOCK_PROFILE_LOW_LATENCY: TCP_NODELAY, TCP_QUICKACK and a
+//                               TCP_NOTSENT_LOWAT of
+//                               SOCK_PROFILE_NOTSENT_LOWAT bytes
+//     SOCK_PROFILE_THROUGHPUT:  Nagle's algorithm enabled, buffers left to the
+//                               kernel autotuning
+//     SOCK_PROFILE_KEEPALIVE:   keepalive after SOCK_PROFILE_KEEPALIVE_IDLE
+//                               seconds
+//
+// The first two profiles are exclusive, and only apply to TCP socks. If
+// applied is not NULL it is filled like with sock_get_tuning(). Every option
+// is attempted even if one of them fails. Returns false on error.
+//
+//     bool sock_get_tuning(Sock *sock, SockTuning *tuning)
+//
+// Fills tuning with the options currently applied to a sock, -1 for the ones
+// that do not apply to its type. Returns false on error.
+//
+// SockThreadPool related functions:
+//
+// A SockThreadPool is a fixed number of worker threads fed by a bounded job
+// queue. What happens when a job is submitted while the queue is full depends
+// on the policy of the pool:
+//
+//     SOCK_POOL_BLOCK:  wait until a worker frees a slot in the queue
+//     SOCK_POOL_REJECT: fail the submission
+//     SOCK_POOL_INLINE: run the job in the submitting thread
+//
+//     SockThreadPool *sock_thread_pool_create(size_t workers,
+//                     size_t queue_capacity, SockPoolPolicy policy)
+//
+// Allocates a SockThreadPool and starts its workers. When you're done using
+// it you should destroy it with sock_thread_pool_destroy(). Returns NULL on
+// error.
+//
+//     bool sock_thread_pool_submit(SockThreadPool *pool,
+//                                  SockThreadCallback fn, Sock *sock,
+//                                  void *user_data)
+//
+// Queues fn to be called with sock and user_data on a worker thread. The sock
+// parameter may be NULL for jobs that are not related to a sock. Returns false
+// with errno set to EBUSY if the job was rejected.
+//
+//     SockPoolStats sock_thread_pool_stats(SockThreadPool *pool)
+//
+// Returns a snapshot of the statistics of the pool: number of workers, busy
+// workers, queued jobs, jobs run (by workers and inline) and rejections.
+//
+//     void sock_thread_pool_destroy(SockThreadPool *pool)
+//
+// Waits for the queued jobs to be run, stops the workers and releases the
+// memory of the pool.
+//
+// SockConnPool related functions:
+//
+// A SockConnPool keeps connected TCP socks open after use so that later
+// requests to the same SockAddr skip the handshake. It can be shared between
+// threads. Idle socks are handed out most recently used first and checked for
+// liveness before being returned: a sock that was closed by the peer, that
+// has unread data pending or that was idle for too long is discarded.
+//
+//     SockConnPool *sock_conn_pool_create(size_t max_idle,
+//                   size_t max_per_host, int idle_timeout_ms)
+//
+// Allocates a SockConnPool keeping at most max_idle idle socks over all hosts
+// and at most max_per_host open socks (idle and in use) per host, 0 meaning no
+// limit. Idle socks are discarded after idle_timeout_ms milliseconds, or never
+// if it is 0. Returns NULL on error.
+//
+//     Sock *sock_conn_pool_get(SockConnPool *pool, SockAddr addr,
+//                              int timeout_ms)
+//
+// Returns an idle sock connected to addr, or connects a new one. New
+// connections use sock_connect_timeout() when timeout_ms is positive. Returns
+// NULL on error with errno set, to EBUSY if max_per_host socks are already
+// open for addr.
+//
+//     void sock_conn_pool_put(SockConnPool *pool, Sock *sock, bool reuse)
+//
+// Gives back a sock returned by sock_conn_pool_get(). When reuse is false, or
+// when the pool already holds max_idle idle socks, the sock is closed. Only
+// reuse a sock after a complete request/response exchange.
+//
+//     SockConnPoolStats sock_conn_pool_stats(SockConnPool *pool)
+//
+// Returns a snapshot of the statistics of the pool: idle and open socks,
+// checkouts served from the pool or by a new connection and discarded socks.
+//
+//     void sock_conn_pool_destroy(SockConnPool *pool)
+//
+// Closes the idle socks and releases the memory of the pool. Socks still in
+// use must be closed by their owner.
+//
+// SockReader related functions:
+//
+// A SockReader buffers the data received on a TCP sock to split it into
+// messages, filling its buffer with as few sock_recv() calls as possible. The
+// messages are returned as views into that buffer: they stay valid until the
+// next call on the reader. On error a negative number is returned with the
+// last_errno of the sock set, to ENODATA if the peer closed the connection
+// before a complete message, to EMSGSIZE if the message does not fit in the
+// buffer, or to EAGAIN if the sock is non-blocking and the message is not
+// complete yet. In this last case the received data is kept and the call can
+// be repeated once the sock is readable.
+//
+//     SockReader *sock_reader_create(Sock *sock, size_t capacity)
+//
+// Allocates a SockReader reading from sock with a buffer of capacity bytes,
+// or SOCK_READER_DEFAULT_CAPACITY when it is 0, which bounds the size of a
+// message. The sock must only be read through the reader from then on.
+// Returns NULL on error.
+//
+//     ssize_t sock_read_until(SockReader *reader, const char *delim,
+//                             const void **data)
+//
+// Reads up to and including the next occurrence of the delim string. On
+// success points data to the message and returns its size, delim included.
+//
+//     ssize_t sock_read_exact(SockReader *reader, size_t size,
+//                             const void **data)
+//
+// Reads exactly size bytes. On success points data to them and returns size.
+//
+//     ssize_t sock_read_frame(SockReader *reader, SockFrameType type,
+//                             const void **data)
+//
+// Reads a message prefixed by its length, a big-endian integer of 16 bits
+// (SOCK_FRAME_U16) or 32 bits (SOCK_FRAME_U32) that does not count itself.
+// On success points data to the payload and returns its size.
+//
+//     void sock_reader_destroy(SockReader *reader)
+//
+// Releases the memory of a SockReader. The sock is not closed.
+//
+// SockWriter related functions:
+//
+// A SockWriter gathers small writes to a TCP sock in a buffer so that they
+// cost a single system call, and often a single TCP segment. The buffer is
+// sent when a write does not fit in it, together with that write, or when
+// sock_flush() is called. With a non-blocking sock the data that could not be
+// sent stays in the buffer for the next flush.
+//
+//     SockWriter *sock_writer_create(Sock *sock, size_t capacity)
+//
+// Allocates a SockWriter sending to sock with a buffer of capacity bytes, or
+// SOCK_WRITER_DEFAULT_CAPACITY when it is 0. Returns NULL on error.
+//
+//     ssize_t sock_write(SockWriter *writer, const void *buf, size_t size)
+//
+// Appends buf to the buffer, sending the buffer first when buf does not fit.
+// Writes larger than the buffer are sent without being copied. On success
+// returns the number of bytes taken from buf, which may be less than size
+// only for a non-blocking sock. On error a negative number shall be returned.
+//
+//     bool sock_flush(SockWriter *writer)
+//
+// Sends all of the buffered data. Returns false on error, with last_errno set
+// to EAGAIN if a non-blocking sock could not take all of it.
+//
+//     bool sock_writer_cork(SockWriter *writer, bool enable)
+//
+// Corks or uncorks a writer around a response made of several parts. While
+// corked, the buffer is sent with MSG_MORE when it overflows, so the kernel
+// does not send a partial segment. Uncorking flushes the writer. Returns
+// false on error.
+//
+//     void sock_writer_destroy(SockWriter *writer)
+//
+// Releases the memory of a SockWriter, the data not flushed is lost. The sock
+// is not closed.
+//
+// SockResolver related functions:
+//
+// A SockResolver caches the results of sock_dns() lookups, so that names that
+// are resolved repeatedly only hit the system resolver once per TTL. Failed
+// lookups of names that do not exist are cached as well, with their own TTL.
+// Entries are keyed by name and address type and evicted least recently used
+// first. Concurrent lookups of the same name, synchronous or not, are merged
+// into a single query. The cached addresses do not depend on the port, which
+// is applied when the addresses are copied out.
+//
+//     SockResolver *sock_resolver_create(size_t workers, size_t max_entries,
+//                   int ttl_ms, int negative_ttl_ms)
+//
+// Allocates a SockResolver caching up to max_entries names (0 for a default)
+// and running asynchronous lookups on workers threads. Results are cached for
+// ttl_ms milliseconds and unknown names for negative_ttl_ms milliseconds.
+// Returns NULL on error.
+//
+//     bool sock_resolve(SockResolver *resolver, const char *name, int port,
+//                       SockAddrType addr_hint, SockAddrList *list)
+//
+// Resolves name, from the cache when possible, and stores the addresses with
+// the given port in list, whose memory is reused: the list must be zeroed or
+// filled by a previous call, and freed with sock_addr_list_free(). Returns
+// false with errno set on error, to ENOENT if the name does not exist.
+//
+//     bool sock_resolve_async(SockResolver *resolver, const char *name,
+//                             int port, SockAddrType addr_hint,
+//                             SockResolveCallback fn, void *user_data)
+//
+// Same as sock_resolve() but does not block: fn is called with the addresses
+// and an errno value (0 on success) from a worker thread of the resolver, or
+// from the calling thread before returning when the name is cached. The list
+// passed to fn belongs to the callback, which must free it. Returns false on
+// error.
+//
+//     SockResolverStats sock_resolver_stats(SockResolver *resolver)
+//
+// Returns a snapshot of the statistics of the resolver: cached names, cache
+// hits and misses, lookups merged into an in-flight query and evictions.
+//
+//     void sock_resolver_destroy(SockResolver *resolver)
+//
+// Waits for the asynchronous lookups to complete and releases the memory of
+// the resolver.
+//
+// SockLoop related functions:
+//
+// A SockLoop is an event loop built on epoll that lets a single thread drive
+// many non-blocking socks. Socks are registered with an interest mask made of
+// SOCK_EVENT_READ and SOCK_EVENT_WRITE and a callback with the following
+// signature:
+//     void callback(SockLoop *loop, Sock *sock, int events, void *user_data)
+// The events parameter holds the SOCK_EVENT_* flags that are ready.
+// SOCK_EVENT_ERROR and SOCK_EVENT_HUP are always reported.
+//
+//     SockLoop *sock_loop_create(void)
+//
+// Allocates and initializes a new SockLoop. When you're done using it you
+// should destroy it with sock_loop_destroy(). Returns NULL on error.
+//
+//     bool sock_loop_add(SockLoop *loop, Sock *sock, int events,
+//                        SockLoopCallback fn, void *user_data)
+//
+// Registers a sock in the loop with the specified interest mask. The sock is
+// switched to non-blocking mode. Returns false on error.
+//
+//     bool sock_loop_modify(SockLoop *loop, Sock *sock, int events)
+//
+// Changes the interest mask of a sock already registered in the loop.
+// Returns false on error.
+//
+//     bool sock_loop_remove(SockLoop *loop, Sock *sock)
+//
+// Unregisters a sock from the loop. It is safe to call this function from
+// inside a callback, also for socks other than the one being dispatched. A
+// sock must be removed from the loop before being closed. Returns false on
+// error.
+//
+//     bool sock_loop_set_timeout(SockLoop *loop, Sock *sock, int timeout_ms)
+//
+// Sets an idle timeout on a sock registered in the loop: its callback is
+// called with SOCK_EVENT_TIMEOUT when no event was dispatched for it during
+// timeout_ms milliseconds, and again after every further timeout_ms
+// milliseconds of inactivity. A timeout of 0 disables it. Dispatching events
+// does not touch the timer wheel, so this is cheap for any number of socks.
+// Returns false on error.
+//
+//     bool sock_loop_add_timer(SockLoop *loop, SockTimer *timer,
+//                              int timeout_ms)
+//
+// Starts a timer initialized with sock_timer_init() in the timer wheel of the
+// loop, to expire after timeout_ms milliseconds. Its callback is called by
+// the thread running the loop. Returns false on error.
+//
+//     int sock_loop_poll(SockLoop *loop, int timeout_ms)
+//
+// Waits up to timeout_ms milliseconds (-1 waits indefinitely) for events and
+// dispatches them to their callbacks. Returns the number of dispatched events
+// or a negative number on error.
+//
+//     bool sock_loop_run(SockLoop *loop)
+//
+// Runs the loop until sock_loop_stop() is called. Returns false on error.
+//
+//     void sock_loop_stop(SockLoop *loop)
+//
+// Makes sock_loop_run() return as soon as possible. This function can be
+// called from any thread.
+//
+//     void sock_loop_destroy(SockLoop *loop)
+//
+// Releases the memory of a SockLoop. Registered socks are not closed and its
+// running timers are stopped.
+//
+// SockTimerWheel related functions:
+//
+// A SockTimerWheel is a hierarchical timer wheel with a resolution of one
+// millisecond: starting and stopping a timer takes constant time, whatever
+// the number of running timers. Timers are SockTimer structures owned by the
+// caller, usually embedded in a per-connection structure, so the wheel does
+// not allocate memory. Times are expressed with the clock of sock_now_ms().
+// A wheel must only be used by one thread.
+//
+//     SockTimerWheel *sock_timer_wheel_create(void)
+//
+// Allocates a SockTimerWheel. Returns NULL on error.
+//
+//     void sock_timer_init(SockTimer *timer, SockTimerCallback fn,
+//                          void *user_data)
+//
+// Initializes a stopped timer that calls fn with the following signature
+// when it expires:
+//     void callback(SockTimer *timer, void *user_data)
+// The callback may start or stop any timer, including its own.
+//
+//     bool sock_timer_start(SockTimerWheel *wheel, SockTimer *timer,
+//                           int64_t deadline)
+//
+// Starts a timer to expire at deadline, restarting it if it was running.
+// Returns false on error.
+//
+//     void sock_timer_stop(SockTimer *timer)
+//
+// Stops a timer. Stopping a timer that is not running does nothing.
+//
+//     size_t sock_timer_wheel_advance(SockTimerWheel *wheel, int64_t now)
+//
+// Calls the callbacks of the timers that expired at now. Returns the number
+// of expired timers.
+//
+//     int sock_timer_wheel_timeout(const SockTimerWheel *wheel, int64_t now)
+//
+// Returns how many milliseconds the caller may wait before advancing the
+// wheel, suitable as a poll() timeout, or -1 when no timer is running.
+//
+//     void sock_timer_wheel_destroy(SockTimerWheel *wheel)
+//
+// Stops the running timers and releases the memory of a SockTimerWheel.
+//
+// SockFanout related functions:
+//
+// A SockFanout delivers messages published on named topics to the TCP socks
+// subscribed to them. A message is stored once in a refcounted SockMessage
+// shared by all of its subscribers. Publishing only queues a reference to it
+// on every subscriber, without system calls, so its cost does not depend on
+// how fast the peers read. Each subscriber has a bounded lock-free queue
+// that publishers of any thread fill, and that is sent by the thread running
+// the SockLoop the fanout is attached to. When the queue of a subscriber is
+// full, the policy of the fanout decides what happens:
+//
+//     SOCK_FANOUT_DROP:       the message is not delivered to the subscriber
+//     SOCK_FANOUT_DISCONNECT: the subscriber is reported as failed
+//     SOCK_FANOUT_BLOCK:      the publisher waits for room in the queue, it
+//                             must not run in the thread of the SockLoop
+//
+//     SockMessage *sock_message_create(const void *data, size_t size)
+//
+// Allocates a SockMessage holding a copy of data, with a reference count of
+// one. Returns NULL on error.
+//
+//     SockMessage *sock_message_ref(SockMessage *message)
+//     void sock_message_unref(SockMessage *message)
+//
+// Take and release a reference to a message, which is freed with its last
+// reference. These functions can be called from any thread.
+//
+//     SockFanout *sock_fanout_create(size_t queue_capacity,
+//                                    SockFanoutPolicy policy)
+//
+// Allocates a SockFanout whose subscribers queue up to queue_capacity
+// messages, rounded up to a power of two, or
+// SOCK_FANOUT_DEFAULT_QUEUE_CAPACITY when it is 0. Returns NULL on error.
+//
+//     bool sock_fanout_attach(SockFanout *fanout, SockLoop *loop)
+//
+// Makes loop send the queued messages. The subscribed socks should be
+// registered in the same loop: the fanout then waits for SOCK_EVENT_WRITE on
+// them while a peer cannot take more data, and a failed subscriber, either
+// because of a send error or of the SOCK_FANOUT_DISCONNECT policy, is
+// reported to the callback of its sock with SOCK_EVENT_ERROR and the error in
+// last_errno (ENOBUFS for an overflow). Returns false on error.
+//
+//     SockTopic *sock_fanout_topic(SockFanout *fanout, const char *name)
+//
+// Returns the topic with the specified name, creating it if needed. Topics
+// live as long as the fanout. Returns NULL on error.
+//
+//     SockSubscriber *sock_fanout_subscribe(SockTopic *topic, Sock *sock)
+//
+// Subscribes sock to a topic. Returns NULL on error.
+//
+//     void sock_fanout_unsubscribe(SockSubscriber *sub)
+//
+// Unsubscribes a sock, dropping the messages it did not send yet. It must be
+// called from the thread sending the messages, before closing the sock.
+//
+//     size_t sock_fanout_publish(SockTopic *topic, SockMessage *message,
+//                                const Sock *except)
+//
+// Queues message on every subscriber of a topic, except the one of the
+// except sock which may be NULL. The caller keeps its reference to message.
+// This function can be called from any thread. With SOCK_FANOUT_BLOCK, the
+// full subscribers are waited for once the topic was released, so that socks
+// can still be (un)subscribed meanwhile. Returns the number of subscribers the
+// message was queued on.
+//
+//     ssize_t sock_subscriber_flush(SockSubscriber *sub)
+//
+// Sends the messages queued on a subscriber without blocking, gathering them
+// into as few system calls as possible. The loop of the fanout calls it, and
+// so should the callback of the sock on SOCK_EVENT_WRITE. On success returns
+// the number of bytes sent. On error a negative number shall be returned,
+// with last_errno set to EAGAIN if the peer cannot take more data yet.
+//
+//     void sock_fanout_dispatch(SockFanout *fanout)
+//
+// Flushes the subscribers that have messages queued. The loop of an attached
+// fanout calls it, otherwise it is up to the thread sending the messages.
+//
+//     SockFanoutStats sock_fanout_stats(SockFanout *fanout)
+//
+// Returns a snapshot of the statistics of the fanout: messages published,
+// queued, dropped and subscribers that overflowed.
+//
+//     void sock_fanout_destroy(SockFanout *fanout)
+//
+// Unsubscribes the remaining subscribers, detaches the fanout from its loop
+// and releases its memory. The socks are not closed.
+//
+// SockUring related functions:
+//
+// A SockUring delivers completions of accept, receive and send operations to
+// callbacks. When SOCK_IO_URING is defined before including this file and the
+// kernel supports it, operations are batched in an io_uring submission queue:
+// accepts and receives are multishot and receives use a ring of buffers
+// provided to the kernel. Otherwise the same API is emulated on top of a
+// SockLoop. Callbacks shall have the following signature:
+//     void callback(SockUring *ring, const SockUringCompletion *completion,
+//                   void *user_data)
+// Where completion contains the operation, the sock it was submitted on,
+// the number of bytes transferred and an errno value in case of error. Fields
+// that are not described here are documented in the structure definition.
+//
+//     SockUring *sock_uring_create(unsigned entries, size_t buffer_count,
+//                                  size_t buffer_size)
+//
+// Allocates and initializes a new SockUring. The entries parameter is the size
+// of the submission queue, buffer_count and buffer_size describe the buffers
+// used to receive data. Any parameter can be set to 0 to use the defaults.
+// When you're done using it you should destroy it with sock_uring_destroy().
+// Returns NULL on error.
+//
+//     bool sock_uring_native(const SockUring *ring)
+//
+// Returns true if the ring is backed by io_uring, false if it is emulated.
+//
+//     bool sock_uring_accept(SockUring *ring, Sock *sock,
+//                            SockUringCallback fn, void *user_data)
+//
+// Starts accepting connections on a listening sock. A completion is delivered
+// for every new client: the callback owns the client sock and shall close it.
+// Returns false on error.
+//
+//     bool sock_uring_recv(SockUring *ring, Sock *sock,
+//                          SockUringCallback fn, void *user_data)
+//
+// Starts receiving data from a sock. A completion is delivered for every chunk
+// of data received; the data is only valid for the duration of the callback.
+// A completion of size 0 signals that the peer closed the connection. Returns
+// false on error.
+//
+//     bool sock_uring_send(SockUring *ring, Sock *sock, const void *buf,
+//                          size_t size, SockUringCallback fn, void *user_data)
+//
+// Queues a send of buf on a sock. The buffer shall remain valid until the
+// completion is delivered. Like sock_send() less bytes than requested may be
+// sent. Like the other operations, sends never block the ring while the peer
+// cannot take more data. Returns false on error.
+//
+//     bool sock_uring_cancel(SockUring *ring, Sock *sock)
+//
+// Cancels the pending operations of a sock. Every cancelled operation
+// delivers a last completion with error set to ECANCELED. A sock must not be
+// closed while it still has pending operations. Returns false on error.
+//
+//     int sock_uring_poll(SockUring *ring, int timeout_ms)
+//
+// Submits the queued operations, waits up to timeout_ms milliseconds (-1 waits
+// indefinitely) for completions and dispatches them to their callbacks.
+// Returns the number of dispatched completions or a negative number on error.
+//
+//     bool sock_uring_run(SockUring *ring)
+//
+// Runs the ring until sock_uring_stop() is called. Returns false on error.
+//
+//     void sock_uring_stop(SockUring *ring)
+//
+// Makes sock_uring_run() return as soon as possible. This function can be
+// called from any thread.
+//
+//     void sock_uring_destroy(SockUring *ring)
+//
+// Releases the resources of a SockUring. Pending operations are dropped
+// without delivering their completions and their socks are not closed.
+//
+// Statistics related functions:
+//
+// These functions return snapshots of the counters described in the
+// [Statistics] section, they can be called from any thread.
+//
+//     SockStats sock_stats(const Sock *sock)
+//
+// Returns the counters of a sock. The accepts are counted on the listening
+// sock.
+//
+//     SockGlobalStats sock_global_stats(void)
+//
+// Returns the counters of all the socks, summed over the running threads
+// and the ones that already exited, along with the connect and accept
+// latency histograms.
+//
+//     uint64_t sock_histogram_percentile(const SockHistogram *histogram,
+//                                        double percentile)
+//
+// Returns the upper bound in microseconds of the bucket holding the given
+// percentile, between 0 and 100, of a histogram. The result may exceed the
+// real value by up to a factor of two, but is never below it. Returns 0 for
+// an empty histogram.
+//
 // SockAddr related functions:
 //
 //     SockAddr sock_addr(const char *addr, int port)
@@ -146,6 +990,11 @@
 // correctly initialized SockAddr structure. On invalid input, the resulting
 // SockAddr type will be set to SOCK_ADDR_INVALID.
 //
+//     const char *sock_addr_str(SockAddr *addr)
+//
+// Returns the string representation of an address, formatting it into the
+// str field first if it was left empty (see sock_set_lazy_addr()).
+//
 //     SockAddrList sock_dns(const char *addr,
 //                  int port, SockAddrType addr_hint, SockType sock_hint)
 //
@@ -160,24 +1009,123 @@
 //     void sock_addr_list_free(SockAddrList *list)
 //
 // Releases the memory of the specified SockAddrList.
+//
+//     SockAddrList sock_dns_query(const char *name, int port,
+//                  SockAddrType addr_hint, const SockDnsConfig *config)
+//
+// Same as sock_dns() but uses the built-in stub resolver instead of the
+// system one. The A and AAAA queries are sent together over UDP to each name
+// server of config in turn, which has timeout_ms milliseconds to answer, for
+// the configured number of attempts. Truncated answers are queried again over
+// TCP. The name is queried as is, without search domains. When config is
+// NULL, it is loaded from /etc/resolv.conf. IPv6 addresses come first in the
+// list. On failure an empty list is returned with errno set to ENOENT if the
+// name has no address, to EAGAIN if the servers failed and to ETIMEDOUT if
+// they did not answer.
+//
+//     bool sock_dns_config_load(SockDnsConfig *config, const char *path)
+//
+// Reads the name servers and the timeout and attempts options of a
+// resolv.conf file, /etc/resolv.conf when path is NULL. Missing values are set
+// to defaults, with 127.0.0.1 as name server. Returns false if the file could
+// not be read, in which case config only holds defaults. The servers can be
+// changed afterwards, e.g. to use a test server on another port. Release the
+// config with sock_dns_config_free().
+//
+//     void sock_dns_config_free(SockDnsConfig *config)
+//
+// Releases the memory of the specified SockDnsConfig.
 
 #ifndef SOCK_H_
 #define SOCK_H_
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif // SO_ZEROCOPY
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif // MSG_ZEROCOPY
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif // SPLICE_F_MOVE
+#ifndef SPLICE_F_MORE
+#define SPLICE_F_MORE 4
+#endif // SPLICE_F_MORE
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif // UDP_SEGMENT
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif // UDP_GRO
+
+#ifdef SOCK_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#endif // SOCK_IO_URING
+
+#ifndef SOCK_FREELIST_CAPACITY
+#define SOCK_FREELIST_CAPACITY 64
+#endif // SOCK_FREELIST_CAPACITY
 #define SOCK_ADDR_LIST_INITIAL_CAPACITY 16
+#define SOCK_LOOP_MAX_EVENTS 256
+#define SOCK_LOOP_INITIAL_CAPACITY 64
+#define SOCK_POOL_DEFAULT_QUEUE_CAPACITY 1024
+#define SOCK_IOV_MAX 64
+#define SOCK_BATCH_MAX 64
+#define SOCK_GSO_MAX_SEGMENTS 64
+#define SOCK_GSO_MAX_SIZE 65507
+#define SOCK_SPLICE_CHUNK (64 * 1024)
+#define SOCK_CONNECT_ATTEMPT_DELAY_MS 250
+#define SOCK_RESOLVER_DEFAULT_MAX_ENTRIES 1024
+#define SOCK_READER_DEFAULT_CAPACITY (16 * 1024)
+#define SOCK_WRITER_DEFAULT_CAPACITY (16 * 1024)
+#define SOCK_PROFILE_NOTSENT_LOWAT (16 * 1024)
+#define SOCK_FANOUT_DEFAULT_QUEUE_CAPACITY 256
+#define SOCK_CACHE_LINE_SIZE 64
+#define SOCK_TIMER_BITS 8
+#define SOCK_TIMER_SLOTS (1 << SOCK_TIMER_BITS)
+#define SOCK_TIMER_MASK (SOCK_TIMER_SLOTS - 1)
+#define SOCK_TIMER_LEVELS 4
+#define SOCK_HISTOGRAM_BUCKETS 32
+#define SOCK_PROFILE_KEEPALIVE_IDLE 60
+#define SOCK_PROFILE_KEEPALIVE_INTERVAL 10
+#define SOCK_PROFILE_KEEPALIVE_COUNT 6
+#define SOCK_DNS_PORT 53
+#define SOCK_DNS_DEFAULT_TIMEOUT_MS 5000
+#define SOCK_DNS_DEFAULT_ATTEMPTS 2
+#define SOCK_DNS_MAX_QUERY 512
+#define SOCK_DNS_UDP_BUFFER_SIZE 4096
+#define SOCK_URING_DEFAULT_ENTRIES 256
+#define SOCK_URING_DEFAULT_BUFFER_COUNT 256
+#define SOCK_URING_DEFAULT_BUFFER_SIZE 4096
 
 #ifdef __cplusplus
 extern "C" { // Prevent name mangling
@@ -207,19 +1155,120 @@ typedef struct {
     size_t capacity;
 } SockAddrList;
 
+typedef struct {
+    SockAddrList servers; // Name servers, queried in order
+    int timeout_ms;       // Time given to each server to answer
+    int attempts;         // Number of rounds over the servers
+} SockDnsConfig;
+
+typedef struct {
+    uint16_t id;                       // Message id
+    uint16_t type;                     // Record type, A or AAAA
+    bool done;                         // Whether a final answer arrived
+    bool truncated;                    // Whether the answer needs TCP
+    int error;                         // errno of the last answer
+    SockAddrList addrs;                // Addresses of the answer
+    uint8_t query[SOCK_DNS_MAX_QUERY]; // Query message
+    size_t query_len;
+} SockDnsQuestion;
+
 typedef enum {
     SOCK_TYPE_INVALID = 0,
     SOCK_TCP = SOCK_STREAM,
     SOCK_UDP = SOCK_DGRAM
 } SockType;
 
+typedef enum {
+    SOCK__NO_GSO    = 1 << 0, // UDP segmentation offload is not supported
+    SOCK__ZEROCOPY  = 1 << 1, // SO_ZEROCOPY is enabled
+    SOCK__LAZY_ADDR = 1 << 2  // Received addresses are not formatted
+} SockFlags;
+
+typedef enum {
+    SOCK_PROFILE_LOW_LATENCY = 1 << 0, // Send small messages right away
+    SOCK_PROFILE_THROUGHPUT  = 1 << 1, // Favor full segments
+    SOCK_PROFILE_KEEPALIVE   = 1 << 2  // Detect dead peers
+} SockProfile;
+
+typedef struct {
+    int nodelay;            // TCP_NODELAY
+    int quickack;           // TCP_QUICKACK
+    int send_buffer;        // SO_SNDBUF in bytes
+    int recv_buffer;        // SO_RCVBUF in bytes
+    int busy_poll;          // SO_BUSY_POLL in microseconds
+    int notsent_lowat;      // TCP_NOTSENT_LOWAT in bytes
+    int keepalive;          // SO_KEEPALIVE
+    int keepalive_idle;     // TCP_KEEPIDLE in seconds
+    int keepalive_interval; // TCP_KEEPINTVL in seconds
+    int keepalive_count;    // TCP_KEEPCNT
+} SockTuning;
+
+typedef struct {
+    uint64_t send_calls;     // Successful sock_send() calls
+    uint64_t send_bytes;     // Bytes sent by sock_send()
+    uint64_t recv_calls;     // Successful sock_recv() calls
+    uint64_t recv_bytes;     // Bytes received by sock_recv()
+    uint64_t sendto_calls;   // Successful sock_sendto() calls
+    uint64_t sendto_bytes;   // Bytes sent by sock_sendto()
+    uint64_t recvfrom_calls; // Successful sock_recvfrom() calls
+    uint64_t recvfrom_bytes; // Bytes received by sock_recvfrom()
+    uint64_t eintr;          // System calls retried after EINTR
+    uint64_t eagain;         // Calls that failed with EAGAIN
+    uint64_t short_writes;   // Partial sends in sock_send_all()
+    uint64_t accepts;        // Accepted connections
+    uint64_t accept_errors;  // Failed accepts, EAGAIN excluded
+    uint64_t connects;       // Established connections
+    uint64_t connect_errors; // Failed connects
+} SockStats;
+
+typedef struct {
+    uint64_t buckets[SOCK_HISTOGRAM_BUCKETS]; // Samples of [2^i, 2^(i+1)) us
+    uint64_t count;                           // Number of samples
+    uint64_t sum_us;                          // Sum of the samples
+} SockHistogram;
+
+typedef struct {
+    SockStats io;                  // Counters of all the socks
+    SockHistogram connect_latency; // Duration of the successful connects
+    SockHistogram accept_latency;  // Duration of the successful accepts
+} SockGlobalStats;
+
 typedef struct {
-    SockType type;  // Socket type
-    SockAddr addr;  // Socket address
-    int fd;         // File descriptor
-    int last_errno; // Last error about this socket
+    SockType type;          // Socket type
+    SockAddr addr;          // Socket address
+    int fd;                 // File descriptor
+    int last_errno;         // Last error about this socket
+    int flags;              // Internal SockFlags
+    uint32_t zerocopy_next;   // Id of the next zero-copy send
+    uint32_t zerocopy_done;   // First copied send not reported as released
+    uint32_t zerocopy_kernel; // Id the kernel gives to its next zero-copy send
+    SockStats stats;        // Counters, only updated with SOCK_STATS
 } Sock;
 
+typedef struct {
+    uint32_t lo; // First released send id
+    uint32_t hi; // Last released send id
+    bool copied; // Whether the kernel copied the data anyway
+} SockZerocopyRange;
+
+typedef struct {
+    void *buf;     // Datagram data
+    size_t size;   // Size of the data to send or capacity of buf
+    size_t len;    // Number of bytes sent or received
+    SockAddr addr; // Destination or sender address
+} SockMsg;
+
+// Same layout as struct mmsghdr, which is only declared with _GNU_SOURCE
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} SockMmsgHdr;
+
+typedef enum {
+    SOCK_BATCH_NO_ADDR_STR = 1 << 0, // Do not format SockAddr.str
+    SOCK_BATCH_NONBLOCK    = 1 << 1  // Make the accepted socks non-blocking
+} SockBatchFlags;
+
 typedef void (*SockThreadCallback)(Sock *sock, void *user_data);
 
 typedef struct {
@@ -228,6 +1277,403 @@ typedef struct {
     void *user_data;
 } SockThreadData;
 
+typedef enum {
+    SOCK__SLAB_SOCK = 0,    // Sock objects
+    SOCK__SLAB_THREAD_DATA, // SockThreadData objects
+    SOCK__SLAB_COUNT
+} SockSlabKind;
+
+typedef struct SockSlabNode {
+    struct SockSlabNode *next;
+} SockSlabNode;
+
+typedef struct {
+    SockSlabNode *free[SOCK__SLAB_COUNT]; // Released objects of each kind
+    size_t count[SOCK__SLAB_COUNT];
+} SockSlab;
+
+typedef struct SockStatsBlock {
+    SockGlobalStats stats;       // Only written by the owning thread
+    struct SockStatsBlock *prev;
+    struct SockStatsBlock *next;
+} SockStatsBlock;
+
+typedef struct SockReaperEntry {
+    int fd;                       // Connection being closed
+    int64_t deadline;             // When to close it anyway
+    struct SockReaperEntry *prev;
+    struct SockReaperEntry *next;
+} SockReaperEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int epfd;               // epoll file descriptor
+    int wakeup_fd;          // eventfd used when the next deadline changes
+    bool started;           // Whether the reaper thread is running
+    SockReaperEntry *head;  // Connections sorted by deadline
+    SockReaperEntry *tail;
+} SockReaper;
+
+typedef enum {
+    SOCK_POOL_BLOCK = 0, // Wait for a free slot in the queue
+    SOCK_POOL_REJECT,    // Reject the job
+    SOCK_POOL_INLINE     // Run the job in the submitting thread
+} SockPoolPolicy;
+
+typedef struct {
+    size_t workers;        // Number of worker threads
+    size_t busy;           // Workers currently running a job
+    size_t queue_depth;    // Jobs waiting in the queue
+    size_t queue_capacity; // Maximum number of queued jobs
+    uint64_t jobs_run;     // Jobs completed by the workers
+    uint64_t jobs_inline;  // Jobs run by the submitting thread
+    uint64_t rejected;     // Jobs rejected because the queue was full
+} SockPoolStats;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_t *threads;     // Worker threads
+    SockThreadData *jobs;   // Ring buffer of queued jobs
+    size_t head;            // Index of the next job to run
+    SockPoolPolicy policy;  // What to do when the queue is full
+    bool stopping;          // Set by sock_thread_pool_destroy()
+    SockPoolStats stats;
+} SockThreadPool;
+
+typedef struct SockShardedListener SockShardedListener;
+
+typedef struct {
+    SockShardedListener *owner;
+    Sock *sock;       // SO_REUSEPORT listening sock
+    pthread_t thread; // Thread accepting its connections
+    size_t index;     // Index of the shard, used to pick its CPU
+} SockShard;
+
+struct SockShardedListener {
+    SockAddr addr;               // Address shared by the listening socks
+    SockShard *shards;
+    size_t count;                // Number of running shards
+    SockThreadCallback callback; // Called with every accepted sock
+    void *user_data;
+    int stop_fd;                 // eventfd signaled to stop the threads
+};
+
+typedef struct SockConnIdle {
+    Sock *sock;
+    int64_t since;             // When the sock was put back in the pool
+    struct SockConnIdle *next; // Next idle sock of the same host, older
+} SockConnIdle;
+
+typedef struct {
+    SockAddr addr;      // Destination address
+    size_t open;        // Socks of this host idle or in use
+    SockConnIdle *idle; // Idle socks, most recently used first
+} SockConnHost;
+
+typedef struct {
+    size_t idle;      // Idle socks
+    size_t open;      // Socks idle or in use
+    uint64_t hits;    // Checkouts served by an idle sock
+    uint64_t misses;  // Checkouts that opened a new connection
+    uint64_t stale;   // Idle socks discarded as dead or expired
+    uint64_t refused; // Checkouts refused by the per host limit
+} SockConnPoolStats;
+
+typedef struct {
+    pthread_mutex_t lock;
+    SockConnHost *hosts;  // Dynamic array of destinations
+    size_t host_count;
+    size_t host_capacity;
+    size_t max_idle;      // Maximum number of idle socks
+    size_t max_per_host;  // Maximum number of open socks per host
+    int idle_timeout_ms;  // Idle time after which a sock is discarded
+    SockConnPoolStats stats;
+} SockConnPool;
+
+typedef void (*SockResolveCallback)(SockAddrList list, int error,
+                                    void *user_data);
+
+typedef enum {
+    SOCK_FRAME_U16 = 0, // 16 bits big-endian length prefix
+    SOCK_FRAME_U32      // 32 bits big-endian length prefix
+} SockFrameType;
+
+typedef struct {
+    Sock *sock;      // Sock the data is read from
+    uint8_t *data;   // Buffer of capacity bytes
+    size_t capacity;
+    size_t start;    // First byte not returned yet
+    size_t end;      // End of the received data
+    size_t scanned;  // Bytes after start already searched for a delimiter
+} SockReader;
+
+typedef struct {
+    Sock *sock;      // Sock the data is sent to
+    uint8_t *data;   // Buffer of capacity bytes
+    size_t capacity;
+    size_t len;      // Buffered bytes
+    bool corked;     // Whether overflows are sent with MSG_MORE
+} SockWriter;
+
+typedef struct SockResolverWaiter {
+    SockResolveCallback callback;
+    void *user_data;
+    int port;                        // Port to apply to the addresses
+    SockAddrList list;               // Addresses handed to the callback
+    int error;                       // Error handed to the callback
+    struct SockResolverWaiter *next;
+} SockResolverWaiter;
+
+typedef struct SockResolver SockResolver;
+
+typedef struct SockResolverEntry {
+    SockResolver *resolver;
+    char *name;                        // Resolved name
+    uint32_t hash;                     // Hash of the name and hint
+    SockAddrType addr_hint;            // Requested address type
+    SockAddrList list;                 // Addresses, without port
+    int error;                         // Cached errno, 0 on success
+    int64_t expires;                   // When the entry becomes stale
+    bool pending;                      // Whether a query is in flight
+    size_t waiting;                    // Threads waiting for the query
+    SockResolverWaiter *waiters;       // Callbacks waiting for the query
+    struct SockResolverEntry *next;    // Next entry in the hash bucket
+    struct SockResolverEntry *lru_prev;
+    struct SockResolverEntry *lru_next;
+} SockResolverEntry;
+
+typedef struct {
+    size_t entries;     // Cached names
+    uint64_t hits;      // Lookups answered from the cache
+    uint64_t misses;    // Lookups that started a query
+    uint64_t coalesced; // Lookups merged into an in-flight query
+    uint64_t evictions; // Entries evicted to make room for new ones
+} SockResolverStats;
+
+struct SockResolver {
+    pthread_mutex_t lock;
+    pthread_cond_t resolved;     // Signaled when a query completes
+    SockThreadPool *pool;        // Workers running asynchronous queries
+    SockResolverEntry **buckets; // Hash table of entries
+    size_t bucket_count;         // Power of two
+    SockResolverEntry *lru_head; // Most recently used entry
+    SockResolverEntry *lru_tail; // Least recently used entry
+    size_t max_entries;
+    int ttl_ms;
+    int negative_ttl_ms;
+    SockResolverStats stats;
+};
+
+typedef enum {
+    SOCK_EVENT_READ    = 1 << 0, // Sock is readable
+    SOCK_EVENT_WRITE   = 1 << 1, // Sock is writable
+    SOCK_EVENT_ERROR   = 1 << 2, // An error is pending on the sock
+    SOCK_EVENT_HUP     = 1 << 3, // The peer hung up
+    SOCK_EVENT_TIMEOUT = 1 << 4  // The sock was idle for too long
+} SockEvent;
+
+typedef struct SockTimerLink {
+    struct SockTimerLink *prev;
+    struct SockTimerLink *next;
+} SockTimerLink;
+
+typedef struct SockTimer SockTimer;
+typedef struct SockTimerWheel SockTimerWheel;
+
+typedef void (*SockTimerCallback)(SockTimer *timer, void *user_data);
+
+struct SockTimer {
+    SockTimerLink link;         // Position in its slot, must come first
+    int64_t deadline;           // Expiration time in milliseconds
+    SockTimerCallback callback;
+    void *user_data;
+    SockTimerWheel *wheel;      // Wheel the timer runs in, NULL if stopped
+};
+
+struct SockTimerWheel {
+    int64_t current; // Next tick to expire
+    size_t count;    // Running timers
+    SockTimerLink slots[SOCK_TIMER_LEVELS][SOCK_TIMER_SLOTS];
+};
+
+typedef struct SockLoop SockLoop;
+
+typedef void (*SockLoopCallback)(SockLoop *loop, Sock *sock, int events,
+                                 void *user_data);
+
+typedef struct SockLoopEntry {
+    Sock *sock;
+    SockLoopCallback callback;
+    void *user_data;
+    int events;                 // Interest mask of SOCK_EVENT_* flags
+    bool removed;               // Removed while dispatching
+    struct SockLoopEntry *next; // Next removed entry waiting to be freed
+    SockTimer idle_timer;       // Reports SOCK_EVENT_TIMEOUT
+    int idle_timeout_ms;        // Zero when there is no idle timeout
+    int64_t last_activity;      // Time of the last dispatched event
+} SockLoopEntry;
+
+struct SockLoop {
+    int epfd;                  // epoll file descriptor
+    int wakeup_fd;             // eventfd used by sock_loop_stop()
+    bool running;              // Whether sock_loop_run() should keep going
+    bool dispatching;          // Whether callbacks are being dispatched
+    SockLoopEntry **entries;   // Registered entries indexed by fd
+    size_t capacity;
+    SockLoopEntry *removed;    // Entries to free after dispatching
+    int64_t now;               // Time of the last poll
+    SockTimerWheel timers;     // Idle timeouts and timers of the loop
+    struct epoll_event events[SOCK_LOOP_MAX_EVENTS];
+};
+
+typedef struct {
+    uint8_t *data; // Content of the message
+    size_t size;
+    uint32_t refs; // Reference count, updated atomically
+} SockMessage;
+
+typedef enum {
+    SOCK_FANOUT_DROP = 0,   // Drop the message for the slow subscriber
+    SOCK_FANOUT_DISCONNECT, // Report the slow subscriber as failed
+    SOCK_FANOUT_BLOCK       // Wait for room in the queue
+} SockFanoutPolicy;
+
+typedef struct {
+    uint64_t published;  // Calls to sock_fanout_publish()
+    uint64_t queued;     // Messages queued on subscribers
+    uint64_t dropped;    // Messages dropped because of a full queue
+    uint64_t overflowed; // Subscribers failed because of a full queue
+} SockFanoutStats;
+
+typedef struct {
+    size_t sequence;      // Lap of the queue the cell is ready for
+    SockMessage *message;
+} SockFanoutCell;
+
+typedef struct SockFanout SockFanout;
+typedef struct SockTopic SockTopic;
+
+typedef struct SockSubscriber {
+    SockTopic *topic;
+    Sock *sock;                            // Sock the messages are sent to
+    SockFanoutCell *cells;                 // Queue of messages to send
+    size_t mask;                           // Capacity of the queue minus one
+    size_t enqueue_pos;                    // Next cell filled by publishers
+    uint8_t padding[SOCK_CACHE_LINE_SIZE]; // Keeps the positions apart
+    size_t dequeue_pos;                    // Next cell sent by the owner
+    SockMessage *inflight[SOCK_IOV_MAX];   // Messages being sent
+    size_t inflight_count;
+    size_t offset;                         // Bytes of inflight[0] sent
+    uint32_t refs;                         // Owner and ready stack references
+    bool scheduled;                        // Whether it is in the ready stack
+    bool overflowed;                       // Failed by SOCK_FANOUT_DISCONNECT
+    bool closed;                           // Unsubscribed
+    bool watching;                         // SOCK_EVENT_WRITE added by the fanout
+    struct SockSubscriber *next_ready;
+} SockSubscriber;
+
+struct SockTopic {
+    SockFanout *fanout;
+    char *name;
+    pthread_rwlock_t lock;  // Publishers read, (un)subscriptions write
+    SockSubscriber **subs;
+    size_t count;
+    size_t capacity;
+};
+
+struct SockFanout {
+    pthread_mutex_t lock;    // Protects the topics and blocked publishers
+    pthread_cond_t space;    // Signaled when queues get room
+    size_t waiters;          // Publishers waiting for room
+    SockTopic **topics;
+    size_t topic_count;
+    size_t queue_capacity;   // Capacity of the subscriber queues
+    SockFanoutPolicy policy;
+    SockSubscriber *ready;   // Stack of subscribers with queued messages
+    int event_fd;            // eventfd signaled when ready gets filled
+    Sock event_sock;         // event_fd as registered in the loop
+    SockLoop *loop;
+    SockFanoutStats stats;
+};
+
+typedef enum {
+    SOCK_URING_ACCEPT,
+    SOCK_URING_RECV,
+    SOCK_URING_SEND
+} SockUringOp;
+
+typedef struct {
+    SockUringOp op;  // Operation that completed
+    Sock *sock;      // Sock the operation was submitted on
+    Sock *client;    // Accepted client (SOCK_URING_ACCEPT only)
+    const void *buf; // Received or sent data
+    size_t size;     // Number of bytes received or sent
+    int error;       // errno value of the operation, 0 on success
+    bool more;       // Whether the operation will deliver more completions
+} SockUringCompletion;
+
+typedef struct SockUring SockUring;
+
+typedef void (*SockUringCallback)(SockUring *ring,
+                                  const SockUringCompletion *completion,
+                                  void *user_data);
+
+typedef struct SockUringRequest {
+    SockUring *ring;                  // Ring owning the request
+    SockUringOp op;
+    Sock *sock;
+    SockUringCallback callback;
+    void *user_data;
+    const void *buf;                  // Buffer of a send
+    size_t size;                      // Size of a send
+    int error;                        // Error of a completed emulated request
+    bool cancelled;                   // Cancelled by sock_uring_cancel()
+    bool blocked;                     // Emulated send waiting for room
+    struct SockUringRequest *prev;    // Pending requests list
+    struct SockUringRequest *next;
+} SockUringRequest;
+
+struct SockUring {
+    bool native;                 // Whether io_uring is in use
+    bool running;                // Whether sock_uring_run() should keep going
+    int wakeup_fd;               // eventfd used by sock_uring_stop()
+    SockUringRequest *pending;   // Requests that did not complete yet
+    uint8_t *buffers;            // Buffers used to receive data
+    size_t buffer_count;
+    size_t buffer_size;
+
+    // io_uring backend
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local_tail;      // Tail including not yet submitted entries
+    unsigned to_submit;          // Entries not yet submitted
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    uint16_t buf_ring_tail;
+
+    // SockLoop emulation
+    SockLoop *loop;
+    SockUringRequest *completed; // Completed requests to dispatch, in order
+    SockUringRequest *completed_last;
+    size_t blocked_sends;        // Sends waiting for room in their sock
+};
+
 // Create a socket with the corresponding domain and type
 Sock *sock_create(SockAddrType domain, SockType type);
 
@@ -237,11 +1683,22 @@ SockAddr sock_addr(const char *addr, int port);
 // Get all possible addresses from DNS with optional hints
 SockAddrList sock_dns(const char *addr, int port, SockAddrType addr_hint, SockType sock_hint);
 
+// Get the string representation of an address
+const char *sock_addr_str(SockAddr *addr);
+
 // Free a SockAddrList structure
 void sock_addr_list_free(SockAddrList *list);
 
+// Resolve an address with the built-in stub resolver
+SockAddrList sock_dns_query(const char *name, int port, SockAddrType addr_hint, const SockDnsConfig *config);
+
+// Load and free a stub resolver configuration
+bool sock_dns_config_load(SockDnsConfig *config, const char *path);
+void sock_dns_config_free(SockDnsConfig *config);
+
 // Bind a socket to a specific address
 bool sock_bind(Sock *sock, SockAddr addr);
+bool sock_bind_addr(Sock *sock, const SockAddr *addr);
 
 // Make the socket listen to incoming connections
 bool sock_listen(Sock *sock);
@@ -252,32 +1709,351 @@ Sock *sock_accept(Sock *sock);
 // Accept connections from a socket and handle them into a separate thread
 bool sock_async_accept(Sock *sock, SockThreadCallback fn, void *user_data);
 
+// Accept connections from a socket and handle them in a thread pool
+bool sock_pool_accept(Sock *sock, SockThreadPool *pool, SockThreadCallback fn, void *user_data);
+
+// Accept all the pending connections of a socket
+ssize_t sock_accept_batch(Sock *sock, Sock **clients, size_t count, int flags);
+
+// Accept connections from SO_REUSEPORT sockets owned by CPU-pinned threads
+SockShardedListener *sock_listen_sharded(SockAddr addr, size_t count, SockThreadCallback fn, void *user_data);
+void sock_sharded_listener_destroy(SockShardedListener *listener);
+
 // Connect a socket to a specific address
 bool sock_connect(Sock *sock, SockAddr addr);
+bool sock_connect_addr(Sock *sock, const SockAddr *addr);
+
+// Connect a socket to a specific address with a timeout
+bool sock_connect_timeout(Sock *sock, SockAddr addr, int timeout_ms);
+
+// Connect to the first reachable address of a list
+Sock *sock_connect_any(const SockAddrList *list, int timeout_ms);
 
 // Send data through a socket
 ssize_t sock_send(Sock *sock, const void *buf, size_t size);
 ssize_t sock_send_all(Sock *sock, const void *buf, size_t size);
+ssize_t sock_send_all_until(Sock *sock, const void *buf, size_t size, int64_t deadline);
+ssize_t sock_sendv(Sock *sock, const struct iovec *iov, size_t count);
+ssize_t sock_sendv_all(Sock *sock, const struct iovec *iov, size_t count);
+
+// Send data through a socket without copying it
+bool sock_set_zerocopy(Sock *sock, bool enable);
+ssize_t sock_send_zerocopy(Sock *sock, const void *buf, size_t size, uint32_t *id);
+ssize_t sock_zerocopy_poll(Sock *sock, SockZerocopyRange *ranges, size_t count);
+
+// Send the content of a file through a socket
+ssize_t sock_sendfile(Sock *sock, int file_fd, off_t offset, size_t count);
+ssize_t sock_sendfile_all(Sock *sock, int file_fd, off_t offset, size_t count);
 
 // Receive data from a socket
 ssize_t sock_recv(Sock *sock, void *buf, size_t size);
 ssize_t sock_recv_all(Sock *sock, void *buf, size_t size);
+ssize_t sock_recv_all_until(Sock *sock, void *buf, size_t size, int64_t deadline);
+ssize_t sock_recvv(Sock *sock, const struct iovec *iov, size_t count);
 
 // Send data through a socket in connectionless mode
 ssize_t sock_sendto(Sock *sock, const void *buf, size_t size, SockAddr addr);
+ssize_t sock_sendto_addr(Sock *sock, const void *buf, size_t size, const SockAddr *addr);
 
 // Receive data from a socket in connectionless mode
 ssize_t sock_recvfrom(Sock *sock, void *buf, size_t size, SockAddr *addr);
 
+// Only format received addresses on demand
+void sock_set_lazy_addr(Sock *sock, bool enable);
+
+// Send and receive multiple datagrams at once
+ssize_t sock_sendto_batch(Sock *sock, SockMsg *msgs, size_t count);
+ssize_t sock_recvfrom_batch(Sock *sock, SockMsg *msgs, size_t count, int flags);
+
+// Send and receive datagrams with UDP segmentation offloads
+ssize_t sock_sendto_gso(Sock *sock, const void *buf, size_t size, size_t segment_size, SockAddr addr);
+bool sock_set_gro(Sock *sock, bool enable);
+ssize_t sock_recvfrom_gro(Sock *sock, void *buf, size_t size, SockAddr *addr, size_t *segment_size);
+
 // Close a socket
 void sock_close(Sock *sock);
+void sock_close_async(Sock *sock, int timeout_ms);
+void sock_close_abort(Sock *sock);
+
+// Release the socks kept for reuse by the calling thread
+void sock_freelist_trim(void);
 
 // Log last error to stderr
 void sock_log_error(const Sock *sock);
 
+// Get the time of a monotonic clock in milliseconds
+int64_t sock_now_ms(void);
+
+// Enable or disable non-blocking mode on a socket
+bool sock_set_nonblocking(Sock *sock, bool enable);
+
+// Enable or disable TCP_CORK on a socket
+bool sock_set_cork(Sock *sock, bool enable);
+
+// Set socket options, returning the values applied by the kernel
+int sock_set_nodelay(Sock *sock, bool enable);
+int sock_set_quickack(Sock *sock, bool enable);
+int sock_set_send_buffer(Sock *sock, int size);
+int sock_set_recv_buffer(Sock *sock, int size);
+int sock_set_busy_poll(Sock *sock, int usec);
+int sock_set_notsent_lowat(Sock *sock, int size);
+bool sock_set_keepalive(Sock *sock, int idle_s, int interval_s, int count);
+
+// Tune a socket for a class of service
+bool sock_set_profile(Sock *sock, int profile, SockTuning *applied);
+
+// Get the options applied to a socket
+bool sock_get_tuning(Sock *sock, SockTuning *tuning);
+
+// Create a pool of worker threads
+SockThreadPool *sock_thread_pool_create(size_t workers, size_t queue_capacity, SockPoolPolicy policy);
+
+// Submit a job to a thread pool
+bool sock_thread_pool_submit(SockThreadPool *pool, SockThreadCallback fn, Sock *sock, void *user_data);
+
+// Get the statistics of a thread pool
+SockPoolStats sock_thread_pool_stats(SockThreadPool *pool);
+
+// Wait for the queued jobs and destroy a thread pool
+void sock_thread_pool_destroy(SockThreadPool *pool);
+
+// Create a pool of idle client connections
+SockConnPool *sock_conn_pool_create(size_t max_idle, size_t max_per_host, int idle_timeout_ms);
+
+// Get a connected socket from a connection pool and give it back
+Sock *sock_conn_pool_get(SockConnPool *pool, SockAddr addr, int timeout_ms);
+void sock_conn_pool_put(SockConnPool *pool, Sock *sock, bool reuse);
+
+// Get the statistics of a connection pool
+SockConnPoolStats sock_conn_pool_stats(SockConnPool *pool);
+
+// Close the idle connections and destroy a connection pool
+void sock_conn_pool_destroy(SockConnPool *pool);
+
+// Create a buffered reader of socket messages
+SockReader *sock_reader_create(Sock *sock, size_t capacity);
+
+// Read a message ending with a delimiter, of a fixed size or length-prefixed
+ssize_t sock_read_until(SockReader *reader, const char *delim, const void **data);
+ssize_t sock_read_exact(SockReader *reader, size_t size, const void **data);
+ssize_t sock_read_frame(SockReader *reader, SockFrameType type, const void **data);
+
+// Destroy a buffered reader
+void sock_reader_destroy(SockReader *reader);
+
+// Create a buffered writer of socket messages
+SockWriter *sock_writer_create(Sock *sock, size_t capacity);
+
+// Buffer data and send it when the buffer is full or flushed
+ssize_t sock_write(SockWriter *writer, const void *buf, size_t size);
+bool sock_flush(SockWriter *writer);
+
+// Hold partial segments while a multi-part message is written
+bool sock_writer_cork(SockWriter *writer, bool enable);
+
+// Destroy a buffered writer
+void sock_writer_destroy(SockWriter *writer);
+
+// Create a caching DNS resolver
+SockResolver *sock_resolver_create(size_t workers, size_t max_entries, int ttl_ms, int negative_ttl_ms);
+
+// Resolve a name through a resolver cache
+bool sock_resolve(SockResolver *resolver, const char *name, int port, SockAddrType addr_hint, SockAddrList *list);
+bool sock_resolve_async(SockResolver *resolver, const char *name, int port, SockAddrType addr_hint, SockResolveCallback fn, void *user_data);
+
+// Get the statistics of a resolver
+SockResolverStats sock_resolver_stats(SockResolver *resolver);
+
+// Wait for the pending lookups and destroy a resolver
+void sock_resolver_destroy(SockResolver *resolver);
+
+// Create an event loop
+SockLoop *sock_loop_create(void);
+
+// Register, modify and unregister sockets in an event loop
+bool sock_loop_add(SockLoop *loop, Sock *sock, int events, SockLoopCallback fn, void *user_data);
+bool sock_loop_modify(SockLoop *loop, Sock *sock, int events);
+bool sock_loop_remove(SockLoop *loop, Sock *sock);
+
+// Set an idle timeout on a socket of an event loop
+bool sock_loop_set_timeout(SockLoop *loop, Sock *sock, int timeout_ms);
+
+// Start a timer in an event loop
+bool sock_loop_add_timer(SockLoop *loop, SockTimer *timer, int timeout_ms);
+
+// Wait for events and dispatch them to their callbacks
+int sock_loop_poll(SockLoop *loop, int timeout_ms);
+
+// Run an event loop until it is stopped
+bool sock_loop_run(SockLoop *loop);
+
+// Stop a running event loop
+void sock_loop_stop(SockLoop *loop);
+
+// Destroy an event loop
+void sock_loop_destroy(SockLoop *loop);
+
+// Create a timer wheel
+SockTimerWheel *sock_timer_wheel_create(void);
+
+// Initialize, start and stop a timer
+void sock_timer_init(SockTimer *timer, SockTimerCallback fn, void *user_data);
+bool sock_timer_start(SockTimerWheel *wheel, SockTimer *timer, int64_t deadline);
+void sock_timer_stop(SockTimer *timer);
+
+// Expire the timers of a wheel and get the time until the next one
+size_t sock_timer_wheel_advance(SockTimerWheel *wheel, int64_t now);
+int sock_timer_wheel_timeout(const SockTimerWheel *wheel, int64_t now);
+
+// Destroy a timer wheel
+void sock_timer_wheel_destroy(SockTimerWheel *wheel);
+
+// Create and reference count messages shared by the subscribers of a fanout
+SockMessage *sock_message_create(const void *data, size_t size);
+SockMessage *sock_message_ref(SockMessage *message);
+void sock_message_unref(SockMessage *message);
+
+// Create a fanout and attach it to an event loop
+SockFanout *sock_fanout_create(size_t queue_capacity, SockFanoutPolicy policy);
+bool sock_fanout_attach(SockFanout *fanout, SockLoop *loop);
+
+// Get a topic and subscribe or unsubscribe sockets to it
+SockTopic *sock_fanout_topic(SockFanout *fanout, const char *name);
+SockSubscriber *sock_fanout_subscribe(SockTopic *topic, Sock *sock);
+void sock_fanout_unsubscribe(SockSubscriber *sub);
+
+// Publish a message to the subscribers of a topic
+size_t sock_fanout_publish(SockTopic *topic, SockMessage *message, const Sock *except);
+
+// Send the messages queued on subscribers
+ssize_t sock_subscriber_flush(SockSubscriber *sub);
+void sock_fanout_dispatch(SockFanout *fanout);
+
+// Get the statistics of a fanout
+SockFanoutStats sock_fanout_stats(SockFanout *fanout);
+
+// Destroy a fanout
+void sock_fanout_destroy(SockFanout *fanout);
+
+// Create a completion based I/O ring
+SockUring *sock_uring_create(unsigned entries, size_t buffer_count, size_t buffer_size);
+
+// Check whether a ring is backed by io_uring
+bool sock_uring_native(const SockUring *ring);
+
+// Queue operations on a ring
+bool sock_uring_accept(SockUring *ring, Sock *sock, SockUringCallback fn, void *user_data);
+bool sock_uring_recv(SockUring *ring, Sock *sock, SockUringCallback fn, void *user_data);
+bool sock_uring_send(SockUring *ring, Sock *sock, const void *buf, size_t size, SockUringCallback fn, void *user_data);
+
+// Cancel the pending operations of a socket
+bool sock_uring_cancel(SockUring *ring, Sock *sock);
+
+// Submit operations, wait for completions and dispatch them
+int sock_uring_poll(SockUring *ring, int timeout_ms);
+
+// Run a ring until it is stopped
+bool sock_uring_run(SockUring *ring);
+
+// Stop a running ring
+void sock_uring_stop(SockUring *ring);
+
+// Destroy a ring
+void sock_uring_destroy(SockUring *ring);
+
+// Get the counters of a sock
+SockStats sock_stats(const Sock *sock);
+
+// Get the counters and latency histograms of all the threads
+SockGlobalStats sock_global_stats(void);
+
+// Get a percentile of a latency histogram in microseconds
+uint64_t sock_histogram_percentile(const SockHistogram *histogram, double percentile);
+
 // Private functions
+void *sock__slab_alloc(SockSlabKind kind);
+void sock__slab_free(SockSlabKind kind, void *ptr);
+void sock__slab_destroy(void *data);
+void sock__slab_init(void);
+void sock__reaper_init(void);
+void *sock__reaper_thread(void *data);
+void sock__reaper_unlink(SockReaperEntry *entry);
+Sock *sock__listen_reuseport(SockAddr *addr);
+bool sock__reader_fill(SockReader *reader, size_t needed);
+ssize_t sock__sendv(Sock *sock, const struct iovec *iov, size_t count, int flags);
+ssize_t sock__writer_send(SockWriter *writer, const void *buf, size_t size, int flags);
+int sock__set_option(Sock *sock, int level, int name, int value);
+int sock__get_option(Sock *sock, int level, int name, bool *ok);
+void sock__fanout_ready(SockLoop *loop, Sock *sock, int events, void *user_data);
+bool sock__subscriber_push(SockSubscriber *sub, SockMessage *message);
+SockMessage *sock__subscriber_pop(SockSubscriber *sub);
+void sock__subscriber_schedule(SockSubscriber *sub);
+bool sock__subscriber_wait(SockSubscriber *sub, SockMessage *message);
+void sock__subscriber_watch(SockSubscriber *sub, bool blocked);
+void sock__subscriber_report(SockSubscriber *sub);
+void sock__subscriber_unref(SockSubscriber *sub);
+void sock__timer_wheel_init(SockTimerWheel *wheel, int64_t now);
+void sock__timer_wheel_insert(SockTimerWheel *wheel, SockTimer *timer);
+void sock__timer_list_take(SockTimerLink *slot, SockTimerLink *list);
+void sock__timer_wheel_clear(SockTimerWheel *wheel);
+void sock__loop_idle_expired(SockTimer *timer, void *user_data);
+void sock__stats_init(void);
+void sock__stats_retire(void *data);
+SockStatsBlock *sock__stats_block_get(void);
+void sock__stats_add(Sock *sock, size_t offset, uint64_t n);
+void sock__stats_io(Sock *sock, size_t offset, uint64_t bytes);
+void sock__stats_latency(size_t offset, int64_t start_us);
+void sock__stats_merge(SockGlobalStats *dst, const SockGlobalStats *src);
+int64_t sock__now_us(void);
+void sock__pin_cpu(size_t index);
+void *sock__shard_thread(void *data);
 void *sock__accept_thread(void *data);
+void *sock__pool_worker(void *data);
 void sock__convert_addr(SockAddr *addr);
+void sock__parse_addr(SockAddr *addr);
+void sock__received_addr(const Sock *sock, SockAddr *addr);
+bool sock__addr_equal(const SockAddr *a, const SockAddr *b);
+int sock__dns(const char *addr, int port, SockAddrType addr_hint, SockType sock_hint, SockAddrList *list);
+bool sock__addr_list_copy(SockAddrList *dst, const SockAddrList *src, int port);
+bool sock__addr_list_push(SockAddrList *list, const SockAddr *addr);
+uint16_t sock__dns_id(void);
+bool sock__dns_question(SockDnsQuestion *q, const char *name, uint16_t type);
+bool sock__dns_answer(SockDnsQuestion *q, const uint8_t *msg, size_t len, int port);
+void sock__dns_exchange(SockDnsQuestion *questions, size_t count, const SockAddr *server, int timeout_ms, int port);
+void sock__dns_tcp(SockDnsQuestion *q, const SockAddr *server, int timeout_ms, int port);
+SockResolverEntry *sock__resolver_entry(SockResolver *resolver, const char *name, SockAddrType addr_hint);
+void sock__resolver_touch(SockResolver *resolver, SockResolverEntry *entry);
+void sock__resolver_evict(SockResolver *resolver);
+void sock__resolver_query(Sock *sock, void *data);
+SockConnHost *sock__conn_host(SockConnPool *pool, const SockAddr *addr, bool create);
+bool sock__conn_alive(Sock *sock);
+bool sock__conn_discard(SockConnPool *pool, SockConnHost *host, Sock *sock);
+bool sock__wait(Sock *sock, short events, int64_t deadline);
+ssize_t sock__splice(Sock *sock, int file_fd, off_t *offset, size_t count);
+ssize_t sock__sendto_segments(Sock *sock, const uint8_t *buf, size_t size, size_t segment_size, const SockAddr *addr);
+uint32_t sock__loop_to_epoll(int events);
+int sock__loop_from_epoll(uint32_t events);
+SockUringRequest *sock__uring_request(SockUring *ring, SockUringOp op, Sock *sock, SockUringCallback fn, void *user_data);
+void sock__uring_unlink(SockUring *ring, SockUringRequest *req);
+void sock__uring_release(SockUring *ring, SockUringRequest *req);
+void sock__uring_complete(SockUring *ring, SockUringRequest *req);
+Sock *sock__uring_client(Sock *sock, int fd);
+void sock__uring_emulated_ready(SockLoop *loop, Sock *sock, int events, void *user_data);
+SockLoopEntry *sock__uring_emulated_entry(SockUring *ring, Sock *sock);
+bool sock__uring_emulated_watch(SockUring *ring, SockUringRequest *req, int events);
+bool sock__uring_emulated_send(SockUring *ring, SockUringRequest *req);
+SockUringRequest *sock__uring_blocked_send(SockUring *ring, Sock *sock);
+void sock__uring_emulated_flush(SockUring *ring, Sock *sock);
+#ifdef SOCK_IO_URING
+bool sock__uring_setup(SockUring *ring, unsigned entries);
+void sock__uring_teardown(SockUring *ring);
+struct io_uring_sqe *sock__uring_sqe(SockUring *ring);
+int sock__uring_enter(SockUring *ring, unsigned min_complete, int timeout_ms);
+void sock__uring_provide(SockUring *ring, uint16_t bid);
+bool sock__uring_arm_wakeup(SockUring *ring);
+bool sock__uring_arm_recv(SockUring *ring, SockUringRequest *req);
+void sock__uring_dispatch(SockUring *ring, const struct io_uring_cqe *cqe);
+#endif // SOCK_IO_URING
 
 #ifdef __cplusplus
 }
@@ -287,13 +2063,60 @@ void sock__convert_addr(SockAddr *addr);
 
 #ifdef SOCK_IMPLEMENTATION
 
+#if defined(SOCK_MALLOC) && defined(SOCK_FREE) && defined(SOCK_REALLOC)
+// Custom allocator provided by the user
+#elif !defined(SOCK_MALLOC) && !defined(SOCK_FREE) && !defined(SOCK_REALLOC)
+#define SOCK_MALLOC(size) malloc(size)
+#define SOCK_FREE(ptr) free(ptr)
+#define SOCK_REALLOC(ptr, size) realloc(ptr, size)
+#else
+#error "Must define all or none of SOCK_MALLOC, SOCK_FREE and SOCK_REALLOC"
+#endif
+
+#ifdef SOCK_STATS
+#define SOCK__STAT(sock, field, n) \
+    sock__stats_add((sock), offsetof(SockStats, field), (uint64_t)(n))
+// Count a successful call along with its bytes
+#define SOCK__STAT_IO(sock, call, n) \
+    sock__stats_io((sock), offsetof(SockStats, call##_calls), (uint64_t)(n))
+#define SOCK__STAT_CLOCK() sock__now_us()
+#define SOCK__STAT_LATENCY(histogram, start) \
+    sock__stats_latency(offsetof(SockGlobalStats, histogram), (start))
+#else
+#define SOCK__STAT(sock, field, n) ((void)0)
+#define SOCK__STAT_IO(sock, call, n) ((void)0)
+#define SOCK__STAT_CLOCK() 0
+#define SOCK__STAT_LATENCY(histogram, start) ((void)(start))
+#endif // SOCK_STATS
+// Count a failure as EAGAIN or as the specified error counter
+#define SOCK__STAT_ERROR(sock, field, err) \
+    ((err) == EAGAIN ? SOCK__STAT(sock, eagain, 1) : SOCK__STAT(sock, field, 1))
+#define SOCK__STAT_EAGAIN(sock, err) \
+    ((err) == EAGAIN ? SOCK__STAT(sock, eagain, 1) : (void)0)
+
 #ifdef __cplusplus
 extern "C" { // Prevent name mangling
 #endif // __cplusplus
 
+static pthread_once_t sock__reaper_once = PTHREAD_ONCE_INIT;
+static SockReaper sock__reaper;
+
+static pthread_once_t sock__stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sock__stats_key;
+static pthread_mutex_t sock__stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static SockStatsBlock *sock__stats_blocks = NULL; // Blocks of running threads
+static SockGlobalStats sock__stats_retired;       // Totals of exited threads
+static __thread SockStatsBlock *sock__stats_block = NULL;
+
+#if SOCK_FREELIST_CAPACITY > 0
+static pthread_once_t sock__slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sock__slab_key;
+static __thread SockSlab *sock__slab = NULL;
+#endif // SOCK_FREELIST_CAPACITY
+
 Sock *sock_create(SockAddrType domain, SockType type)
 {
-    Sock *sock = (Sock*)malloc(sizeof(*sock));
+    Sock *sock = (Sock*)sock__slab_alloc(SOCK__SLAB_SOCK);
     if (sock == NULL) {
         return NULL;
     }
@@ -302,7 +2125,7 @@ Sock *sock_create(SockAddrType domain, SockType type)
     sock->type = type;
     sock->fd = socket(domain, type, 0);
     if (sock->fd < 0) {
-        free(sock);
+        sock__slab_free(SOCK__SLAB_SOCK, sock);
         return NULL;
     }
 
@@ -310,7 +2133,7 @@ Sock *sock_create(SockAddrType domain, SockType type)
     if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR,
                    &enable, sizeof(enable)) < 0) {
         close(sock->fd);
-        free(sock);
+        sock__slab_free(SOCK__SLAB_SOCK, sock);
         return NULL;
     }
 
@@ -345,121 +2168,223 @@ SockAddr sock_addr(const char *addr, int port)
     return sa;
 }
 
+const char *sock_addr_str(SockAddr *addr)
+{
+    if (addr == NULL) {
+        return "";
+    }
+
+    if (addr->str[0] == '\0') {
+        sock__convert_addr(addr);
+    }
+
+    return addr->str;
+}
+
 SockAddrList sock_dns(const char *addr, int port, SockAddrType addr_hint, SockType sock_hint)
 {
     SockAddrList list;
     memset(&list, 0, sizeof(list));
 
-    if (addr == NULL) {
-        return list;
+    int err = sock__dns(addr, port, addr_hint, sock_hint, &list);
+    if (err != 0) {
+        errno = err;
     }
 
-    list.items = (SockAddr*)malloc(
-            sizeof(*list.items) * SOCK_ADDR_LIST_INITIAL_CAPACITY);
-    if (list.items == NULL) {
-        return list;
+    return list;
+}
+
+void sock_addr_list_free(SockAddrList *list)
+{
+    if (list == NULL) {
+        return;
     }
-    list.capacity = SOCK_ADDR_LIST_INITIAL_CAPACITY;
 
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = (addr_hint != SOCK_ADDR_INVALID ? addr_hint : AF_UNSPEC);
-    hints.ai_socktype = sock_hint;
+    SOCK_FREE(list->items);
+    list->count = 0;
+    list->capacity = 0;
+}
 
-    char *service = NULL;
-    char port_str[16];
-    if (port > 0) {
-        snprintf(port_str, sizeof(port_str), "%d", port);
-        service = port_str;
-    }
+SockAddrList sock_dns_query(const char *name, int port, SockAddrType addr_hint, const SockDnsConfig *config)
+{
+    SockAddrList list;
+    memset(&list, 0, sizeof(list));
 
-    struct addrinfo *res;
-    if (getaddrinfo(addr, service, &hints, &res) != 0) {
+    if (name == NULL) {
+        errno = EINVAL;
         return list;
     }
 
-    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
-        SockAddr sa;
-        memset(&sa, 0, sizeof(sa));
-
-        bool skip = false;
+    // Addresses are returned without querying any server
+    SockAddr literal = sock_addr(name, port);
+    if (literal.type != SOCK_ADDR_INVALID) {
+        if (!sock__addr_list_push(&list, &literal)) {
+            errno = ENOMEM;
+        }
+        return list;
+    }
 
-        switch (ai->ai_family) {
-            case AF_INET: {
-                struct sockaddr_in *sin = (struct sockaddr_in*)ai->ai_addr;
-                sa.type = SOCK_IPV4;
-                sa.port = ntohs(sin->sin_port);
-                sa.ipv4 = *sin;
-                sa.len = sizeof(sa.ipv4);
-                inet_ntop(AF_INET, &sa.ipv4.sin_addr, sa.str, sizeof(sa.str));
-            } break;
+    SockDnsConfig loaded;
+    if (config == NULL) {
+        sock_dns_config_load(&loaded, NULL);
+        config = &loaded;
+    }
 
-            case AF_INET6: {
-                struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)ai->ai_addr;
-                sa.type = SOCK_IPV6;
-                sa.port = ntohs(sin6->sin6_port);
-                sa.ipv6 = *sin6;
-                sa.len = sizeof(sa.ipv6);
-                inet_ntop(AF_INET6, &sa.ipv6.sin6_addr, sa.str, sizeof(sa.str));
-            } break;
+    // The AAAA question comes first so that IPv6 addresses do as well
+    SockDnsQuestion questions[2];
+    size_t count = 0;
+    bool valid = true;
+    if (addr_hint != SOCK_IPV4) {
+        valid = valid && sock__dns_question(&questions[count++], name, 28);
+    }
+    if (addr_hint != SOCK_IPV6) {
+        valid = valid && sock__dns_question(&questions[count++], name, 1);
+    }
+    if (count == 2 && questions[0].id == questions[1].id) {
+        questions[1].id++;
+        questions[1].query[0] = questions[1].id >> 8;
+        questions[1].query[1] = questions[1].id & 0xff;
+    }
 
-            // Unreachable address family, skip address
-            default: {
-                skip = true;
-            } break;
+    int error = EINVAL;
+
+    if (valid) {
+        for (int attempt = 0; attempt < config->attempts; ++attempt) {
+            for (size_t i = 0; i < config->servers.count; ++i) {
+                bool done = true;
+                for (size_t j = 0; j < count; ++j) {
+                    done = done && questions[j].done;
+                }
+                if (done) {
+                    break;
+                }
+                sock__dns_exchange(questions, count, &config->servers.items[i],
+                                   config->timeout_ms, port);
+            }
         }
 
-        if (skip) {
-            continue;
+        error = ETIMEDOUT;
+        for (size_t i = 0; i < count; ++i) {
+            SockDnsQuestion *q = &questions[i];
+            if (q->done || (q->error != 0 && error == ETIMEDOUT)) {
+                error = q->done ? ENOENT : q->error;
+            }
         }
+    }
 
-        if (list.count >= list.capacity) {
-            list.capacity *= 2;
-            SockAddr *new_items = (SockAddr*)realloc(
-                    list.items, list.capacity * sizeof(*list.items));
-            if (new_items == NULL) {
-                sock_addr_list_free(&list);
-                return list;
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < questions[i].addrs.count; ++j) {
+            if (!sock__addr_list_push(&list, &questions[i].addrs.items[j])) {
+                error = ENOMEM;
+                break;
             }
-            list.items = new_items;
         }
-        list.items[list.count++] = sa;
+        sock_addr_list_free(&questions[i].addrs);
     }
 
-    freeaddrinfo(res);
-
-    return list;
-}
+    if (config == &loaded) {
+        sock_dns_config_free(&loaded);
+    }
 
-void sock_addr_list_free(SockAddrList *list)
-{
-    if (list == NULL) {
-        return;
+    if (list.count == 0) {
+        errno = error;
     }
 
-    free(list->items);
-    list->count = 0;
-    list->capacity = 0;
+    return list;
 }
 
-bool sock_bind(Sock *sock, SockAddr addr)
+bool sock_dns_config_load(SockDnsConfig *config, const char *path)
 {
-    if (sock == NULL) {
+    if (config == NULL) {
+        errno = EINVAL;
         return false;
     }
 
-    if (bind(sock->fd, &addr.sockaddr, addr.len) < 0) {
-        sock->last_errno = errno;
-        return false;
-    }
+    memset(config, 0, sizeof(*config));
+    config->timeout_ms = SOCK_DNS_DEFAULT_TIMEOUT_MS;
+    config->attempts = SOCK_DNS_DEFAULT_ATTEMPTS;
 
-    sock->addr = addr;
+    FILE *file = fopen(path != NULL ? path : "/etc/resolv.conf", "r");
+    bool loaded = file != NULL;
 
-    return true;
-}
+    char line[512];
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        char key[32];
+        char value[256];
+        int n = 0;
+        if (sscanf(line, "%31s%n", key, &n) != 1) {
+            continue;
+        }
 
-bool sock_listen(Sock *sock)
-{
+        const char *rest = line + n;
+        if (strcmp(key, "nameserver") == 0 && sscanf(rest, "%255s", value) == 1) {
+            SockAddr server = sock_addr(value, SOCK_DNS_PORT);
+            if (server.type != SOCK_ADDR_INVALID) {
+                sock__addr_list_push(&config->servers, &server);
+            }
+        } else if (strcmp(key, "options") == 0) {
+            while (sscanf(rest, "%255s%n", value, &n) == 1) {
+                rest += n;
+                if (strncmp(value, "timeout:", 8) == 0 && atoi(value + 8) > 0) {
+                    config->timeout_ms = atoi(value + 8) * 1000;
+                } else if (strncmp(value, "attempts:", 9) == 0
+                           && atoi(value + 9) > 0) {
+                    config->attempts = atoi(value + 9);
+                }
+            }
+        }
+    }
+
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    // Same default as the system resolver
+    if (config->servers.count == 0) {
+        SockAddr server = sock_addr("127.0.0.1", SOCK_DNS_PORT);
+        sock__addr_list_push(&config->servers, &server);
+    }
+
+    return loaded;
+}
+
+void sock_dns_config_free(SockDnsConfig *config)
+{
+    if (config == NULL) {
+        return;
+    }
+
+    sock_addr_list_free(&config->servers);
+}
+
+bool sock_bind(Sock *sock, SockAddr addr)
+{
+    return sock_bind_addr(sock, &addr);
+}
+
+bool sock_bind_addr(Sock *sock, const SockAddr *addr)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (addr == NULL) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    if (bind(sock->fd, &addr->sockaddr, addr->len) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    sock->addr = *addr;
+
+    return true;
+}
+
+bool sock_listen(Sock *sock)
+{
     if (sock == NULL) {
         return false;
     }
@@ -483,7 +2408,7 @@ Sock *sock_accept(Sock *sock)
         return NULL;
     }
 
-    Sock *res = (Sock*)malloc(sizeof(*res));
+    Sock *res = (Sock*)sock__slab_alloc(SOCK__SLAB_SOCK);
     if (res == NULL) {
         sock->last_errno = errno;
         return NULL;
@@ -492,16 +2417,21 @@ Sock *sock_accept(Sock *sock)
 
     res->addr.len = sock->addr.len;
 
+    int64_t start = SOCK__STAT_CLOCK();
     int fd = accept(sock->fd, &res->addr.sockaddr, &res->addr.len);
     if (fd < 0) {
-        free(res);
+        sock__slab_free(SOCK__SLAB_SOCK, res);
         sock->last_errno = errno;
+        SOCK__STAT_ERROR(sock, accept_errors, sock->last_errno);
         return NULL;
     }
+    SOCK__STAT_LATENCY(accept_latency, start);
+    SOCK__STAT(sock, accepts, 1);
 
     res->type = sock->type;
     res->fd = fd;
-    sock__convert_addr(&res->addr);
+    res->flags = sock->flags & SOCK__LAZY_ADDR;
+    sock__received_addr(res, &res->addr);
 
     return res;
 }
@@ -523,7 +2453,7 @@ bool sock_async_accept(Sock *sock, SockThreadCallback fn, void *user_data)
     }
 
     SockThreadData *thread_data =
-        (SockThreadData*)malloc(sizeof(*thread_data));
+        (SockThreadData*)sock__slab_alloc(SOCK__SLAB_THREAD_DATA);
     if (thread_data == NULL) {
         sock_close(client);
         sock->last_errno = errno;
@@ -536,7 +2466,7 @@ bool sock_async_accept(Sock *sock, SockThreadCallback fn, void *user_data)
 
     pthread_t thread;
     if (pthread_create(&thread, NULL, sock__accept_thread, thread_data) != 0) {
-        free(thread_data);
+        sock__slab_free(SOCK__SLAB_THREAD_DATA, thread_data);
         sock_close(client);
         sock->last_errno = errno;
         return false;
@@ -547,76 +2477,459 @@ bool sock_async_accept(Sock *sock, SockThreadCallback fn, void *user_data)
     return true;
 }
 
-bool sock_connect(Sock *sock, SockAddr addr)
+bool sock_pool_accept(Sock *sock, SockThreadPool *pool, SockThreadCallback fn, void *user_data)
 {
     if (sock == NULL) {
         return false;
     }
 
-    if (sock->type != SOCK_TCP) {
+    if (sock->type != SOCK_TCP || pool == NULL || fn == NULL) {
         sock->last_errno = EINVAL;
-        return NULL;
+        return false;
     }
 
-    if (connect(sock->fd, &addr.sockaddr, addr.len) < 0) {
-        sock->last_errno = errno;
+    Sock *client = sock_accept(sock);
+    if (client == NULL) {
         return false;
     }
 
-    sock->addr = addr;
+    if (!sock_thread_pool_submit(pool, fn, client, user_data)) {
+        sock_close(client);
+        sock->last_errno = EBUSY;
+        return false;
+    }
 
     return true;
 }
 
-ssize_t sock_send(Sock *sock, const void *buf, size_t size)
+ssize_t sock_accept_batch(Sock *sock, Sock **clients, size_t count, int flags)
 {
-    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
-        if (sock != NULL) {
-            sock->last_errno = EINVAL;
-        }
+    if (sock == NULL) {
         return -1;
     }
 
-    while (true) {
-        ssize_t n = send(sock->fd, buf, size, 0);
-        if (n < 0) {
-            if (errno == EINTR) {
+    if (sock->type != SOCK_TCP || clients == NULL || count == 0) {
+        sock->last_errno = EINVAL;
+        return -1;
+    }
+
+    // Only the first accept may block on a blocking listener
+    int fd_flags = fcntl(sock->fd, F_GETFL, 0);
+    bool blocking = fd_flags >= 0 && !(fd_flags & O_NONBLOCK);
+
+    int accept_flags = SOCK_CLOEXEC;
+    if (flags & SOCK_BATCH_NONBLOCK) {
+        accept_flags |= SOCK_NONBLOCK;
+    }
+
+    size_t n = 0;
+    while (n < count) {
+        if (n > 0 && blocking) {
+            struct pollfd pfd = { .fd = sock->fd, .events = POLLIN, .revents = 0 };
+            if (poll(&pfd, 1, 0) <= 0) {
+                break;
+            }
+        }
+
+        Sock *client = (Sock*)sock__slab_alloc(SOCK__SLAB_SOCK);
+        if (client == NULL) {
+            sock->last_errno = errno;
+            break;
+        }
+        memset(client, 0, sizeof(*client));
+
+        client->addr.len = sizeof(client->addr.ipv6);
+        int64_t start = SOCK__STAT_CLOCK();
+        int fd = (int)syscall(SYS_accept4, sock->fd, &client->addr.sockaddr,
+                              &client->addr.len, accept_flags);
+        if (fd < 0) {
+            int err = errno;
+            sock__slab_free(SOCK__SLAB_SOCK, client);
+            if (err == EINTR) {
+                SOCK__STAT(sock, eintr, 1);
+                continue;
+            }
+            // The connection was reset while waiting in the backlog
+            if (err == ECONNABORTED) {
+                SOCK__STAT(sock, accept_errors, 1);
                 continue;
             }
+            sock->last_errno = err;
+            SOCK__STAT_ERROR(sock, accept_errors, err);
+            break;
+        }
+        SOCK__STAT_LATENCY(accept_latency, start);
+        SOCK__STAT(sock, accepts, 1);
+
+        client->type = sock->type;
+        client->fd = fd;
+        client->flags = sock->flags & SOCK__LAZY_ADDR;
+        if (flags & SOCK_BATCH_NO_ADDR_STR) {
+            sock__parse_addr(&client->addr);
+            client->addr.str[0] = '\0';
+        } else {
+            sock__received_addr(client, &client->addr);
+        }
+
+        clients[n++] = client;
+    }
+
+    if (n == 0) {
+        return -1;
+    }
+
+    return (ssize_t)n;
+}
+
+SockShardedListener *sock_listen_sharded(SockAddr addr, size_t count, SockThreadCallback fn, void *user_data)
+{
+    if (fn == NULL || addr.type == SOCK_ADDR_INVALID) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    SockShardedListener *listener =
+        (SockShardedListener*)SOCK_MALLOC(sizeof(*listener));
+    if (listener == NULL) {
+        return NULL;
+    }
+    memset(listener, 0, sizeof(*listener));
+
+    listener->shards = (SockShard*)SOCK_MALLOC(sizeof(*listener->shards) * count);
+    listener->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (listener->shards == NULL || listener->stop_fd < 0) {
+        int err = errno;
+        if (listener->stop_fd >= 0) {
+            close(listener->stop_fd);
+        }
+        SOCK_FREE(listener->shards);
+        SOCK_FREE(listener);
+        errno = err;
+        return NULL;
+    }
+    memset(listener->shards, 0, sizeof(*listener->shards) * count);
+
+    listener->addr = addr;
+    listener->callback = fn;
+    listener->user_data = user_data;
+
+    for (size_t i = 0; i < count; ++i) {
+        SockShard *shard = &listener->shards[i];
+        shard->owner = listener;
+        shard->index = i;
+        shard->sock = sock__listen_reuseport(&listener->addr);
+        if (shard->sock == NULL) {
+            int err = errno;
+            sock_sharded_listener_destroy(listener);
+            errno = err;
+            return NULL;
+        }
+
+        int err = pthread_create(&shard->thread, NULL, sock__shard_thread,
+                                 shard);
+        if (err != 0) {
+            sock_close(shard->sock);
+            sock_sharded_listener_destroy(listener);
+            errno = err;
+            return NULL;
+        }
+        listener->count++;
+    }
+
+    return listener;
+}
+
+void sock_sharded_listener_destroy(SockShardedListener *listener)
+{
+    if (listener == NULL) {
+        return;
+    }
+
+    uint64_t one = 1;
+    ssize_t n = write(listener->stop_fd, &one, sizeof(one));
+    (void) n;
+
+    for (size_t i = 0; i < listener->count; ++i) {
+        pthread_join(listener->shards[i].thread, NULL);
+        sock_close(listener->shards[i].sock);
+    }
+
+    close(listener->stop_fd);
+    SOCK_FREE(listener->shards);
+    SOCK_FREE(listener);
+}
+
+bool sock_connect(Sock *sock, SockAddr addr)
+{
+    return sock_connect_addr(sock, &addr);
+}
+
+bool sock_connect_addr(Sock *sock, const SockAddr *addr)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (sock->type != SOCK_TCP || addr == NULL) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    int64_t start = SOCK__STAT_CLOCK();
+    if (connect(sock->fd, &addr->sockaddr, addr->len) < 0) {
+        sock->last_errno = errno;
+        // A non-blocking connect in progress is not a failure yet
+        if (sock->last_errno != EINPROGRESS) {
+            SOCK__STAT(sock, connect_errors, 1);
+        }
+        return false;
+    }
+    SOCK__STAT_LATENCY(connect_latency, start);
+    SOCK__STAT(sock, connects, 1);
+
+    sock->addr = *addr;
+
+    return true;
+}
+
+bool sock_connect_timeout(Sock *sock, SockAddr addr, int timeout_ms)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (sock->type != SOCK_TCP) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    if (timeout_ms < 0) {
+        return sock_connect_addr(sock, &addr);
+    }
+
+    int flags = fcntl(sock->fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    int64_t start = SOCK__STAT_CLOCK();
+    int64_t deadline = sock_now_ms() + timeout_ms;
+    bool connected = true;
+
+    if (connect(sock->fd, &addr.sockaddr, addr.len) < 0) {
+        if (errno != EINPROGRESS) {
             sock->last_errno = errno;
-            return -1;
+            connected = false;
+        } else if (!sock__wait(sock, POLLOUT, deadline)) {
+            connected = false;
+        } else {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+                error = errno;
+            }
+            if (error != 0) {
+                sock->last_errno = error;
+                connected = false;
+            }
         }
+    }
 
-        return n;
+    // Restore the original blocking mode of the sock
+    fcntl(sock->fd, F_SETFL, flags);
+
+    if (connected) {
+        SOCK__STAT_LATENCY(connect_latency, start);
+        SOCK__STAT(sock, connects, 1);
+        sock->addr = addr;
+    } else {
+        SOCK__STAT(sock, connect_errors, 1);
     }
+
+    return connected;
 }
 
-ssize_t sock_send_all(Sock *sock, const void *buf, size_t size)
+Sock *sock_connect_any(const SockAddrList *list, int timeout_ms)
 {
-    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
-        if (sock != NULL) {
-            sock->last_errno = EINVAL;
+    if (list == NULL || list->count == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t count = list->count;
+    size_t *order = (size_t*)SOCK_MALLOC(sizeof(*order) * count);
+    Sock **attempts = (Sock**)SOCK_MALLOC(sizeof(*attempts) * count);
+    struct pollfd *pfds = (struct pollfd*)SOCK_MALLOC(sizeof(*pfds) * count);
+    size_t *pfd_attempts = (size_t*)SOCK_MALLOC(sizeof(*pfd_attempts) * count);
+    if (order == NULL || attempts == NULL || pfds == NULL
+            || pfd_attempts == NULL) {
+        SOCK_FREE(order);
+        SOCK_FREE(attempts);
+        SOCK_FREE(pfds);
+        SOCK_FREE(pfd_attempts);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(attempts, 0, sizeof(*attempts) * count);
+
+    // Interleave the address families starting from the one of the first
+    // address, keeping the relative order within each family
+    SockAddrType first = list->items[0].type;
+    size_t ordered = 0;
+    size_t next_same = 0;
+    size_t next_other = 0;
+    bool pick_same = true;
+    while (ordered < count) {
+        size_t *next = pick_same ? &next_same : &next_other;
+        while (*next < count
+                && (list->items[*next].type == first) != pick_same) {
+            (*next)++;
         }
-        return -1;
+        if (*next < count) {
+            order[ordered++] = (*next)++;
+        }
+        pick_same = !pick_same;
     }
 
-    uint8_t *ptr = (uint8_t*)buf;
-    size_t remaining = size;
+    int64_t deadline = timeout_ms >= 0 ? sock_now_ms() + timeout_ms : -1;
+    int64_t next_attempt = sock_now_ms();
+    size_t started = 0;
+    size_t in_flight = 0;
+    int last_error = ETIMEDOUT;
+    Sock *winner = NULL;
+
+    while (winner == NULL && (started < count || in_flight > 0)) {
+        int64_t now = sock_now_ms();
+        if (deadline >= 0 && now >= deadline) {
+            last_error = ETIMEDOUT;
+            break;
+        }
 
-    while (remaining > 0) {
-        ssize_t n = sock_send(sock, ptr, remaining);
+        if (started < count && (in_flight == 0 || now >= next_attempt)) {
+            size_t index = order[started++];
+            SockAddr addr = list->items[index];
+
+            Sock *sock = sock_create(addr.type, SOCK_TCP);
+            if (sock == NULL) {
+                last_error = errno;
+                continue;
+            }
+
+            if (!sock_set_nonblocking(sock, true)) {
+                last_error = sock->last_errno;
+                sock_close(sock);
+                continue;
+            }
+
+            if (connect(sock->fd, &addr.sockaddr, addr.len) < 0
+                    && errno != EINPROGRESS) {
+                last_error = errno;
+                sock_close(sock);
+                continue;
+            }
+
+            sock->addr = addr;
+            attempts[index] = sock;
+            in_flight++;
+            next_attempt = now + SOCK_CONNECT_ATTEMPT_DELAY_MS;
+        }
+
+        nfds_t nfds = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (attempts[i] != NULL) {
+                pfds[nfds].fd = attempts[i]->fd;
+                pfds[nfds].events = POLLOUT;
+                pfds[nfds].revents = 0;
+                pfd_attempts[nfds] = i;
+                nfds++;
+            }
+        }
+
+        if (nfds == 0) {
+            continue;
+        }
+
+        int64_t wait = -1;
+        if (started < count) {
+            wait = next_attempt - now;
+        }
+        if (deadline >= 0 && (wait < 0 || deadline - now < wait)) {
+            wait = deadline - now;
+        }
+        if (wait < 0 && (started < count || deadline >= 0)) {
+            wait = 0;
+        }
+
+        int n = poll(pfds, nfds, (int)wait);
         if (n < 0) {
-            return -1;
+            if (errno == EINTR) {
+                continue;
+            }
+            last_error = errno;
+            break;
         }
 
-        ptr += n;
-        remaining -= n;
+        for (nfds_t i = 0; i < nfds && n > 0; ++i) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+
+            size_t index = pfd_attempts[i];
+            Sock *sock = attempts[index];
+
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+                error = errno;
+            }
+
+            if (error == 0 && winner == NULL) {
+                winner = sock;
+                attempts[index] = NULL;
+                break;
+            }
+
+            // A failed attempt lets the next one start right away
+            last_error = error != 0 ? error : last_error;
+            sock_close(sock);
+            attempts[index] = NULL;
+            in_flight--;
+            next_attempt = sock_now_ms();
+        }
     }
 
-    return size;
+    for (size_t i = 0; i < count; ++i) {
+        if (attempts[i] != NULL) {
+            sock_close(attempts[i]);
+        }
+    }
+
+    SOCK_FREE(order);
+    SOCK_FREE(attempts);
+    SOCK_FREE(pfds);
+    SOCK_FREE(pfd_attempts);
+
+    if (winner == NULL) {
+        errno = last_error;
+        return NULL;
+    }
+
+    if (!sock_set_nonblocking(winner, false)) {
+        errno = winner->last_errno;
+        sock_close(winner);
+        return NULL;
+    }
+
+    return winner;
 }
 
-ssize_t sock_recv(Sock *sock, void *buf, size_t size)
+ssize_t sock_send(Sock *sock, const void *buf, size_t size)
 {
     if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
         if (sock != NULL) {
@@ -626,19 +2939,23 @@ ssize_t sock_recv(Sock *sock, void *buf, size_t size)
     }
 
     while (true) {
-        ssize_t n = recv(sock->fd, buf, size, 0);
+        ssize_t n = send(sock->fd, buf, size, 0);
         if (n < 0) {
             if (errno == EINTR) {
+                SOCK__STAT(sock, eintr, 1);
                 continue;
             }
             sock->last_errno = errno;
+            SOCK__STAT_EAGAIN(sock, sock->last_errno);
             return -1;
         }
+
+        SOCK__STAT_IO(sock, send, n);
         return n;
     }
 }
 
-ssize_t sock_recv_all(Sock *sock, void *buf, size_t size)
+ssize_t sock_send_all(Sock *sock, const void *buf, size_t size)
 {
     if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
         if (sock != NULL) {
@@ -649,137 +2966,5582 @@ ssize_t sock_recv_all(Sock *sock, void *buf, size_t size)
 
     uint8_t *ptr = (uint8_t*)buf;
     size_t remaining = size;
-    ssize_t total = 0;
 
     while (remaining > 0) {
-        ssize_t n = sock_recv(sock, ptr, remaining);
+        ssize_t n = sock_send(sock, ptr, remaining);
         if (n < 0) {
             return -1;
         }
-        if (n == 0) {
-            return total;
+        if ((size_t)n < remaining) {
+            SOCK__STAT(sock, short_writes, 1);
         }
+
         ptr += n;
         remaining -= n;
-        total += n;
     }
 
-    return total;
+    return size;
 }
 
-ssize_t sock_sendto(Sock *sock, const void *buf, size_t size, SockAddr addr)
+ssize_t sock_send_all_until(Sock *sock, const void *buf, size_t size, int64_t deadline)
 {
-    if (sock == NULL || buf == NULL || sock->type != SOCK_UDP) {
+    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
         if (sock != NULL) {
             sock->last_errno = EINVAL;
         }
         return -1;
     }
 
-    while (true) {
-        ssize_t n = sendto(sock->fd, buf, size, 0, &addr.sockaddr, addr.len);
+    sock->last_errno = 0;
+
+    const uint8_t *ptr = (const uint8_t*)buf;
+    size_t sent = 0;
+
+    while (sent < size) {
+        ssize_t n = send(sock->fd, ptr + sent, size - sent, MSG_DONTWAIT);
         if (n < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            sock->last_errno = errno;
-            return -1;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                sock->last_errno = errno;
+                return -1;
+            }
+            if (!sock__wait(sock, POLLOUT, deadline)) {
+                if (sock->last_errno != ETIMEDOUT) {
+                    return -1;
+                }
+                break;
+            }
+            continue;
         }
-        return n;
+        sent += n;
     }
+
+    return sent;
+}
+
+ssize_t sock_sendv(Sock *sock, const struct iovec *iov, size_t count)
+{
+    if (sock == NULL || iov == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    return sock__sendv(sock, iov, count, 0);
+}
+
+ssize_t sock_sendv_all(Sock *sock, const struct iovec *iov, size_t count)
+{
+    if (sock == NULL || iov == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += iov[i].iov_len;
+    }
+
+    struct iovec window[SOCK_IOV_MAX];
+    size_t index = 0;  // First buffer not completely sent
+    size_t offset = 0; // Bytes already sent from iov[index]
+
+    while (index < count) {
+        if (offset >= iov[index].iov_len) {
+            index++;
+            offset = 0;
+            continue;
+        }
+
+        // Copy the remaining buffers so that the caller's array is left
+        // untouched when the first one was only partially sent
+        size_t window_count = 0;
+        for (size_t i = index; i < count && window_count < SOCK_IOV_MAX; ++i) {
+            window[window_count] = iov[i];
+            window_count++;
+        }
+        window[0].iov_base = (uint8_t*)window[0].iov_base + offset;
+        window[0].iov_len -= offset;
+
+        ssize_t n = sock_sendv(sock, window, window_count);
+        if (n < 0) {
+            return -1;
+        }
+
+        size_t sent = (size_t)n;
+        while (sent > 0) {
+            size_t left = iov[index].iov_len - offset;
+            if (sent < left) {
+                offset += sent;
+                break;
+            }
+            sent -= left;
+            index++;
+            offset = 0;
+        }
+    }
+
+    return total;
+}
+
+bool sock_set_zerocopy(Sock *sock, bool enable)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (sock->type != SOCK_TCP) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    // The ids of the copied sends would otherwise be reused before they
+    // were reported as released
+    bool enabled = (sock->flags & SOCK__ZEROCOPY) != 0;
+    if (enable && !enabled && sock->zerocopy_done != sock->zerocopy_next) {
+        sock->last_errno = EBUSY;
+        return false;
+    }
+
+    int value = enable ? 1 : 0;
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &value,
+                   sizeof(value)) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    // The kernel only counts the sends made with SO_ZEROCOPY, so the ids
+    // follow its numbering again and the copied sends start from there
+    if (enable) {
+        sock->flags |= SOCK__ZEROCOPY;
+        if (!enabled) {
+            sock->zerocopy_next = sock->zerocopy_kernel;
+            sock->zerocopy_done = sock->zerocopy_next;
+        }
+    } else {
+        sock->flags &= ~SOCK__ZEROCOPY;
+        if (enabled) {
+            sock->zerocopy_done = sock->zerocopy_next;
+        }
+    }
+
+    return true;
+}
+
+ssize_t sock_send_zerocopy(Sock *sock, const void *buf, size_t size, uint32_t *id)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    // Without SO_ZEROCOPY the data is copied and released immediately
+    if (!(sock->flags & SOCK__ZEROCOPY)) {
+        ssize_t n = sock_send(sock, buf, size);
+        if (n < 0) {
+            return -1;
+        }
+        if (id != NULL) {
+            *id = sock->zerocopy_next;
+        }
+        sock->zerocopy_next++;
+        return n;
+    }
+
+    while (true) {
+        ssize_t n = send(sock->fd, buf, size, MSG_ZEROCOPY);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+
+        // The kernel numbers every successful zero-copy send sequentially
+        if (id != NULL) {
+            *id = sock->zerocopy_kernel;
+        }
+        sock->zerocopy_kernel++;
+        sock->zerocopy_next = sock->zerocopy_kernel;
+        return n;
+    }
+}
+
+ssize_t sock_zerocopy_poll(Sock *sock, SockZerocopyRange *ranges, size_t count)
+{
+    if (sock == NULL || ranges == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    size_t stored = 0;
+
+    if (!(sock->flags & SOCK__ZEROCOPY)) {
+        if (count > 0 && sock->zerocopy_done != sock->zerocopy_next) {
+            ranges[0].lo = sock->zerocopy_done;
+            ranges[0].hi = sock->zerocopy_next - 1;
+            ranges[0].copied = true;
+            sock->zerocopy_done = sock->zerocopy_next;
+            stored++;
+        }
+        return stored;
+    }
+
+    while (stored < count) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)
+                                + sizeof(struct sockaddr_in6))];
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            sock->last_errno = errno;
+            return stored > 0 ? (ssize_t)stored : -1;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool is_recverr =
+                (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6
+                    && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!is_recverr) {
+                continue;
+            }
+
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0
+                    || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            ranges[stored].lo = err.ee_info;
+            ranges[stored].hi = err.ee_data;
+            ranges[stored].copied =
+                (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+            stored++;
+        }
+    }
+
+    return stored;
+}
+
+ssize_t sock_sendfile(Sock *sock, int file_fd, off_t offset, size_t count)
+{
+    if (sock == NULL || file_fd < 0 || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    off_t *offset_ptr = offset >= 0 ? &offset : NULL;
+
+    while (true) {
+        ssize_t n = sendfile(sock->fd, file_fd, offset_ptr, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The file does not support sendfile(), e.g. it is a pipe
+            if (errno == EINVAL || errno == ENOSYS) {
+                return sock__splice(sock, file_fd, offset_ptr, count);
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+        return n;
+    }
+}
+
+ssize_t sock_sendfile_all(Sock *sock, int file_fd, off_t offset, size_t count)
+{
+    if (sock == NULL || file_fd < 0 || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    size_t total = 0;
+
+    while (total < count) {
+        ssize_t n = sock_sendfile(sock, file_fd, offset, count - total);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (offset >= 0) {
+            offset += n;
+        }
+        total += n;
+    }
+
+    return total;
+}
+
+ssize_t sock_recv(Sock *sock, void *buf, size_t size)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    while (true) {
+        ssize_t n = recv(sock->fd, buf, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                SOCK__STAT(sock, eintr, 1);
+                continue;
+            }
+            sock->last_errno = errno;
+            SOCK__STAT_EAGAIN(sock, sock->last_errno);
+            return -1;
+        }
+        SOCK__STAT_IO(sock, recv, n);
+        return n;
+    }
+}
+
+ssize_t sock_recv_all(Sock *sock, void *buf, size_t size)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    uint8_t *ptr = (uint8_t*)buf;
+    size_t remaining = size;
+    ssize_t total = 0;
+
+    while (remaining > 0) {
+        ssize_t n = sock_recv(sock, ptr, remaining);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return total;
+        }
+        ptr += n;
+        remaining -= n;
+        total += n;
+    }
+
+    return total;
+}
+
+ssize_t sock_recv_all_until(Sock *sock, void *buf, size_t size, int64_t deadline)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    sock->last_errno = 0;
+
+    uint8_t *ptr = (uint8_t*)buf;
+    size_t received = 0;
+
+    while (received < size) {
+        ssize_t n = recv(sock->fd, ptr + received, size - received,
+                         MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                sock->last_errno = errno;
+                return -1;
+            }
+            if (!sock__wait(sock, POLLIN, deadline)) {
+                if (sock->last_errno != ETIMEDOUT) {
+                    return -1;
+                }
+                break;
+            }
+            continue;
+        }
+        if (n == 0) {
+            break;
+        }
+        received += n;
+    }
+
+    return received;
+}
+
+ssize_t sock_recvv(Sock *sock, const struct iovec *iov, size_t count)
+{
+    if (sock == NULL || iov == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = count < SOCK_IOV_MAX ? count : SOCK_IOV_MAX;
+
+    while (true) {
+        ssize_t n = recvmsg(sock->fd, &msg, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+        return n;
+    }
+}
+
+ssize_t sock_sendto(Sock *sock, const void *buf, size_t size, SockAddr addr)
+{
+    return sock_sendto_addr(sock, buf, size, &addr);
+}
+
+ssize_t sock_sendto_addr(Sock *sock, const void *buf, size_t size, const SockAddr *addr)
+{
+    if (sock == NULL || buf == NULL || addr == NULL || sock->type != SOCK_UDP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    while (true) {
+        ssize_t n = sendto(sock->fd, buf, size, 0, &addr->sockaddr, addr->len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                SOCK__STAT(sock, eintr, 1);
+                continue;
+            }
+            sock->last_errno = errno;
+            SOCK__STAT_EAGAIN(sock, sock->last_errno);
+            return -1;
+        }
+        SOCK__STAT_IO(sock, sendto, n);
+        return n;
+    }
+}
+
+ssize_t sock_recvfrom(Sock *sock, void *buf, size_t size, SockAddr *addr)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_UDP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    // The address is received in place, sock socks are only IPv4 or IPv6
+    struct sockaddr *sa = NULL;
+    socklen_t sa_len = 0;
+    socklen_t *len_ptr = NULL;
+
+    if (addr != NULL) {
+        sa = &addr->sockaddr;
+        sa_len = sizeof(addr->ipv6);
+        len_ptr = &sa_len;
+    }
+
+    ssize_t res = 0;
+    while (true) {
+        res = recvfrom(sock->fd, buf, size, 0, sa, len_ptr);
+        if (res < 0) {
+            if (errno == EINTR) {
+                SOCK__STAT(sock, eintr, 1);
+                continue;
+            }
+            sock->last_errno = errno;
+            SOCK__STAT_EAGAIN(sock, sock->last_errno);
+            return -1;
+        }
+        break;
+    }
+    SOCK__STAT_IO(sock, recvfrom, res);
+
+    if (addr != NULL) {
+        addr->len = sa_len;
+        sock__received_addr(sock, addr);
+    }
+
+    return res;
+}
+
+ssize_t sock_sendto_batch(Sock *sock, SockMsg *msgs, size_t count)
+{
+    if (sock == NULL || msgs == NULL || sock->type != SOCK_UDP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    SockMmsgHdr headers[SOCK_BATCH_MAX];
+    struct iovec iovs[SOCK_BATCH_MAX];
+    size_t sent = 0;
+
+    while (sent < count) {
+        size_t chunk = count - sent;
+        if (chunk > SOCK_BATCH_MAX) {
+            chunk = SOCK_BATCH_MAX;
+        }
+
+        memset(headers, 0, sizeof(*headers) * chunk);
+        for (size_t i = 0; i < chunk; ++i) {
+            SockMsg *msg = &msgs[sent + i];
+            iovs[i].iov_base = msg->buf;
+            iovs[i].iov_len = msg->size;
+            headers[i].msg_hdr.msg_name = &msg->addr.sockaddr;
+            headers[i].msg_hdr.msg_namelen = msg->addr.len;
+            headers[i].msg_hdr.msg_iov = &iovs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = (int)syscall(SYS_sendmmsg, sock->fd, headers,
+                             (unsigned int)chunk, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            // Report the messages that made it before the error
+            return sent > 0 ? (ssize_t)sent : -1;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            msgs[sent + i].len = headers[i].msg_len;
+        }
+        sent += n;
+
+        if ((size_t)n < chunk) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+ssize_t sock_recvfrom_batch(Sock *sock, SockMsg *msgs, size_t count, int flags)
+{
+    if (sock == NULL || msgs == NULL || sock->type != SOCK_UDP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    if (count > SOCK_BATCH_MAX) {
+        count = SOCK_BATCH_MAX;
+    }
+
+    SockMmsgHdr headers[SOCK_BATCH_MAX];
+    struct iovec iovs[SOCK_BATCH_MAX];
+
+    memset(headers, 0, sizeof(*headers) * count);
+    for (size_t i = 0; i < count; ++i) {
+        SockMsg *msg = &msgs[i];
+        iovs[i].iov_base = msg->buf;
+        iovs[i].iov_len = msg->size;
+        headers[i].msg_hdr.msg_name = &msg->addr.sockaddr;
+        headers[i].msg_hdr.msg_namelen = sizeof(msg->addr.ipv6);
+        headers[i].msg_hdr.msg_iov = &iovs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n = 0;
+    while (true) {
+        n = (int)syscall(SYS_recvmmsg, sock->fd, headers,
+                         (unsigned int)count, MSG_WAITFORONE, NULL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+        break;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        SockMsg *msg = &msgs[i];
+        msg->len = headers[i].msg_len;
+        msg->addr.len = headers[i].msg_hdr.msg_namelen;
+        if (flags & SOCK_BATCH_NO_ADDR_STR) {
+            sock__parse_addr(&msg->addr);
+            msg->addr.str[0] = '\0';
+        } else {
+            sock__received_addr(sock, &msg->addr);
+        }
+    }
+
+    return n;
+}
+
+ssize_t sock_sendto_gso(Sock *sock, const void *buf, size_t size, size_t segment_size, SockAddr addr)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_UDP
+            || segment_size == 0 || segment_size > UINT16_MAX) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    if (size <= segment_size) {
+        return sock_sendto(sock, buf, size, addr);
+    }
+
+    size_t max_segments = SOCK_GSO_MAX_SIZE / segment_size;
+    if (max_segments > SOCK_GSO_MAX_SEGMENTS) {
+        max_segments = SOCK_GSO_MAX_SEGMENTS;
+    }
+    if (max_segments == 0) {
+        return sock__sendto_segments(sock, (const uint8_t*)buf, size,
+                                     segment_size, &addr);
+    }
+    size_t chunk_size = max_segments * segment_size;
+
+    const uint8_t *ptr = (const uint8_t*)buf;
+    size_t remaining = size;
+
+    while (remaining > 0 && !(sock->flags & SOCK__NO_GSO)) {
+        size_t chunk = remaining < chunk_size ? remaining : chunk_size;
+
+        struct iovec iov;
+        iov.iov_base = (void*)ptr;
+        iov.iov_len = chunk;
+
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof(control));
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr.sockaddr;
+        msg.msg_namelen = addr.len;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gso_size = (uint16_t)segment_size;
+        memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+        ssize_t n = sendmsg(sock->fd, &msg, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The kernel or the outgoing device cannot segment: remember it
+            // and fall back to manual segmentation
+            if (errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EIO) {
+                sock->flags |= SOCK__NO_GSO;
+                break;
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+
+        ptr += n;
+        remaining -= n;
+    }
+
+    if (remaining > 0) {
+        if (sock__sendto_segments(sock, ptr, remaining, segment_size,
+                                  &addr) < 0) {
+            return -1;
+        }
+    }
+
+    return size;
+}
+
+bool sock_set_gro(Sock *sock, bool enable)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (sock->type != SOCK_UDP) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    int value = enable ? 1 : 0;
+    if (setsockopt(sock->fd, IPPROTO_UDP, UDP_GRO, &value,
+                   sizeof(value)) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    return true;
+}
+
+ssize_t sock_recvfrom_gro(Sock *sock, void *buf, size_t size, SockAddr *addr, size_t *segment_size)
+{
+    if (sock == NULL || buf == NULL || sock->type != SOCK_UDP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (addr != NULL) {
+        memset(addr, 0, sizeof(*addr));
+        msg.msg_name = &addr->sockaddr;
+        msg.msg_namelen = sizeof(addr->ipv6);
+    }
+
+    ssize_t res = 0;
+    while (true) {
+        res = recvmsg(sock->fd, &msg, 0);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+        break;
+    }
+
+    if (segment_size != NULL) {
+        *segment_size = (size_t)res;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_UDP
+                    && cmsg->cmsg_type == UDP_GRO) {
+                int gso_size = 0;
+                memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                *segment_size = (size_t)gso_size;
+            }
+        }
+    }
+
+    if (addr != NULL) {
+        addr->len = msg.msg_namelen;
+        sock__received_addr(sock, addr);
+    }
+
+    return res;
+}
+
+void sock_close(Sock *sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+
+    // Datagram socks have no connection to wait for
+    if (sock->type == SOCK_TCP) {
+        shutdown(sock->fd, SHUT_WR);
+        uint8_t buffer[1024];
+        while (true) {
+            // Not sock_recv(), the drained data is not counted in the stats
+            ssize_t n = recv(sock->fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+        }
+    }
+
+    close(sock->fd);
+    sock__slab_free(SOCK__SLAB_SOCK, sock);
+}
+
+void sock_close_async(Sock *sock, int timeout_ms)
+{
+    if (sock == NULL) {
+        return;
+    }
+
+    int fd = sock->fd;
+    bool stream = sock->type == SOCK_TCP;
+    sock__slab_free(SOCK__SLAB_SOCK, sock);
+
+    if (!stream || timeout_ms <= 0) {
+        close(fd);
+        return;
+    }
+
+    pthread_once(&sock__reaper_once, sock__reaper_init);
+
+    SockReaperEntry *entry = NULL;
+    if (sock__reaper.started) {
+        entry = (SockReaperEntry*)SOCK_MALLOC(sizeof(*entry));
+    }
+
+    // Without the reaper, close right away instead of blocking the caller
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (entry == NULL || flags < 0
+            || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0
+            || shutdown(fd, SHUT_WR) < 0) {
+        SOCK_FREE(entry);
+        close(fd);
+        return;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = fd;
+    entry->deadline = sock_now_ms() + timeout_ms;
+
+    pthread_mutex_lock(&sock__reaper.lock);
+
+    // Timeouts are usually the same, so the entry mostly goes at the end
+    SockReaperEntry *prev = sock__reaper.tail;
+    while (prev != NULL && prev->deadline > entry->deadline) {
+        prev = prev->prev;
+    }
+    entry->prev = prev;
+    entry->next = prev != NULL ? prev->next : sock__reaper.head;
+    if (entry->next != NULL) {
+        entry->next->prev = entry;
+    } else {
+        sock__reaper.tail = entry;
+    }
+    if (prev != NULL) {
+        prev->next = entry;
+    } else {
+        sock__reaper.head = entry;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = entry;
+    bool added = epoll_ctl(sock__reaper.epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    if (!added) {
+        sock__reaper_unlink(entry);
+    }
+    bool first = added && sock__reaper.head == entry;
+
+    pthread_mutex_unlock(&sock__reaper.lock);
+
+    if (!added) {
+        close(fd);
+        SOCK_FREE(entry);
+        return;
+    }
+
+    // The reaper has to wait for a closer deadline
+    if (first) {
+        uint64_t one = 1;
+        ssize_t n = write(sock__reaper.wakeup_fd, &one, sizeof(one));
+        (void) n;
+    }
+}
+
+void sock_close_abort(Sock *sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+
+    // A zero linger time makes close() reset the connection
+    struct linger linger;
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+    setsockopt(sock->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+    close(sock->fd);
+    sock__slab_free(SOCK__SLAB_SOCK, sock);
+}
+
+void sock_freelist_trim(void)
+{
+#if SOCK_FREELIST_CAPACITY > 0
+    SockSlab *slab = sock__slab;
+    if (slab == NULL) {
+        return;
+    }
+
+    // The key destructor must not release the slab again
+    pthread_setspecific(sock__slab_key, NULL);
+    sock__slab_destroy(slab);
+#endif // SOCK_FREELIST_CAPACITY
+}
+
+void sock_log_error(const Sock *sock)
+{
+    if (sock == NULL) {
+        fprintf(stderr, "SOCK ERROR: socket is NULL. errno says: %s\n",
+                strerror(errno));
+        return;
+    }
+
+    fprintf(stderr, "SOCK ERROR: %s\n", strerror(sock->last_errno));
+}
+
+int64_t sock_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+SockStats sock_stats(const Sock *sock)
+{
+    SockStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (sock == NULL) {
+        return stats;
+    }
+
+    const uint64_t *src = (const uint64_t*)&sock->stats;
+    uint64_t *dst = (uint64_t*)&stats;
+    for (size_t i = 0; i < sizeof(stats) / sizeof(uint64_t); ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+
+    return stats;
+}
+
+SockGlobalStats sock_global_stats(void)
+{
+    SockGlobalStats stats;
+
+    pthread_mutex_lock(&sock__stats_lock);
+    stats = sock__stats_retired;
+    for (SockStatsBlock *it = sock__stats_blocks; it != NULL; it = it->next) {
+        sock__stats_merge(&stats, &it->stats);
+    }
+    pthread_mutex_unlock(&sock__stats_lock);
+
+    return stats;
+}
+
+uint64_t sock_histogram_percentile(const SockHistogram *histogram, double percentile)
+{
+    if (histogram == NULL || histogram->count == 0) {
+        return 0;
+    }
+
+    if (percentile < 0.0) {
+        percentile = 0.0;
+    } else if (percentile > 100.0) {
+        percentile = 100.0;
+    }
+
+    // Rank of the sample, rounded up
+    double exact = percentile / 100.0 * (double)histogram->count;
+    uint64_t rank = (uint64_t)exact;
+    if ((double)rank < exact || rank == 0) {
+        rank++;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < SOCK_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+
+    return (uint64_t)1 << SOCK_HISTOGRAM_BUCKETS;
+}
+
+bool sock_set_nonblocking(Sock *sock, bool enable)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    int flags = fcntl(sock->fd, F_GETFL, 0);
+    if (flags < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    if (enable) {
+        flags |= O_NONBLOCK;
+    } else {
+        flags &= ~O_NONBLOCK;
+    }
+
+    if (fcntl(sock->fd, F_SETFL, flags) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    return true;
+}
+
+bool sock_set_cork(Sock *sock, bool enable)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (sock->type != SOCK_TCP) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    int value = enable ? 1 : 0;
+    if (setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    return true;
+}
+
+int sock_set_nodelay(Sock *sock, bool enable)
+{
+    return sock__set_option(sock, IPPROTO_TCP, TCP_NODELAY, enable ? 1 : 0);
+}
+
+int sock_set_quickack(Sock *sock, bool enable)
+{
+    return sock__set_option(sock, IPPROTO_TCP, TCP_QUICKACK, enable ? 1 : 0);
+}
+
+int sock_set_send_buffer(Sock *sock, int size)
+{
+    return sock__set_option(sock, SOL_SOCKET, SO_SNDBUF, size);
+}
+
+int sock_set_recv_buffer(Sock *sock, int size)
+{
+    return sock__set_option(sock, SOL_SOCKET, SO_RCVBUF, size);
+}
+
+int sock_set_busy_poll(Sock *sock, int usec)
+{
+    return sock__set_option(sock, SOL_SOCKET, SO_BUSY_POLL, usec);
+}
+
+int sock_set_notsent_lowat(Sock *sock, int size)
+{
+    return sock__set_option(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, size);
+}
+
+bool sock_set_keepalive(Sock *sock, int idle_s, int interval_s, int count)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (sock->type != SOCK_TCP || idle_s < 0 || interval_s < 0 || count < 0) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    if (idle_s == 0) {
+        return sock__set_option(sock, SOL_SOCKET, SO_KEEPALIVE, 0) == 0;
+    }
+
+    // Zero keeps the system default of the parameter
+    return (interval_s == 0
+            || sock__set_option(sock, IPPROTO_TCP, TCP_KEEPINTVL, interval_s) >= 0)
+        && (count == 0
+            || sock__set_option(sock, IPPROTO_TCP, TCP_KEEPCNT, count) >= 0)
+        && sock__set_option(sock, IPPROTO_TCP, TCP_KEEPIDLE, idle_s) >= 0
+        && sock__set_option(sock, SOL_SOCKET, SO_KEEPALIVE, 1) == 1;
+}
+
+bool sock_set_profile(Sock *sock, int profile, SockTuning *applied)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if ((profile & SOCK_PROFILE_LOW_LATENCY)
+            && (profile & SOCK_PROFILE_THROUGHPUT)) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    // Every option is attempted even when one of them fails
+    bool ok = true;
+    bool tcp = sock->type == SOCK_TCP;
+
+    if (tcp && (profile & SOCK_PROFILE_LOW_LATENCY)) {
+        ok = sock_set_nodelay(sock, true) >= 0 && ok;
+        ok = sock_set_quickack(sock, true) >= 0 && ok;
+        ok = sock_set_notsent_lowat(sock, SOCK_PROFILE_NOTSENT_LOWAT) >= 0 && ok;
+    }
+
+    // The buffers are left to the kernel autotuning, which usually reaches
+    // larger sizes than the ones allowed to SO_SNDBUF and SO_RCVBUF
+    if (tcp && (profile & SOCK_PROFILE_THROUGHPUT)) {
+        ok = sock_set_nodelay(sock, false) >= 0 && ok;
+    }
+
+    if (tcp && (profile & SOCK_PROFILE_KEEPALIVE)) {
+        ok = sock_set_keepalive(sock, SOCK_PROFILE_KEEPALIVE_IDLE,
+                                SOCK_PROFILE_KEEPALIVE_INTERVAL,
+                                SOCK_PROFILE_KEEPALIVE_COUNT) && ok;
+    }
+
+    if (applied != NULL) {
+        int last_errno = sock->last_errno;
+        sock_get_tuning(sock, applied);
+        sock->last_errno = last_errno;
+    }
+
+    return ok;
+}
+
+bool sock_get_tuning(Sock *sock, SockTuning *tuning)
+{
+    if (sock == NULL) {
+        return false;
+    }
+
+    if (tuning == NULL) {
+        sock->last_errno = EINVAL;
+        return false;
+    }
+
+    bool tcp = sock->type == SOCK_TCP;
+    bool ok = true;
+
+    tuning->send_buffer = sock__get_option(sock, SOL_SOCKET, SO_SNDBUF, &ok);
+    tuning->recv_buffer = sock__get_option(sock, SOL_SOCKET, SO_RCVBUF, &ok);
+    tuning->busy_poll = sock__get_option(sock, SOL_SOCKET, SO_BUSY_POLL, &ok);
+    tuning->keepalive = sock__get_option(sock, SOL_SOCKET, SO_KEEPALIVE, &ok);
+
+    tuning->nodelay = -1;
+    tuning->quickack = -1;
+    tuning->notsent_lowat = -1;
+    tuning->keepalive_idle = -1;
+    tuning->keepalive_interval = -1;
+    tuning->keepalive_count = -1;
+
+    if (tcp) {
+        tuning->nodelay = sock__get_option(sock, IPPROTO_TCP, TCP_NODELAY, &ok);
+        tuning->quickack = sock__get_option(sock, IPPROTO_TCP, TCP_QUICKACK, &ok);
+        tuning->notsent_lowat = sock__get_option(sock, IPPROTO_TCP,
+                                                 TCP_NOTSENT_LOWAT, &ok);
+        tuning->keepalive_idle = sock__get_option(sock, IPPROTO_TCP,
+                                                  TCP_KEEPIDLE, &ok);
+        tuning->keepalive_interval = sock__get_option(sock, IPPROTO_TCP,
+                                                      TCP_KEEPINTVL, &ok);
+        tuning->keepalive_count = sock__get_option(sock, IPPROTO_TCP,
+                                                   TCP_KEEPCNT, &ok);
+    }
+
+    return ok;
+}
+
+void sock_set_lazy_addr(Sock *sock, bool enable)
+{
+    if (sock == NULL) {
+        return;
+    }
+
+    if (enable) {
+        sock->flags |= SOCK__LAZY_ADDR;
+    } else {
+        sock->flags &= ~SOCK__LAZY_ADDR;
+    }
+}
+
+SockThreadPool *sock_thread_pool_create(size_t workers, size_t queue_capacity, SockPoolPolicy policy)
+{
+    if (workers == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (queue_capacity == 0) {
+        queue_capacity = SOCK_POOL_DEFAULT_QUEUE_CAPACITY;
+    }
+
+    SockThreadPool *pool = (SockThreadPool*)SOCK_MALLOC(sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->policy = policy;
+    pool->stats.queue_capacity = queue_capacity;
+
+    pool->jobs = (SockThreadData*)SOCK_MALLOC(sizeof(*pool->jobs) * queue_capacity);
+    pool->threads = (pthread_t*)SOCK_MALLOC(sizeof(*pool->threads) * workers);
+    if (pool->jobs == NULL || pool->threads == NULL) {
+        SOCK_FREE(pool->jobs);
+        SOCK_FREE(pool->threads);
+        SOCK_FREE(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    for (size_t i = 0; i < workers; ++i) {
+        int err = pthread_create(&pool->threads[i], NULL, sock__pool_worker,
+                                 pool);
+        if (err != 0) {
+            // Tear down the workers that were already started
+            sock_thread_pool_destroy(pool);
+            errno = err;
+            return NULL;
+        }
+        pool->stats.workers++;
+    }
+
+    return pool;
+}
+
+bool sock_thread_pool_submit(SockThreadPool *pool, SockThreadCallback fn, Sock *sock, void *user_data)
+{
+    if (pool == NULL || fn == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->stats.queue_depth >= pool->stats.queue_capacity) {
+        if (pool->policy == SOCK_POOL_BLOCK && !pool->stopping) {
+            pthread_cond_wait(&pool->not_full, &pool->lock);
+            continue;
+        }
+
+        if (pool->policy == SOCK_POOL_INLINE) {
+            pool->stats.jobs_inline++;
+            pthread_mutex_unlock(&pool->lock);
+            fn(sock, user_data);
+            return true;
+        }
+
+        pool->stats.rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        errno = EBUSY;
+        return false;
+    }
+
+    size_t tail = (pool->head + pool->stats.queue_depth)
+                  % pool->stats.queue_capacity;
+    pool->jobs[tail].callback = fn;
+    pool->jobs[tail].sock = sock;
+    pool->jobs[tail].user_data = user_data;
+    pool->stats.queue_depth++;
+
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+SockPoolStats sock_thread_pool_stats(SockThreadPool *pool)
+{
+    SockPoolStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (pool == NULL) {
+        return stats;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+
+    return stats;
+}
+
+void sock_thread_pool_destroy(SockThreadPool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_cond_broadcast(&pool->not_full);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->stats.workers; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->not_full);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->lock);
+    SOCK_FREE(pool->threads);
+    SOCK_FREE(pool->jobs);
+    SOCK_FREE(pool);
+}
+
+SockConnPool *sock_conn_pool_create(size_t max_idle, size_t max_per_host, int idle_timeout_ms)
+{
+    if (idle_timeout_ms < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SockConnPool *pool = (SockConnPool*)SOCK_MALLOC(sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->max_idle = max_idle;
+    pool->max_per_host = max_per_host;
+    pool->idle_timeout_ms = idle_timeout_ms;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+Sock *sock_conn_pool_get(SockConnPool *pool, SockAddr addr, int timeout_ms)
+{
+    if (pool == NULL || addr.type == SOCK_ADDR_INVALID) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    SockConnHost *host = sock__conn_host(pool, &addr, false);
+
+    int64_t now = sock_now_ms();
+    while (host != NULL && host->idle != NULL) {
+        SockConnIdle *idle = host->idle;
+        bool expired = pool->idle_timeout_ms > 0
+                       && now - idle->since >= pool->idle_timeout_ms;
+
+        if (!expired && sock__conn_alive(idle->sock)) {
+            Sock *sock = idle->sock;
+            host->idle = idle->next;
+            pool->stats.idle--;
+            pool->stats.hits++;
+            pthread_mutex_unlock(&pool->lock);
+            SOCK_FREE(idle);
+            return sock;
+        }
+
+        // Socks put back before an expired one are expired as well
+        host->idle = expired ? NULL : idle->next;
+        if (!expired) {
+            idle->next = NULL;
+        }
+
+        bool released = false;
+        while (idle != NULL) {
+            SockConnIdle *next = idle->next;
+            pool->stats.idle--;
+            pool->stats.stale++;
+            released = sock__conn_discard(pool, host, idle->sock);
+            SOCK_FREE(idle);
+            idle = next;
+        }
+
+        if (released) {
+            break;
+        }
+    }
+
+    host = sock__conn_host(pool, &addr, true);
+    if (host == NULL) {
+        pthread_mutex_unlock(&pool->lock);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (pool->max_per_host > 0 && host->open >= pool->max_per_host) {
+        pool->stats.refused++;
+        pthread_mutex_unlock(&pool->lock);
+        errno = EBUSY;
+        return NULL;
+    }
+
+    // Reserve the slot so that the connection can happen without the lock
+    host->open++;
+    pool->stats.open++;
+    pool->stats.misses++;
+    pthread_mutex_unlock(&pool->lock);
+
+    Sock *sock = sock_create(addr.type, SOCK_TCP);
+    bool connected = false;
+    int err = errno;
+    if (sock != NULL) {
+        connected = timeout_ms > 0 ? sock_connect_timeout(sock, addr, timeout_ms)
+                                   : sock_connect(sock, addr);
+        err = sock->last_errno;
+    }
+
+    if (connected) {
+        return sock;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    sock__conn_discard(pool, sock__conn_host(pool, &addr, false), sock);
+    pthread_mutex_unlock(&pool->lock);
+
+    errno = err;
+    return NULL;
+}
+
+void sock_conn_pool_put(SockConnPool *pool, Sock *sock, bool reuse)
+{
+    if (pool == NULL || sock == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    SockConnHost *host = sock__conn_host(pool, &sock->addr, false);
+    if (host == NULL) {
+        // Not a sock of this pool
+        sock__conn_discard(pool, NULL, sock);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    SockConnIdle *idle = NULL;
+    if (reuse && (pool->max_idle == 0 || pool->stats.idle < pool->max_idle)) {
+        idle = (SockConnIdle*)SOCK_MALLOC(sizeof(*idle));
+    }
+
+    if (idle == NULL) {
+        sock__conn_discard(pool, host, sock);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    idle->sock = sock;
+    idle->since = sock_now_ms();
+    idle->next = host->idle;
+    host->idle = idle;
+    pool->stats.idle++;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+SockConnPoolStats sock_conn_pool_stats(SockConnPool *pool)
+{
+    SockConnPoolStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (pool == NULL) {
+        return stats;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+
+    return stats;
+}
+
+void sock_conn_pool_destroy(SockConnPool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < pool->host_count; ++i) {
+        SockConnIdle *idle = pool->hosts[i].idle;
+        while (idle != NULL) {
+            SockConnIdle *next = idle->next;
+            close(idle->sock->fd);
+            sock__slab_free(SOCK__SLAB_SOCK, idle->sock);
+            SOCK_FREE(idle);
+            idle = next;
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    SOCK_FREE(pool->hosts);
+    SOCK_FREE(pool);
+}
+
+SockReader *sock_reader_create(Sock *sock, size_t capacity)
+{
+    if (sock == NULL || sock->type != SOCK_TCP) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (capacity == 0) {
+        capacity = SOCK_READER_DEFAULT_CAPACITY;
+    }
+
+    // The buffer is allocated right after the reader
+    SockReader *reader = (SockReader*)SOCK_MALLOC(sizeof(*reader) + capacity);
+    if (reader == NULL) {
+        return NULL;
+    }
+    memset(reader, 0, sizeof(*reader));
+
+    reader->sock = sock;
+    reader->data = (uint8_t*)(reader + 1);
+    reader->capacity = capacity;
+
+    return reader;
+}
+
+ssize_t sock_read_until(SockReader *reader, const char *delim, const void **data)
+{
+    if (reader == NULL || delim == NULL || delim[0] == '\0' || data == NULL) {
+        if (reader != NULL) {
+            reader->sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    size_t delim_len = strlen(delim);
+
+    while (true) {
+        // Skip what was already searched by a previous call
+        uint8_t *begin = reader->data + reader->start;
+        size_t len = reader->end - reader->start;
+        size_t offset = reader->scanned;
+
+        while (offset + delim_len <= len) {
+            uint8_t *found = (uint8_t*)memchr(begin + offset, delim[0],
+                                              len - offset - delim_len + 1);
+            if (found == NULL) {
+                break;
+            }
+            offset = found - begin;
+            if (memcmp(found, delim, delim_len) == 0) {
+                size_t size = offset + delim_len;
+                *data = begin;
+                reader->start += size;
+                reader->scanned = 0;
+                return (ssize_t)size;
+            }
+            offset++;
+        }
+        reader->scanned = len >= delim_len ? len - delim_len + 1 : 0;
+
+        if (!sock__reader_fill(reader, len + 1)) {
+            return -1;
+        }
+    }
+}
+
+ssize_t sock_read_exact(SockReader *reader, size_t size, const void **data)
+{
+    if (reader == NULL || data == NULL) {
+        if (reader != NULL) {
+            reader->sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    while (reader->end - reader->start < size) {
+        if (!sock__reader_fill(reader, size)) {
+            return -1;
+        }
+    }
+
+    *data = reader->data + reader->start;
+    reader->start += size;
+    reader->scanned = 0;
+
+    return (ssize_t)size;
+}
+
+ssize_t sock_read_frame(SockReader *reader, SockFrameType type, const void **data)
+{
+    if (reader == NULL || data == NULL) {
+        if (reader != NULL) {
+            reader->sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    size_t header = type == SOCK_FRAME_U16 ? 2 : type == SOCK_FRAME_U32 ? 4 : 0;
+    if (header == 0) {
+        reader->sock->last_errno = EINVAL;
+        return -1;
+    }
+
+    while (reader->end - reader->start < header) {
+        if (!sock__reader_fill(reader, header)) {
+            return -1;
+        }
+    }
+
+    // The length is big-endian and does not include the header
+    const uint8_t *p = reader->data + reader->start;
+    size_t size = 0;
+    for (size_t i = 0; i < header; ++i) {
+        size = (size << 8) | p[i];
+    }
+
+    while (reader->end - reader->start < header + size) {
+        if (!sock__reader_fill(reader, header + size)) {
+            return -1;
+        }
+    }
+
+    *data = reader->data + reader->start + header;
+    reader->start += header + size;
+    reader->scanned = 0;
+
+    return (ssize_t)size;
+}
+
+void sock_reader_destroy(SockReader *reader)
+{
+    SOCK_FREE(reader);
+}
+SockWriter *sock_writer_create(Sock *sock, size_t capacity)
+{
+    if (sock == NULL || sock->type != SOCK_TCP) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (capacity == 0) {
+        capacity = SOCK_WRITER_DEFAULT_CAPACITY;
+    }
+
+    // The buffer is allocated right after the writer
+    SockWriter *writer = (SockWriter*)SOCK_MALLOC(sizeof(*writer) + capacity);
+    if (writer == NULL) {
+        return NULL;
+    }
+    memset(writer, 0, sizeof(*writer));
+
+    writer->sock = sock;
+    writer->data = (uint8_t*)(writer + 1);
+    writer->capacity = capacity;
+
+    return writer;
+}
+
+ssize_t sock_write(SockWriter *writer, const void *buf, size_t size)
+{
+    if (writer == NULL || (buf == NULL && size > 0)) {
+        if (writer != NULL) {
+            writer->sock->last_errno = EINVAL;
+        }
+        return -1;
+    }
+
+    if (size <= writer->capacity - writer->len) {
+        memcpy(writer->data + writer->len, buf, size);
+        writer->len += size;
+        return size;
+    }
+
+    if (!writer->corked) {
+        return sock__writer_send(writer, buf, size, 0);
+    }
+
+    // Keep the end of buf in the buffer, the flush that uncorks the writer
+    // has to send something without MSG_MORE to push the data out
+    size_t kept = size < writer->capacity ? size : writer->capacity;
+    ssize_t n = sock__writer_send(writer, buf, size - kept, MSG_MORE);
+    if (n < 0 || (size_t)n < size - kept) {
+        return n;
+    }
+
+    size_t room = writer->capacity - writer->len;
+    if (kept > room) {
+        kept = room;
+    }
+    memcpy(writer->data + writer->len, (const uint8_t*)buf + n, kept);
+    writer->len += kept;
+
+    return n + kept;
+}
+
+bool sock_flush(SockWriter *writer)
+{
+    if (writer == NULL) {
+        return false;
+    }
+
+    return sock__writer_send(writer, NULL, 0, 0) == 0 && writer->len == 0;
+}
+
+bool sock_writer_cork(SockWriter *writer, bool enable)
+{
+    if (writer == NULL) {
+        return false;
+    }
+
+    writer->corked = enable;
+    if (enable) {
+        return true;
+    }
+
+    return sock_flush(writer);
+}
+
+void sock_writer_destroy(SockWriter *writer)
+{
+    SOCK_FREE(writer);
+}
+
+
+SockResolver *sock_resolver_create(size_t workers, size_t max_entries, int ttl_ms, int negative_ttl_ms)
+{
+    if (workers == 0 || ttl_ms < 0 || negative_ttl_ms < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (max_entries == 0) {
+        max_entries = SOCK_RESOLVER_DEFAULT_MAX_ENTRIES;
+    }
+
+    SockResolver *resolver = (SockResolver*)SOCK_MALLOC(sizeof(*resolver));
+    if (resolver == NULL) {
+        return NULL;
+    }
+    memset(resolver, 0, sizeof(*resolver));
+
+    resolver->max_entries = max_entries;
+    resolver->ttl_ms = ttl_ms;
+    resolver->negative_ttl_ms = negative_ttl_ms;
+
+    resolver->bucket_count = 16;
+    while (resolver->bucket_count < max_entries) {
+        resolver->bucket_count *= 2;
+    }
+    size_t buckets_size = resolver->bucket_count * sizeof(*resolver->buckets);
+    resolver->buckets = (SockResolverEntry**)SOCK_MALLOC(buckets_size);
+    if (resolver->buckets == NULL) {
+        SOCK_FREE(resolver);
+        return NULL;
+    }
+    memset(resolver->buckets, 0, buckets_size);
+
+    // Submissions wait for a free slot instead of failing the lookup
+    resolver->pool = sock_thread_pool_create(workers, 0, SOCK_POOL_BLOCK);
+    if (resolver->pool == NULL) {
+        SOCK_FREE(resolver->buckets);
+        SOCK_FREE(resolver);
+        return NULL;
+    }
+
+    pthread_mutex_init(&resolver->lock, NULL);
+    pthread_cond_init(&resolver->resolved, NULL);
+
+    return resolver;
+}
+
+bool sock_resolve(SockResolver *resolver, const char *name, int port, SockAddrType addr_hint, SockAddrList *list)
+{
+    if (resolver == NULL || name == NULL || list == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    pthread_mutex_lock(&resolver->lock);
+
+    SockResolverEntry *entry = sock__resolver_entry(resolver, name, addr_hint);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&resolver->lock);
+        errno = ENOMEM;
+        return false;
+    }
+    sock__resolver_touch(resolver, entry);
+
+    // Keep the entry from being evicted while it is used without the lock
+    entry->waiting++;
+
+    if (entry->pending) {
+        resolver->stats.coalesced++;
+        while (entry->pending) {
+            pthread_cond_wait(&resolver->resolved, &resolver->lock);
+        }
+    } else if (entry->expires <= sock_now_ms()) {
+        resolver->stats.misses++;
+        entry->pending = true;
+        pthread_mutex_unlock(&resolver->lock);
+
+        sock__resolver_query(NULL, entry);
+
+        pthread_mutex_lock(&resolver->lock);
+    } else {
+        resolver->stats.hits++;
+    }
+
+    entry->waiting--;
+
+    int error = entry->error;
+    if (error == 0 && !sock__addr_list_copy(list, &entry->list, port)) {
+        error = ENOMEM;
+    }
+
+    sock__resolver_evict(resolver);
+    pthread_mutex_unlock(&resolver->lock);
+
+    if (error != 0) {
+        list->count = 0;
+        errno = error;
+        return false;
+    }
+
+    return true;
+}
+
+bool sock_resolve_async(SockResolver *resolver, const char *name, int port, SockAddrType addr_hint, SockResolveCallback fn, void *user_data)
+{
+    if (resolver == NULL || name == NULL || fn == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    SockResolverWaiter *waiter = (SockResolverWaiter*)SOCK_MALLOC(sizeof(*waiter));
+    if (waiter == NULL) {
+        return false;
+    }
+    memset(waiter, 0, sizeof(*waiter));
+    waiter->callback = fn;
+    waiter->user_data = user_data;
+    waiter->port = port;
+
+    pthread_mutex_lock(&resolver->lock);
+
+    SockResolverEntry *entry = sock__resolver_entry(resolver, name, addr_hint);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&resolver->lock);
+        SOCK_FREE(waiter);
+        errno = ENOMEM;
+        return false;
+    }
+    sock__resolver_touch(resolver, entry);
+
+    if (!entry->pending && entry->expires > sock_now_ms()) {
+        resolver->stats.hits++;
+        int error = entry->error;
+        if (error == 0 && !sock__addr_list_copy(&waiter->list, &entry->list, port)) {
+            error = ENOMEM;
+        }
+        pthread_mutex_unlock(&resolver->lock);
+
+        fn(waiter->list, error, user_data);
+        SOCK_FREE(waiter);
+        return true;
+    }
+
+    waiter->next = entry->waiters;
+    entry->waiters = waiter;
+
+    if (entry->pending) {
+        resolver->stats.coalesced++;
+        pthread_mutex_unlock(&resolver->lock);
+        return true;
+    }
+
+    resolver->stats.misses++;
+    entry->pending = true;
+    pthread_mutex_unlock(&resolver->lock);
+
+    if (!sock_thread_pool_submit(resolver->pool, sock__resolver_query, NULL,
+                                 entry)) {
+        // The pool is being destroyed, resolve in this thread instead
+        sock__resolver_query(NULL, entry);
+    }
+
+    return true;
+}
+
+SockResolverStats sock_resolver_stats(SockResolver *resolver)
+{
+    SockResolverStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (resolver == NULL) {
+        return stats;
+    }
+
+    pthread_mutex_lock(&resolver->lock);
+    stats = resolver->stats;
+    pthread_mutex_unlock(&resolver->lock);
+
+    return stats;
+}
+
+void sock_resolver_destroy(SockResolver *resolver)
+{
+    if (resolver == NULL) {
+        return;
+    }
+
+    // Runs the queued lookups and their callbacks
+    sock_thread_pool_destroy(resolver->pool);
+
+    SockResolverEntry *entry = resolver->lru_head;
+    while (entry != NULL) {
+        SockResolverEntry *next = entry->lru_next;
+        sock_addr_list_free(&entry->list);
+        SOCK_FREE(entry->name);
+        SOCK_FREE(entry);
+        entry = next;
+    }
+
+    pthread_cond_destroy(&resolver->resolved);
+    pthread_mutex_destroy(&resolver->lock);
+    SOCK_FREE(resolver->buckets);
+    SOCK_FREE(resolver);
+}
+
+SockLoop *sock_loop_create(void)
+{
+    SockLoop *loop = (SockLoop*)SOCK_MALLOC(sizeof(*loop));
+    if (loop == NULL) {
+        return NULL;
+    }
+    memset(loop, 0, sizeof(*loop));
+
+    size_t entries_size = SOCK_LOOP_INITIAL_CAPACITY * sizeof(*loop->entries);
+    loop->entries = (SockLoopEntry**)SOCK_MALLOC(entries_size);
+    if (loop->entries == NULL) {
+        SOCK_FREE(loop);
+        return NULL;
+    }
+    memset(loop->entries, 0, entries_size);
+    loop->capacity = SOCK_LOOP_INITIAL_CAPACITY;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        SOCK_FREE(loop->entries);
+        SOCK_FREE(loop);
+        return NULL;
+    }
+
+    loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wakeup_fd < 0) {
+        close(loop->epfd);
+        SOCK_FREE(loop->entries);
+        SOCK_FREE(loop);
+        return NULL;
+    }
+
+    // The wakeup eventfd is the only registration with a NULL pointer
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakeup_fd, &ev) < 0) {
+        close(loop->wakeup_fd);
+        close(loop->epfd);
+        SOCK_FREE(loop->entries);
+        SOCK_FREE(loop);
+        return NULL;
+    }
+
+    loop->now = sock_now_ms();
+    sock__timer_wheel_init(&loop->timers, loop->now);
+
+    return loop;
+}
+
+bool sock_loop_add(SockLoop *loop, Sock *sock, int events, SockLoopCallback fn, void *user_data)
+{
+    if (loop == NULL || sock == NULL || fn == NULL || sock->fd < 0) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return false;
+    }
+
+    size_t fd = (size_t)sock->fd;
+
+    if (fd >= loop->capacity) {
+        size_t new_capacity = loop->capacity;
+        while (fd >= new_capacity) {
+            new_capacity *= 2;
+        }
+        SockLoopEntry **new_entries = (SockLoopEntry**)SOCK_REALLOC(
+                loop->entries, new_capacity * sizeof(*loop->entries));
+        if (new_entries == NULL) {
+            sock->last_errno = errno;
+            return false;
+        }
+        memset(new_entries + loop->capacity, 0,
+               (new_capacity - loop->capacity) * sizeof(*new_entries));
+        loop->entries = new_entries;
+        loop->capacity = new_capacity;
+    }
+
+    if (loop->entries[fd] != NULL) {
+        sock->last_errno = EEXIST;
+        return false;
+    }
+
+    if (!sock_set_nonblocking(sock, true)) {
+        return false;
+    }
+
+    SockLoopEntry *entry = (SockLoopEntry*)SOCK_MALLOC(sizeof(*entry));
+    if (entry == NULL) {
+        sock->last_errno = errno;
+        return false;
+    }
+    memset(entry, 0, sizeof(*entry));
+
+    entry->sock = sock;
+    entry->callback = fn;
+    entry->user_data = user_data;
+    entry->events = events;
+    sock_timer_init(&entry->idle_timer, sock__loop_idle_expired, loop);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = sock__loop_to_epoll(events);
+    ev.data.ptr = entry;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sock->fd, &ev) < 0) {
+        sock->last_errno = errno;
+        SOCK_FREE(entry);
+        return false;
+    }
+
+    loop->entries[fd] = entry;
+
+    return true;
+}
+
+bool sock_loop_modify(SockLoop *loop, Sock *sock, int events)
+{
+    if (loop == NULL || sock == NULL) {
+        return false;
+    }
+
+    size_t fd = (size_t)sock->fd;
+    if (sock->fd < 0 || fd >= loop->capacity || loop->entries[fd] == NULL) {
+        sock->last_errno = ENOENT;
+        return false;
+    }
+
+    SockLoopEntry *entry = loop->entries[fd];
+    if (entry->events == events) {
+        return true;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = sock__loop_to_epoll(events);
+    ev.data.ptr = entry;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, sock->fd, &ev) < 0) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+    entry->events = events;
+
+    return true;
+}
+
+bool sock_loop_remove(SockLoop *loop, Sock *sock)
+{
+    if (loop == NULL || sock == NULL) {
+        return false;
+    }
+
+    size_t fd = (size_t)sock->fd;
+    if (sock->fd < 0 || fd >= loop->capacity || loop->entries[fd] == NULL) {
+        sock->last_errno = ENOENT;
+        return false;
+    }
+
+    SockLoopEntry *entry = loop->entries[fd];
+    loop->entries[fd] = NULL;
+    sock_timer_stop(&entry->idle_timer);
+
+    bool result = true;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, sock->fd, NULL) < 0) {
+        sock->last_errno = errno;
+        result = false;
+    }
+
+    // Events for this entry may still be pending in the current batch, so
+    // its memory is released only after dispatching is over
+    if (loop->dispatching) {
+        entry->removed = true;
+        entry->next = loop->removed;
+        loop->removed = entry;
+    } else {
+        SOCK_FREE(entry);
+    }
+
+    return result;
+}
+
+bool sock_loop_set_timeout(SockLoop *loop, Sock *sock, int timeout_ms)
+{
+    if (loop == NULL || sock == NULL) {
+        return false;
+    }
+
+    size_t fd = (size_t)sock->fd;
+    if (sock->fd < 0 || fd >= loop->capacity || loop->entries[fd] == NULL) {
+        sock->last_errno = ENOENT;
+        return false;
+    }
+
+    SockLoopEntry *entry = loop->entries[fd];
+    entry->idle_timeout_ms = timeout_ms > 0 ? timeout_ms : 0;
+    entry->last_activity = sock_now_ms();
+
+    if (entry->idle_timeout_ms == 0) {
+        sock_timer_stop(&entry->idle_timer);
+        return true;
+    }
+
+    return sock_timer_start(&loop->timers, &entry->idle_timer,
+                            entry->last_activity + entry->idle_timeout_ms);
+}
+
+bool sock_loop_add_timer(SockLoop *loop, SockTimer *timer, int timeout_ms)
+{
+    if (loop == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return sock_timer_start(&loop->timers, timer, sock_now_ms() + timeout_ms);
+}
+
+int sock_loop_poll(SockLoop *loop, int timeout_ms)
+{
+    if (loop == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Wake up in time for the next timer
+    int timer_ms = sock_timer_wheel_timeout(&loop->timers, sock_now_ms());
+    if (timer_ms >= 0 && (timeout_ms < 0 || timer_ms < timeout_ms)) {
+        timeout_ms = timer_ms;
+    }
+
+    int n = epoll_wait(loop->epfd, loop->events, SOCK_LOOP_MAX_EVENTS,
+                       timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+
+    int dispatched = 0;
+    loop->dispatching = true;
+    loop->now = sock_now_ms();
+
+    for (int i = 0; i < n; ++i) {
+        SockLoopEntry *entry = (SockLoopEntry*)loop->events[i].data.ptr;
+
+        if (entry == NULL) {
+            uint64_t value;
+            while (read(loop->wakeup_fd, &value, sizeof(value)) > 0);
+            continue;
+        }
+
+        if (entry->removed) {
+            continue;
+        }
+
+        int events = sock__loop_from_epoll(loop->events[i].events);
+        entry->last_activity = loop->now;
+        entry->callback(loop, entry->sock, events, entry->user_data);
+        dispatched++;
+    }
+
+    dispatched += (int)sock_timer_wheel_advance(&loop->timers, loop->now);
+
+    loop->dispatching = false;
+
+    while (loop->removed != NULL) {
+        SockLoopEntry *next = loop->removed->next;
+        SOCK_FREE(loop->removed);
+        loop->removed = next;
+    }
+
+    return dispatched;
+}
+
+bool sock_loop_run(SockLoop *loop)
+{
+    if (loop == NULL) {
+        return false;
+    }
+
+    __atomic_store_n(&loop->running, true, __ATOMIC_RELEASE);
+
+    while (__atomic_load_n(&loop->running, __ATOMIC_ACQUIRE)) {
+        if (sock_loop_poll(loop, -1) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sock_loop_stop(SockLoop *loop)
+{
+    if (loop == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&loop->running, false, __ATOMIC_RELEASE);
+
+    uint64_t value = 1;
+    ssize_t n = write(loop->wakeup_fd, &value, sizeof(value));
+    (void) n;
+}
+
+void sock_loop_destroy(SockLoop *loop)
+{
+    if (loop == NULL) {
+        return;
+    }
+
+    sock__timer_wheel_clear(&loop->timers);
+
+    for (size_t i = 0; i < loop->capacity; ++i) {
+        SOCK_FREE(loop->entries[i]);
+    }
+
+    while (loop->removed != NULL) {
+        SockLoopEntry *next = loop->removed->next;
+        SOCK_FREE(loop->removed);
+        loop->removed = next;
+    }
+
+    close(loop->wakeup_fd);
+    close(loop->epfd);
+    SOCK_FREE(loop->entries);
+    SOCK_FREE(loop);
+}
+SockTimerWheel *sock_timer_wheel_create(void)
+{
+    SockTimerWheel *wheel = (SockTimerWheel*)SOCK_MALLOC(sizeof(*wheel));
+    if (wheel == NULL) {
+        return NULL;
+    }
+
+    sock__timer_wheel_init(wheel, sock_now_ms());
+
+    return wheel;
+}
+
+void sock_timer_init(SockTimer *timer, SockTimerCallback fn, void *user_data)
+{
+    if (timer == NULL) {
+        return;
+    }
+
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = fn;
+    timer->user_data = user_data;
+}
+
+bool sock_timer_start(SockTimerWheel *wheel, SockTimer *timer, int64_t deadline)
+{
+    if (wheel == NULL || timer == NULL || timer->callback == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    sock_timer_stop(timer);
+
+    timer->deadline = deadline;
+    timer->wheel = wheel;
+    wheel->count++;
+    sock__timer_wheel_insert(wheel, timer);
+
+    return true;
+}
+
+void sock_timer_stop(SockTimer *timer)
+{
+    if (timer == NULL || timer->wheel == NULL) {
+        return;
+    }
+
+    timer->link.prev->next = timer->link.next;
+    timer->link.next->prev = timer->link.prev;
+    timer->link.prev = NULL;
+    timer->link.next = NULL;
+    timer->wheel->count--;
+    timer->wheel = NULL;
+}
+
+size_t sock_timer_wheel_advance(SockTimerWheel *wheel, int64_t now)
+{
+    if (wheel == NULL) {
+        return 0;
+    }
+
+    size_t fired = 0;
+
+    while (wheel->current <= now) {
+        if (wheel->count == 0) {
+            wheel->current = now + 1;
+            break;
+        }
+
+        // Bring the timers of the next period of each level down a level
+        size_t index = (size_t)(wheel->current & SOCK_TIMER_MASK);
+        for (size_t level = 1; index == 0 && level < SOCK_TIMER_LEVELS; ++level) {
+            index = (size_t)((wheel->current >> (level * SOCK_TIMER_BITS))
+                             & SOCK_TIMER_MASK);
+            SockTimerLink pending;
+            sock__timer_list_take(&wheel->slots[level][index], &pending);
+            while (pending.next != &pending) {
+                SockTimer *timer = (SockTimer*)pending.next;
+                timer->link.prev->next = timer->link.next;
+                timer->link.next->prev = timer->link.prev;
+                sock__timer_wheel_insert(wheel, timer);
+            }
+        }
+
+        // Timers started by the callbacks go to the next ticks, and the
+        // ones stopped by them are unlinked from the pending list
+        SockTimerLink pending;
+        sock__timer_list_take(&wheel->slots[0][wheel->current & SOCK_TIMER_MASK],
+                              &pending);
+        wheel->current++;
+
+        while (pending.next != &pending) {
+            SockTimer *timer = (SockTimer*)pending.next;
+            sock_timer_stop(timer);
+            timer->callback(timer, timer->user_data);
+            fired++;
+        }
+    }
+
+    return fired;
+}
+
+int sock_timer_wheel_timeout(const SockTimerWheel *wheel, int64_t now)
+{
+    if (wheel == NULL || wheel->count == 0) {
+        return -1;
+    }
+
+    // The timers of the upper levels are moved down to the first one when a
+    // period of SOCK_TIMER_SLOTS ticks begins, so the first level is only
+    // scanned up to the end of the current period, and the wheel must be
+    // advanced at the start of a period even if the first level looks empty
+    int64_t end = wheel->current;
+    if ((wheel->current & SOCK_TIMER_MASK) != 0) {
+        end = (wheel->current | SOCK_TIMER_MASK) + 1;
+        for (int64_t tick = wheel->current; tick < end; ++tick) {
+            const SockTimerLink *slot = &wheel->slots[0][tick & SOCK_TIMER_MASK];
+            if (slot->next != slot) {
+                end = tick;
+                break;
+            }
+        }
+    }
+
+    int64_t timeout = end - now;
+    return timeout <= 0 ? 0 : timeout > INT32_MAX ? INT32_MAX : (int)timeout;
+}
+
+void sock_timer_wheel_destroy(SockTimerWheel *wheel)
+{
+    if (wheel == NULL) {
+        return;
+    }
+
+    sock__timer_wheel_clear(wheel);
+    SOCK_FREE(wheel);
+}
+
+SockMessage *sock_message_create(const void *data, size_t size)
+{
+    if (data == NULL && size > 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // The data is stored right after the message
+    SockMessage *message = (SockMessage*)SOCK_MALLOC(sizeof(*message) + size);
+    if (message == NULL) {
+        return NULL;
+    }
+
+    message->data = (uint8_t*)(message + 1);
+    message->size = size;
+    message->refs = 1;
+    if (size > 0) {
+        memcpy(message->data, data, size);
+    }
+
+    return message;
+}
+
+SockMessage *sock_message_ref(SockMessage *message)
+{
+    if (message != NULL) {
+        __atomic_fetch_add(&message->refs, 1, __ATOMIC_RELAXED);
+    }
+    return message;
+}
+
+void sock_message_unref(SockMessage *message)
+{
+    if (message == NULL) {
+        return;
+    }
+
+    if (__atomic_sub_fetch(&message->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        SOCK_FREE(message);
+    }
+}
+
+SockFanout *sock_fanout_create(size_t queue_capacity, SockFanoutPolicy policy)
+{
+    if (queue_capacity == 0) {
+        queue_capacity = SOCK_FANOUT_DEFAULT_QUEUE_CAPACITY;
+    }
+
+    SockFanout *fanout = (SockFanout*)SOCK_MALLOC(sizeof(*fanout));
+    if (fanout == NULL) {
+        return NULL;
+    }
+    memset(fanout, 0, sizeof(*fanout));
+
+    fanout->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fanout->event_fd < 0) {
+        SOCK_FREE(fanout);
+        return NULL;
+    }
+
+    // The ring indexes are masked, so its capacity is a power of two
+    size_t capacity = 2;
+    while (capacity < queue_capacity) {
+        capacity *= 2;
+    }
+
+    fanout->queue_capacity = capacity;
+    fanout->policy = policy;
+    pthread_mutex_init(&fanout->lock, NULL);
+    pthread_cond_init(&fanout->space, NULL);
+
+    return fanout;
+}
+
+bool sock_fanout_attach(SockFanout *fanout, SockLoop *loop)
+{
+    if (fanout == NULL || loop == NULL || fanout->loop != NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // The loop only knows about socks, so the eventfd gets one
+    fanout->event_sock.fd = fanout->event_fd;
+    if (!sock_loop_add(loop, &fanout->event_sock, SOCK_EVENT_READ,
+                       sock__fanout_ready, fanout)) {
+        errno = fanout->event_sock.last_errno;
+        return false;
+    }
+
+    fanout->loop = loop;
+
+    return true;
+}
+
+SockTopic *sock_fanout_topic(SockFanout *fanout, const char *name)
+{
+    if (fanout == NULL || name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&fanout->lock);
+
+    for (size_t i = 0; i < fanout->topic_count; ++i) {
+        if (strcmp(fanout->topics[i]->name, name) == 0) {
+            SockTopic *topic = fanout->topics[i];
+            pthread_mutex_unlock(&fanout->lock);
+            return topic;
+        }
+    }
+
+    size_t name_len = strlen(name);
+    SockTopic *topic = (SockTopic*)SOCK_MALLOC(sizeof(*topic) + name_len + 1);
+    SockTopic **topics = (SockTopic**)SOCK_REALLOC(fanout->topics,
+            (fanout->topic_count + 1) * sizeof(*fanout->topics));
+    if (topics != NULL) {
+        fanout->topics = topics;
+    }
+    if (topic == NULL || topics == NULL) {
+        pthread_mutex_unlock(&fanout->lock);
+        SOCK_FREE(topic);
+        return NULL;
+    }
+    memset(topic, 0, sizeof(*topic));
+
+    topic->fanout = fanout;
+    topic->name = (char*)(topic + 1);
+    memcpy(topic->name, name, name_len + 1);
+    pthread_rwlock_init(&topic->lock, NULL);
+    fanout->topics[fanout->topic_count++] = topic;
+
+    pthread_mutex_unlock(&fanout->lock);
+
+    return topic;
+}
+
+SockSubscriber *sock_fanout_subscribe(SockTopic *topic, Sock *sock)
+{
+    if (topic == NULL || sock == NULL || sock->type != SOCK_TCP) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SockFanout *fanout = topic->fanout;
+
+    SockSubscriber *sub = (SockSubscriber*)SOCK_MALLOC(sizeof(*sub));
+    if (sub == NULL) {
+        return NULL;
+    }
+    memset(sub, 0, sizeof(*sub));
+
+    sub->cells = (SockFanoutCell*)SOCK_MALLOC(sizeof(*sub->cells)
+                                             * fanout->queue_capacity);
+    if (sub->cells == NULL) {
+        SOCK_FREE(sub);
+        return NULL;
+    }
+
+    // Each cell starts out free for the lap of its index
+    for (size_t i = 0; i < fanout->queue_capacity; ++i) {
+        sub->cells[i].sequence = i;
+        sub->cells[i].message = NULL;
+    }
+
+    sub->topic = topic;
+    sub->sock = sock;
+    sub->mask = fanout->queue_capacity - 1;
+    sub->refs = 1;
+
+    pthread_rwlock_wrlock(&topic->lock);
+
+    if (topic->count == topic->capacity) {
+        size_t capacity = topic->capacity == 0 ? 16 : topic->capacity * 2;
+        SockSubscriber **subs = (SockSubscriber**)SOCK_REALLOC(topic->subs,
+                capacity * sizeof(*topic->subs));
+        if (subs == NULL) {
+            pthread_rwlock_unlock(&topic->lock);
+            SOCK_FREE(sub->cells);
+            SOCK_FREE(sub);
+            return NULL;
+        }
+        topic->subs = subs;
+        topic->capacity = capacity;
+    }
+    topic->subs[topic->count++] = sub;
+
+    pthread_rwlock_unlock(&topic->lock);
+
+    return sub;
+}
+
+void sock_fanout_unsubscribe(SockSubscriber *sub)
+{
+    if (sub == NULL) {
+        return;
+    }
+
+    SockTopic *topic = sub->topic;
+    SockFanout *fanout = topic->fanout;
+
+    // Publishers blocked on this subscriber give up on it
+    __atomic_store_n(&sub->closed, true, __ATOMIC_SEQ_CST);
+    if (fanout->policy == SOCK_FANOUT_BLOCK) {
+        pthread_mutex_lock(&fanout->lock);
+        pthread_cond_broadcast(&fanout->space);
+        pthread_mutex_unlock(&fanout->lock);
+    }
+
+    pthread_rwlock_wrlock(&topic->lock);
+    for (size_t i = 0; i < topic->count; ++i) {
+        if (topic->subs[i] == sub) {
+            topic->subs[i] = topic->subs[--topic->count];
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&topic->lock);
+
+    // No publisher can reach the queue anymore
+    SockMessage *message;
+    while ((message = sock__subscriber_pop(sub)) != NULL) {
+        sock_message_unref(message);
+    }
+    for (size_t i = 0; i < sub->inflight_count; ++i) {
+        sock_message_unref(sub->inflight[i]);
+    }
+    sub->inflight_count = 0;
+
+    sock__subscriber_unref(sub);
+}
+
+size_t sock_fanout_publish(SockTopic *topic, SockMessage *message, const Sock *except)
+{
+    if (topic == NULL || message == NULL) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    SockFanout *fanout = topic->fanout;
+    size_t queued = 0;
+
+    // Full subscribers waited for with SOCK_FANOUT_BLOCK, referenced
+    SockSubscriber **blocked = NULL;
+    size_t blocked_count = 0;
+    size_t blocked_capacity = 0;
+
+    __atomic_fetch_add(&fanout->stats.published, 1, __ATOMIC_RELAXED);
+
+    pthread_rwlock_rdlock(&topic->lock);
+
+    for (size_t i = 0; i < topic->count; ++i) {
+        SockSubscriber *sub = topic->subs[i];
+        if (sub->sock == except
+                || __atomic_load_n(&sub->overflowed, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        sock_message_ref(message);
+        if (sock__subscriber_push(sub, message)) {
+            sock__subscriber_schedule(sub);
+            queued++;
+            continue;
+        }
+
+        // The subscriber is not keeping up
+        switch (fanout->policy) {
+        case SOCK_FANOUT_DROP:
+            sock_message_unref(message);
+            __atomic_fetch_add(&fanout->stats.dropped, 1, __ATOMIC_RELAXED);
+            break;
+
+        case SOCK_FANOUT_DISCONNECT:
+            sock_message_unref(message);
+            __atomic_store_n(&sub->overflowed, true, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&fanout->stats.overflowed, 1, __ATOMIC_RELAXED);
+            sock__subscriber_schedule(sub);
+            break;
+
+        case SOCK_FANOUT_BLOCK:
+            // Waiting with the topic locked would stop the thread flushing
+            // the queue as soon as it (un)subscribes a sock
+            if (blocked_count == blocked_capacity) {
+                size_t capacity = blocked_capacity == 0 ? 8 : blocked_capacity * 2;
+                SockSubscriber **subs = (SockSubscriber**)SOCK_REALLOC(blocked,
+                        capacity * sizeof(*blocked));
+                if (subs == NULL) {
+                    sock_message_unref(message);
+                    __atomic_fetch_add(&fanout->stats.dropped, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+                blocked = subs;
+                blocked_capacity = capacity;
+            }
+            __atomic_fetch_add(&sub->refs, 1, __ATOMIC_RELAXED);
+            blocked[blocked_count++] = sub;
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(&topic->lock);
+
+    // Each of them holds a reference to message
+    for (size_t i = 0; i < blocked_count; ++i) {
+        if (sock__subscriber_wait(blocked[i], message)) {
+            queued++;
+        } else {
+            sock_message_unref(message);
+        }
+        sock__subscriber_unref(blocked[i]);
+    }
+    SOCK_FREE(blocked);
+
+    __atomic_fetch_add(&fanout->stats.queued, queued, __ATOMIC_RELAXED);
+
+    return queued;
+}
+
+ssize_t sock_subscriber_flush(SockSubscriber *sub)
+{
+    if (sub == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Sock *sock = sub->sock;
+    SockFanout *fanout = sub->topic->fanout;
+
+    if (__atomic_load_n(&sub->overflowed, __ATOMIC_RELAXED)) {
+        sock->last_errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t total = 0;
+    bool popped = false;
+
+    while (true) {
+        while (sub->inflight_count < SOCK_IOV_MAX) {
+            SockMessage *message = sock__subscriber_pop(sub);
+            if (message == NULL) {
+                break;
+            }
+            sub->inflight[sub->inflight_count++] = message;
+            popped = true;
+        }
+
+        if (sub->inflight_count == 0) {
+            break;
+        }
+
+        // The queued messages are gathered into a single system call
+        struct iovec iov[SOCK_IOV_MAX];
+        for (size_t i = 0; i < sub->inflight_count; ++i) {
+            iov[i].iov_base = sub->inflight[i]->data;
+            iov[i].iov_len = sub->inflight[i]->size;
+        }
+        iov[0].iov_base = (uint8_t*)iov[0].iov_base + sub->offset;
+        iov[0].iov_len -= sub->offset;
+
+        ssize_t n = sock__sendv(sock, iov, sub->inflight_count, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            total = -1;
+            break;
+        }
+        total += n;
+
+        size_t sent = (size_t)n + sub->offset;
+        size_t done = 0;
+        while (done < sub->inflight_count
+               && sent >= sub->inflight[done]->size) {
+            sent -= sub->inflight[done]->size;
+            sock_message_unref(sub->inflight[done]);
+            done++;
+        }
+        sub->inflight_count -= done;
+        memmove(sub->inflight, sub->inflight + done,
+                sub->inflight_count * sizeof(*sub->inflight));
+        sub->offset = sent;
+    }
+
+    if (popped && fanout->policy == SOCK_FANOUT_BLOCK
+            && __atomic_load_n(&fanout->waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&fanout->lock);
+        pthread_cond_broadcast(&fanout->space);
+        pthread_mutex_unlock(&fanout->lock);
+    }
+
+    // Wait for the sock to be writable only while data is pending
+    bool blocked = total < 0 && (sock->last_errno == EAGAIN
+                                 || sock->last_errno == EWOULDBLOCK);
+    sock__subscriber_watch(sub, blocked);
+
+    return total;
+}
+
+void sock_fanout_dispatch(SockFanout *fanout)
+{
+    if (fanout == NULL) {
+        return;
+    }
+
+    uint64_t value;
+    while (read(fanout->event_fd, &value, sizeof(value)) > 0);
+
+    SockSubscriber *ready = __atomic_exchange_n(&fanout->ready, NULL,
+                                                __ATOMIC_ACQUIRE);
+
+    // The list is a stack, flush the subscribers in scheduling order
+    SockSubscriber *ordered = NULL;
+    while (ready != NULL) {
+        SockSubscriber *next = ready->next_ready;
+        ready->next_ready = ordered;
+        ordered = ready;
+        ready = next;
+    }
+
+    while (ordered != NULL) {
+        SockSubscriber *sub = ordered;
+        ordered = sub->next_ready;
+
+        // Publishers reschedule the subscriber from now on
+        __atomic_store_n(&sub->scheduled, false, __ATOMIC_SEQ_CST);
+
+        if (!__atomic_load_n(&sub->closed, __ATOMIC_SEQ_CST)
+                && sock_subscriber_flush(sub) < 0) {
+            int err = sub->sock->last_errno;
+            if (err != EAGAIN && err != EWOULDBLOCK) {
+                sock__subscriber_report(sub);
+            }
+        }
+
+        sock__subscriber_unref(sub);
+    }
+}
+
+SockFanoutStats sock_fanout_stats(SockFanout *fanout)
+{
+    SockFanoutStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (fanout == NULL) {
+        return stats;
+    }
+
+    stats.published = __atomic_load_n(&fanout->stats.published, __ATOMIC_RELAXED);
+    stats.queued = __atomic_load_n(&fanout->stats.queued, __ATOMIC_RELAXED);
+    stats.dropped = __atomic_load_n(&fanout->stats.dropped, __ATOMIC_RELAXED);
+    stats.overflowed = __atomic_load_n(&fanout->stats.overflowed,
+                                       __ATOMIC_RELAXED);
+
+    return stats;
+}
+
+void sock_fanout_destroy(SockFanout *fanout)
+{
+    if (fanout == NULL) {
+        return;
+    }
+
+    if (fanout->loop != NULL) {
+        sock_loop_remove(fanout->loop, &fanout->event_sock);
+    }
+
+    for (size_t i = 0; i < fanout->topic_count; ++i) {
+        SockTopic *topic = fanout->topics[i];
+        while (topic->count > 0) {
+            sock_fanout_unsubscribe(topic->subs[topic->count - 1]);
+        }
+        pthread_rwlock_destroy(&topic->lock);
+        SOCK_FREE(topic->subs);
+        SOCK_FREE(topic);
+    }
+
+    // Release the references held by the subscribers still scheduled
+    SockSubscriber *ready = fanout->ready;
+    while (ready != NULL) {
+        SockSubscriber *next = ready->next_ready;
+        sock__subscriber_unref(ready);
+        ready = next;
+    }
+
+    close(fanout->event_fd);
+    pthread_cond_destroy(&fanout->space);
+    pthread_mutex_destroy(&fanout->lock);
+    SOCK_FREE(fanout->topics);
+    SOCK_FREE(fanout);
+}
+
+
+SockUring *sock_uring_create(unsigned entries, size_t buffer_count, size_t buffer_size)
+{
+    if (entries == 0) {
+        entries = SOCK_URING_DEFAULT_ENTRIES;
+    }
+    if (buffer_count == 0) {
+        buffer_count = SOCK_URING_DEFAULT_BUFFER_COUNT;
+    }
+    if (buffer_size == 0) {
+        buffer_size = SOCK_URING_DEFAULT_BUFFER_SIZE;
+    }
+
+    // Provided buffer rings need a power of two number of entries
+    size_t count = 1;
+    while (count < buffer_count && count < 32768) {
+        count *= 2;
+    }
+
+    SockUring *ring = (SockUring*)SOCK_MALLOC(sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+
+    ring->ring_fd = -1;
+    ring->buffer_count = count;
+    ring->buffer_size = buffer_size;
+    ring->buffers = (uint8_t*)SOCK_MALLOC(count * buffer_size);
+    if (ring->buffers == NULL) {
+        SOCK_FREE(ring);
+        return NULL;
+    }
+
+    ring->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->wakeup_fd < 0) {
+        SOCK_FREE(ring->buffers);
+        SOCK_FREE(ring);
+        return NULL;
+    }
+
+#ifdef SOCK_IO_URING
+    ring->native = sock__uring_setup(ring, entries);
+    if (ring->native) {
+        return ring;
+    }
+#endif // SOCK_IO_URING
+
+    ring->loop = sock_loop_create();
+    if (ring->loop == NULL) {
+        close(ring->wakeup_fd);
+        SOCK_FREE(ring->buffers);
+        SOCK_FREE(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+bool sock_uring_native(const SockUring *ring)
+{
+    return ring != NULL && ring->native;
+}
+
+bool sock_uring_accept(SockUring *ring, Sock *sock, SockUringCallback fn, void *user_data)
+{
+    if (ring == NULL || sock == NULL || fn == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return false;
+    }
+
+    SockUringRequest *req = sock__uring_request(ring, SOCK_URING_ACCEPT,
+                                                sock, fn, user_data);
+    if (req == NULL) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+#ifdef SOCK_IO_URING
+    if (ring->native) {
+        struct io_uring_sqe *sqe = sock__uring_sqe(ring);
+        if (sqe == NULL) {
+            sock->last_errno = errno;
+            sock__uring_release(ring, req);
+            return false;
+        }
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = sock->fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = (uint64_t)(uintptr_t)req;
+        return true;
+    }
+#endif // SOCK_IO_URING
+
+    if (!sock__uring_emulated_watch(ring, req, SOCK_EVENT_READ)) {
+        sock__uring_release(ring, req);
+        return false;
+    }
+
+    return true;
+}
+
+bool sock_uring_recv(SockUring *ring, Sock *sock, SockUringCallback fn, void *user_data)
+{
+    if (ring == NULL || sock == NULL || fn == NULL || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return false;
+    }
+
+    SockUringRequest *req = sock__uring_request(ring, SOCK_URING_RECV,
+                                                sock, fn, user_data);
+    if (req == NULL) {
+        sock->last_errno = errno;
+        return false;
+    }
+
+#ifdef SOCK_IO_URING
+    if (ring->native) {
+        if (!sock__uring_arm_recv(ring, req)) {
+            sock->last_errno = errno;
+            sock__uring_release(ring, req);
+            return false;
+        }
+        return true;
+    }
+#endif // SOCK_IO_URING
+
+    if (!sock__uring_emulated_watch(ring, req, SOCK_EVENT_READ)) {
+        sock__uring_release(ring, req);
+        return false;
+    }
+
+    return true;
+}
+
+bool sock_uring_send(SockUring *ring, Sock *sock, const void *buf, size_t size, SockUringCallback fn, void *user_data)
+{
+    if (ring == NULL || sock == NULL || buf == NULL || fn == NULL
+            || sock->type != SOCK_TCP) {
+        if (sock != NULL) {
+            sock->last_errno = EINVAL;
+        }
+        return false;
+    }
+
+    SockUringRequest *req = sock__uring_request(ring, SOCK_URING_SEND,
+                                                sock, fn, user_data);
+    if (req == NULL) {
+        sock->last_errno = errno;
+        return false;
+    }
+    req->buf = buf;
+    req->size = size;
+
+#ifdef SOCK_IO_URING
+    if (ring->native) {
+        struct io_uring_sqe *sqe = sock__uring_sqe(ring);
+        if (sqe == NULL) {
+            sock->last_errno = errno;
+            sock__uring_release(ring, req);
+            return false;
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = sock->fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = (uint32_t)size;
+        sqe->user_data = (uint64_t)(uintptr_t)req;
+        return true;
+    }
+#endif // SOCK_IO_URING
+
+    // Emulated sends are performed right away, unless earlier ones wait for
+    // room in the sock: they are then finished by sock_uring_poll() once the
+    // sock is writable. Their completion is delivered by sock_uring_poll()
+    bool queued = ring->blocked_sends > 0
+                  && sock__uring_blocked_send(ring, sock) != NULL;
+    if (!queued && sock__uring_emulated_send(ring, req)) {
+        return true;
+    }
+
+    if (!queued && !sock__uring_emulated_watch(ring, req, SOCK_EVENT_WRITE)) {
+        sock__uring_release(ring, req);
+        return false;
+    }
+    req->blocked = true;
+    ring->blocked_sends++;
+
+    return true;
+}
+
+bool sock_uring_cancel(SockUring *ring, Sock *sock)
+{
+    if (ring == NULL || sock == NULL) {
+        return false;
+    }
+
+#ifdef SOCK_IO_URING
+    if (ring->native) {
+        // A multishot receive may be in between two submissions, so it is
+        // also flagged to not be submitted again
+        for (SockUringRequest *req = ring->pending; req != NULL;
+                req = req->next) {
+            if (req->sock == sock) {
+                req->cancelled = true;
+            }
+        }
+
+        struct io_uring_sqe *sqe = sock__uring_sqe(ring);
+        if (sqe == NULL) {
+            sock->last_errno = errno;
+            return false;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = sock->fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = 0;
+        return true;
+    }
+#endif // SOCK_IO_URING
+
+    SockUringRequest *req = ring->pending;
+    while (req != NULL) {
+        SockUringRequest *next = req->next;
+        if (req->sock == sock) {
+            if (req->blocked) {
+                req->blocked = false;
+                ring->blocked_sends--;
+            }
+            req->error = ECANCELED;
+            sock__uring_complete(ring, req);
+        }
+        req = next;
+    }
+
+    if (sock__uring_emulated_entry(ring, sock) != NULL) {
+        sock_loop_remove(ring->loop, sock);
+    }
+
+    return true;
+}
+
+int sock_uring_poll(SockUring *ring, int timeout_ms)
+{
+    if (ring == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef SOCK_IO_URING
+    if (ring->native) {
+        if (sock__uring_enter(ring, 1, timeout_ms) < 0) {
+            return -1;
+        }
+
+        int dispatched = 0;
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+            head++;
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+            sock__uring_dispatch(ring, &cqe);
+            dispatched++;
+        }
+
+        return dispatched;
+    }
+#endif // SOCK_IO_URING
+
+    int dispatched = 0;
+    if (ring->completed == NULL) {
+        dispatched = sock_loop_poll(ring->loop, timeout_ms);
+        if (dispatched < 0) {
+            return -1;
+        }
+    }
+
+    // Dispatch completed sends and cancelled requests
+    while (ring->completed != NULL) {
+        SockUringRequest *req = ring->completed;
+        ring->completed = req->next;
+        if (ring->completed == NULL) {
+            ring->completed_last = NULL;
+        }
+
+        SockUringCompletion completion;
+        memset(&completion, 0, sizeof(completion));
+        completion.op = req->op;
+        completion.sock = req->sock;
+        completion.buf = req->buf;
+        completion.size = req->error == 0 ? req->size : 0;
+        completion.error = req->error;
+
+        req->callback(ring, &completion, req->user_data);
+        SOCK_FREE(req);
+        dispatched++;
+    }
+
+    return dispatched;
+}
+
+bool sock_uring_run(SockUring *ring)
+{
+    if (ring == NULL) {
+        return false;
+    }
+
+    __atomic_store_n(&ring->running, true, __ATOMIC_RELEASE);
+
+#ifdef SOCK_IO_URING
+    if (ring->native && !sock__uring_arm_wakeup(ring)) {
+        return false;
+    }
+#endif // SOCK_IO_URING
+
+    while (__atomic_load_n(&ring->running, __ATOMIC_ACQUIRE)) {
+        if (sock_uring_poll(ring, -1) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sock_uring_stop(SockUring *ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&ring->running, false, __ATOMIC_RELEASE);
+
+    if (ring->native) {
+        uint64_t value = 1;
+        ssize_t n = write(ring->wakeup_fd, &value, sizeof(value));
+        (void) n;
+    } else {
+        sock_loop_stop(ring->loop);
+    }
+}
+
+void sock_uring_destroy(SockUring *ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+#ifdef SOCK_IO_URING
+    if (ring->native) {
+        sock__uring_teardown(ring);
+    }
+#endif // SOCK_IO_URING
+
+    while (ring->pending != NULL) {
+        SockUringRequest *next = ring->pending->next;
+        SOCK_FREE(ring->pending);
+        ring->pending = next;
+    }
+
+    while (ring->completed != NULL) {
+        SockUringRequest *next = ring->completed->next;
+        SOCK_FREE(ring->completed);
+        ring->completed = next;
+    }
+
+    sock_loop_destroy(ring->loop);
+    close(ring->wakeup_fd);
+    SOCK_FREE(ring->buffers);
+    SOCK_FREE(ring);
+}
+
+bool sock__wait(Sock *sock, short events, int64_t deadline)
+{
+    struct pollfd pfd;
+    pfd.fd = sock->fd;
+    pfd.events = events;
+
+    while (true) {
+        int64_t remaining = deadline - sock_now_ms();
+        if (remaining <= 0) {
+            sock->last_errno = ETIMEDOUT;
+            return false;
+        }
+
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, remaining > INT32_MAX ? INT32_MAX : (int)remaining);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            return false;
+        }
+
+        // Errors and hang ups are reported by the next I/O call
+        if (n > 0) {
+            return true;
+        }
+    }
+}
+
+ssize_t sock__splice(Sock *sock, int file_fd, off_t *offset, size_t count)
+{
+    struct stat st;
+    if (fstat(file_fd, &st) < 0) {
+        sock->last_errno = errno;
+        return -1;
+    }
+
+    if (count > SOCK_SPLICE_CHUNK) {
+        count = SOCK_SPLICE_CHUNK;
+    }
+
+    // Pipes can be spliced into the socket directly, from where they are read
+    if (S_ISFIFO(st.st_mode)) {
+        if (offset != NULL) {
+            sock->last_errno = ESPIPE;
+            return -1;
+        }
+
+        while (true) {
+            ssize_t n = (ssize_t)syscall(SYS_splice, file_fd, NULL, sock->fd,
+                                         NULL, count, SPLICE_F_MOVE);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                sock->last_errno = errno;
+                return -1;
+            }
+            return n;
+        }
+    }
+
+    // Other files go through an intermediate pipe, which must not keep any
+    // data once returning: when the sock would block, what it holds is left in
+    // the file by moving the offset back. Files that cannot seek could not take
+    // it back, so they are only sent to blocking socks.
+    if (offset == NULL && lseek(file_fd, 0, SEEK_CUR) < 0) {
+        int flags = fcntl(sock->fd, F_GETFL, 0);
+        if (flags < 0 || (flags & O_NONBLOCK)) {
+            sock->last_errno = flags < 0 ? errno : EINVAL;
+            return -1;
+        }
+    }
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds) < 0) {
+        sock->last_errno = errno;
+        return -1;
+    }
+
+    ssize_t moved = 0;
+    while (true) {
+        moved = (ssize_t)syscall(SYS_splice, file_fd, offset, pipe_fds[1],
+                                 NULL, count, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+
+    if (moved < 0) {
+        sock->last_errno = errno;
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+
+    ssize_t remaining = moved;
+    while (remaining > 0) {
+        ssize_t n = (ssize_t)syscall(SYS_splice, pipe_fds[0], NULL, sock->fd,
+                                     NULL, (size_t)remaining, SPLICE_F_MOVE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (offset != NULL) {
+                    *offset -= remaining;
+                    break;
+                }
+                // A blocking sock only gets here once its send timeout
+                // expired, after which the data of a file that cannot seek
+                // is lost, as with any stream cut by a timeout
+                lseek(file_fd, -(off_t)remaining, SEEK_CUR);
+                break;
+            }
+            sock->last_errno = errno;
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            return -1;
+        }
+        remaining -= n;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    // Nothing could be sent before the sock would block
+    if (remaining > 0 && remaining == moved) {
+        sock->last_errno = EAGAIN;
+        return -1;
+    }
+
+    return moved - remaining;
+}
+
+ssize_t sock__sendto_segments(Sock *sock, const uint8_t *buf, size_t size, size_t segment_size, const SockAddr *addr)
+{
+    SockMsg msgs[SOCK_BATCH_MAX];
+    size_t offset = 0;
+
+    while (offset < size) {
+        size_t count = 0;
+        while (count < SOCK_BATCH_MAX && offset < size) {
+            size_t len = size - offset;
+            if (len > segment_size) {
+                len = segment_size;
+            }
+            msgs[count].buf = (void*)(buf + offset);
+            msgs[count].size = len;
+            msgs[count].addr = *addr;
+            offset += len;
+            count++;
+        }
+
+        ssize_t n = sock_sendto_batch(sock, msgs, count);
+        if (n < 0) {
+            return -1;
+        }
+        // A partial batch means the socket buffer is full: resend the rest
+        for (size_t i = (size_t)n; i < count; ++i) {
+            offset -= msgs[i].size;
+        }
+    }
+
+    return size;
+}
+
+bool sock__addr_equal(const SockAddr *a, const SockAddr *b)
+{
+    if (a->type != b->type || a->port != b->port) {
+        return false;
+    }
+
+    if (a->type == SOCK_IPV4) {
+        return a->ipv4.sin_addr.s_addr == b->ipv4.sin_addr.s_addr;
+    }
+
+    return memcmp(&a->ipv6.sin6_addr, &b->ipv6.sin6_addr,
+                  sizeof(a->ipv6.sin6_addr)) == 0
+           && a->ipv6.sin6_scope_id == b->ipv6.sin6_scope_id;
+}
+
+SockConnHost *sock__conn_host(SockConnPool *pool, const SockAddr *addr, bool create)
+{
+    for (size_t i = 0; i < pool->host_count; ++i) {
+        if (sock__addr_equal(&pool->hosts[i].addr, addr)) {
+            return &pool->hosts[i];
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (pool->host_count >= pool->host_capacity) {
+        size_t new_capacity = pool->host_capacity == 0
+                              ? SOCK_ADDR_LIST_INITIAL_CAPACITY
+                              : pool->host_capacity * 2;
+        SockConnHost *new_hosts = (SockConnHost*)SOCK_REALLOC(
+                pool->hosts, new_capacity * sizeof(*pool->hosts));
+        if (new_hosts == NULL) {
+            return NULL;
+        }
+        pool->hosts = new_hosts;
+        pool->host_capacity = new_capacity;
+    }
+
+    SockConnHost *host = &pool->hosts[pool->host_count++];
+    memset(host, 0, sizeof(*host));
+    host->addr = *addr;
+
+    return host;
+}
+
+bool sock__conn_alive(Sock *sock)
+{
+    // An idle connection must have nothing to read: EOF means the peer closed
+    // it and data would be a leftover of a previous exchange
+    uint8_t byte;
+    ssize_t n = recv(sock->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int sock__dns(const char *addr, int port, SockAddrType addr_hint, SockType sock_hint, SockAddrList *list)
+{
+    if (addr == NULL) {
+        return EINVAL;
+    }
+
+    list->items = (SockAddr*)SOCK_MALLOC(
+            sizeof(*list->items) * SOCK_ADDR_LIST_INITIAL_CAPACITY);
+    if (list->items == NULL) {
+        return ENOMEM;
+    }
+    list->capacity = SOCK_ADDR_LIST_INITIAL_CAPACITY;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = (addr_hint != SOCK_ADDR_INVALID ? addr_hint : AF_UNSPEC);
+    hints.ai_socktype = sock_hint;
+
+    char *service = NULL;
+    char port_str[16];
+    if (port > 0) {
+        snprintf(port_str, sizeof(port_str), "%d", port);
+        service = port_str;
+    }
+
+    struct addrinfo *res;
+    int status = getaddrinfo(addr, service, &hints, &res);
+    if (status != 0) {
+        // Translate the getaddrinfo() error into an errno value
+        switch (status) {
+            case EAI_AGAIN:  return EAGAIN;
+            case EAI_MEMORY: return ENOMEM;
+            case EAI_SYSTEM: return errno;
+            default:         return ENOENT;
+        }
+    }
+
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        SockAddr sa;
+        memset(&sa, 0, sizeof(sa));
+
+        bool skip = false;
+
+        switch (ai->ai_family) {
+            case AF_INET: {
+                struct sockaddr_in *sin = (struct sockaddr_in*)ai->ai_addr;
+                sa.type = SOCK_IPV4;
+                sa.port = ntohs(sin->sin_port);
+                sa.ipv4 = *sin;
+                sa.len = sizeof(sa.ipv4);
+                inet_ntop(AF_INET, &sa.ipv4.sin_addr, sa.str, sizeof(sa.str));
+            } break;
+
+            case AF_INET6: {
+                struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)ai->ai_addr;
+                sa.type = SOCK_IPV6;
+                sa.port = ntohs(sin6->sin6_port);
+                sa.ipv6 = *sin6;
+                sa.len = sizeof(sa.ipv6);
+                inet_ntop(AF_INET6, &sa.ipv6.sin6_addr, sa.str, sizeof(sa.str));
+            } break;
+
+            // Unreachable address family, skip address
+            default: {
+                skip = true;
+            } break;
+        }
+
+        if (skip) {
+            continue;
+        }
+
+        if (!sock__addr_list_push(list, &sa)) {
+            freeaddrinfo(res);
+            sock_addr_list_free(list);
+            return ENOMEM;
+        }
+    }
+
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+bool sock__addr_list_copy(SockAddrList *dst, const SockAddrList *src, int port)
+{
+    if (dst->capacity < src->count || dst->items == NULL) {
+        size_t capacity = dst->capacity > 0 ? dst->capacity
+                                            : SOCK_ADDR_LIST_INITIAL_CAPACITY;
+        while (capacity < src->count) {
+            capacity *= 2;
+        }
+        SockAddr *new_items = (SockAddr*)SOCK_REALLOC(
+                dst->items, capacity * sizeof(*dst->items));
+        if (new_items == NULL) {
+            return false;
+        }
+        dst->items = new_items;
+        dst->capacity = capacity;
+    }
+
+    for (size_t i = 0; i < src->count; ++i) {
+        SockAddr *sa = &dst->items[i];
+        *sa = src->items[i];
+        sa->port = port;
+        if (sa->type == SOCK_IPV4) {
+            sa->ipv4.sin_port = htons(port);
+        } else {
+            sa->ipv6.sin6_port = htons(port);
+        }
+    }
+    dst->count = src->count;
+
+    return true;
+}
+
+bool sock__addr_list_push(SockAddrList *list, const SockAddr *addr)
+{
+    if (list->count >= list->capacity || list->items == NULL) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2
+                                             : SOCK_ADDR_LIST_INITIAL_CAPACITY;
+        SockAddr *new_items = (SockAddr*)SOCK_REALLOC(
+                list->items, capacity * sizeof(*list->items));
+        if (new_items == NULL) {
+            return false;
+        }
+        list->items = new_items;
+        list->capacity = capacity;
+    }
+
+    list->items[list->count++] = *addr;
+
+    return true;
+}
+
+uint16_t sock__dns_id(void)
+{
+    uint16_t id = 0;
+#ifdef SYS_getrandom
+    if (syscall(SYS_getrandom, &id, sizeof(id), 0) == sizeof(id)) {
+        return id;
+    }
+#endif // SYS_getrandom
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint16_t)(ts.tv_nsec ^ (ts.tv_nsec >> 16) ^ getpid());
+}
+
+bool sock__dns_question(SockDnsQuestion *q, const char *name, uint16_t type)
+{
+    memset(q, 0, sizeof(*q));
+    q->id = sock__dns_id();
+    q->type = type;
+
+    uint8_t *buf = q->query;
+
+    // Header: id, recursion desired and a single question
+    buf[0] = q->id >> 8;
+    buf[1] = q->id & 0xff;
+    buf[2] = 0x01;
+    buf[5] = 1;
+    size_t len = 12;
+
+    // Name as a sequence of labels, a trailing dot is allowed
+    const char *label = name;
+    while (*label != '\0') {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot != NULL ? (size_t)(dot - label) : strlen(label);
+        if (label_len == 0 || label_len > 63 || len - 12 + label_len + 2 > 255) {
+            return false;
+        }
+        buf[len++] = (uint8_t)label_len;
+        memcpy(buf + len, label, label_len);
+        len += label_len;
+        label += label_len + (dot != NULL ? 1 : 0);
+    }
+    if (len == 12) {
+        return false;
+    }
+    buf[len++] = 0;
+
+    // Type and class IN
+    buf[len++] = type >> 8;
+    buf[len++] = type & 0xff;
+    buf[len++] = 0;
+    buf[len++] = 1;
+    q->query_len = len;
+
+    return true;
+}
+
+bool sock__dns_answer(SockDnsQuestion *q, const uint8_t *msg, size_t len, int port)
+{
+    // Match the id, the response flag and the question of the query
+    if (len < q->query_len || msg[0] != q->query[0] || msg[1] != q->query[1]
+        || !(msg[2] & 0x80) || msg[4] != 0 || msg[5] != 1) {
+        return false;
+    }
+    for (size_t i = 12; i < q->query_len; ++i) {
+        uint8_t a = msg[i] >= 'A' && msg[i] <= 'Z' ? msg[i] | 0x20 : msg[i];
+        uint8_t b = q->query[i] >= 'A' && q->query[i] <= 'Z' ? q->query[i] | 0x20
+                                                             : q->query[i];
+        if (a != b) {
+            return false;
+        }
+    }
+
+    if (msg[2] & 0x02) {
+        q->truncated = true;
+        return true;
+    }
+
+    int rcode = msg[3] & 0x0f;
+    if (rcode == 3) {
+        // The name does not exist
+        q->done = true;
+        q->error = ENOENT;
+        return true;
+    }
+    if (rcode != 0) {
+        // Server failure, refusal...: another server may do better
+        q->error = EAGAIN;
+        return true;
+    }
+
+    size_t answers = ((size_t)msg[6] << 8) | msg[7];
+    size_t off = q->query_len;
+    size_t first = q->addrs.count;
+
+    for (size_t i = 0; i < answers; ++i) {
+        // Skip the owner name, which ends with an empty label or a pointer
+        while (off < len && msg[off] != 0 && (msg[off] & 0xc0) != 0xc0) {
+            off += msg[off] + 1;
+        }
+        off += (off < len && msg[off] != 0) ? 2 : 1;
+
+        if (off + 10 > len) {
+            q->addrs.count = first;
+            q->error = EAGAIN;
+            return true;
+        }
+
+        uint16_t type = (msg[off] << 8) | msg[off + 1];
+        uint16_t klass = (msg[off + 2] << 8) | msg[off + 3];
+        size_t rdlen = ((size_t)msg[off + 8] << 8) | msg[off + 9];
+        off += 10;
+
+        if (off + rdlen > len) {
+            q->addrs.count = first;
+            q->error = EAGAIN;
+            return true;
+        }
+
+        // CNAME records are followed by the addresses of their target
+        SockAddr sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.port = port;
+
+        if (klass == 1 && type == q->type && type == 1 && rdlen == 4) {
+            sa.type = SOCK_IPV4;
+            sa.ipv4.sin_family = AF_INET;
+            sa.ipv4.sin_port = htons(port);
+            memcpy(&sa.ipv4.sin_addr, msg + off, 4);
+            sa.len = sizeof(sa.ipv4);
+            inet_ntop(AF_INET, &sa.ipv4.sin_addr, sa.str, sizeof(sa.str));
+        } else if (klass == 1 && type == q->type && type == 28 && rdlen == 16) {
+            sa.type = SOCK_IPV6;
+            sa.ipv6.sin6_family = AF_INET6;
+            sa.ipv6.sin6_port = htons(port);
+            memcpy(&sa.ipv6.sin6_addr, msg + off, 16);
+            sa.len = sizeof(sa.ipv6);
+            inet_ntop(AF_INET6, &sa.ipv6.sin6_addr, sa.str, sizeof(sa.str));
+        }
+
+        if (sa.type != SOCK_ADDR_INVALID && !sock__addr_list_push(&q->addrs, &sa)) {
+            q->addrs.count = first;
+            q->error = ENOMEM;
+            return true;
+        }
+
+        off += rdlen;
+    }
+
+    // An answer without address means that the name has no such record
+    q->done = true;
+    q->error = 0;
+
+    return true;
+}
+
+void sock__dns_exchange(SockDnsQuestion *questions, size_t count, const SockAddr *server, int timeout_ms, int port)
+{
+    Sock *sock = sock_create(server->type, SOCK_UDP);
+    if (sock == NULL) {
+        return;
+    }
+
+    // Questions still waiting for an answer from this server
+    bool waiting[2] = {false, false};
+    size_t remaining = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        SockDnsQuestion *q = &questions[i];
+        if (q->done) {
+            continue;
+        }
+        q->truncated = false;
+        if (sock_sendto_addr(sock, q->query, q->query_len, server) < 0) {
+            continue;
+        }
+        waiting[i] = true;
+        remaining++;
+    }
+
+    int64_t deadline = sock_now_ms() + timeout_ms;
+    uint8_t buf[SOCK_DNS_UDP_BUFFER_SIZE];
+
+    while (remaining > 0 && sock__wait(sock, POLLIN, deadline)) {
+        SockAddr from;
+        ssize_t n = sock_recvfrom(sock, buf, sizeof(buf), &from);
+        if (n < 0 || !sock__addr_equal(&from, server)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            SockDnsQuestion *q = &questions[i];
+            if (!waiting[i] || !sock__dns_answer(q, buf, n, port)) {
+                continue;
+            }
+            if (q->truncated) {
+                sock__dns_tcp(q, server, timeout_ms, port);
+            }
+            waiting[i] = false;
+            remaining--;
+            break;
+        }
+    }
+
+    close(sock->fd);
+    sock__slab_free(SOCK__SLAB_SOCK, sock);
+}
+
+void sock__dns_tcp(SockDnsQuestion *q, const SockAddr *server, int timeout_ms, int port)
+{
+    int64_t deadline = sock_now_ms() + timeout_ms;
+
+    q->truncated = false;
+    q->error = EAGAIN;
+
+    Sock *sock = sock_create(server->type, SOCK_TCP);
+    if (sock == NULL) {
+        return;
+    }
+
+    // Over TCP messages are prefixed by their length
+    uint8_t query[2 + SOCK_DNS_MAX_QUERY];
+    query[0] = q->query_len >> 8;
+    query[1] = q->query_len & 0xff;
+    memcpy(query + 2, q->query, q->query_len);
+
+    uint8_t prefix[2];
+    uint8_t *msg = NULL;
+
+    if (sock_connect_timeout(sock, *server, timeout_ms)
+        && sock_send_all_until(sock, query, q->query_len + 2, deadline)
+           == (ssize_t)q->query_len + 2
+        && sock_recv_all_until(sock, prefix, 2, deadline) == 2) {
+        size_t len = ((size_t)prefix[0] << 8) | prefix[1];
+        msg = (uint8_t*)SOCK_MALLOC(len > 0 ? len : 1);
+        if (msg != NULL && sock_recv_all_until(sock, msg, len, deadline)
+                           == (ssize_t)len) {
+            if (!sock__dns_answer(q, msg, len, port) || q->truncated) {
+                q->truncated = false;
+                q->error = EAGAIN;
+            }
+        }
+    }
+
+    SOCK_FREE(msg);
+    close(sock->fd);
+    sock__slab_free(SOCK__SLAB_SOCK, sock);
+}
+
+SockResolverEntry *sock__resolver_entry(SockResolver *resolver, const char *name, SockAddrType addr_hint)
+{
+    // Case insensitive FNV-1a hash of the name
+    uint32_t hash = 2166136261u ^ (uint32_t)addr_hint;
+    for (const char *c = name; *c != '\0'; ++c) {
+        char lower = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+        hash = (hash ^ (uint8_t)lower) * 16777619u;
+    }
+
+    SockResolverEntry **bucket = &resolver->buckets[hash
+                                 & (resolver->bucket_count - 1)];
+    for (SockResolverEntry *entry = *bucket; entry != NULL;
+         entry = entry->next) {
+        if (entry->addr_hint == addr_hint && strcasecmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+
+    size_t name_len = strlen(name);
+    SockResolverEntry *entry = (SockResolverEntry*)SOCK_MALLOC(sizeof(*entry));
+    char *name_copy = (char*)SOCK_MALLOC(name_len + 1);
+    if (entry == NULL || name_copy == NULL) {
+        SOCK_FREE(entry);
+        SOCK_FREE(name_copy);
+        return NULL;
+    }
+    memset(entry, 0, sizeof(*entry));
+    memcpy(name_copy, name, name_len + 1);
+
+    entry->resolver = resolver;
+    entry->name = name_copy;
+    entry->hash = hash;
+    entry->addr_hint = addr_hint;
+    entry->expires = INT64_MIN;
+
+    entry->next = *bucket;
+    *bucket = entry;
+
+    entry->lru_next = resolver->lru_head;
+    if (resolver->lru_head != NULL) {
+        resolver->lru_head->lru_prev = entry;
+    } else {
+        resolver->lru_tail = entry;
+    }
+    resolver->lru_head = entry;
+    resolver->stats.entries++;
+
+    return entry;
+}
+
+void sock__resolver_touch(SockResolver *resolver, SockResolverEntry *entry)
+{
+    if (resolver->lru_head == entry) {
+        return;
+    }
+
+    entry->lru_prev->lru_next = entry->lru_next;
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        resolver->lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = resolver->lru_head;
+    resolver->lru_head->lru_prev = entry;
+    resolver->lru_head = entry;
+}
+
+void sock__resolver_evict(SockResolver *resolver)
+{
+    SockResolverEntry *entry = resolver->lru_tail;
+
+    while (resolver->stats.entries > resolver->max_entries && entry != NULL) {
+        SockResolverEntry *prev = entry->lru_prev;
+
+        // Entries with a query in flight are still referenced
+        if (entry->pending || entry->waiting > 0) {
+            entry = prev;
+            continue;
+        }
+
+        if (prev != NULL) {
+            prev->lru_next = entry->lru_next;
+        } else {
+            resolver->lru_head = entry->lru_next;
+        }
+        if (entry->lru_next != NULL) {
+            entry->lru_next->lru_prev = prev;
+        } else {
+            resolver->lru_tail = prev;
+        }
+
+        SockResolverEntry **link = &resolver->buckets[entry->hash
+                                   & (resolver->bucket_count - 1)];
+        while (*link != entry) {
+            link = &(*link)->next;
+        }
+        *link = entry->next;
+
+        sock_addr_list_free(&entry->list);
+        SOCK_FREE(entry->name);
+        SOCK_FREE(entry);
+        resolver->stats.entries--;
+        resolver->stats.evictions++;
+
+        entry = prev;
+    }
+}
+
+void sock__resolver_query(Sock *sock, void *data)
+{
+    (void) sock;
+    SockResolverEntry *entry = (SockResolverEntry*)data;
+    SockResolver *resolver = entry->resolver;
+
+    // The name and hint of a pending entry are not modified, read them
+    // without the lock
+    SockAddrList list;
+    memset(&list, 0, sizeof(list));
+    int error = sock__dns(entry->name, 0, entry->addr_hint, SOCK_TCP, &list);
+
+    pthread_mutex_lock(&resolver->lock);
+
+    sock_addr_list_free(&entry->list);
+    entry->list = list;
+    entry->error = error;
+    entry->pending = false;
+
+    // Only successes and unknown names are cached, other errors are transient
+    int64_t now = sock_now_ms();
+    if (error == 0) {
+        entry->expires = now + resolver->ttl_ms;
+    } else if (error == ENOENT) {
+        entry->expires = now + resolver->negative_ttl_ms;
+    } else {
+        entry->expires = INT64_MIN;
+    }
+
+    SockResolverWaiter *waiters = entry->waiters;
+    entry->waiters = NULL;
+
+    // Copy the addresses for the callbacks before the entry can be evicted
+    for (SockResolverWaiter *w = waiters; w != NULL; w = w->next) {
+        w->error = error;
+        if (error == 0 && !sock__addr_list_copy(&w->list, &entry->list, w->port)) {
+            w->error = ENOMEM;
+        }
+    }
+
+    pthread_cond_broadcast(&resolver->resolved);
+    sock__resolver_evict(resolver);
+    pthread_mutex_unlock(&resolver->lock);
+
+    while (waiters != NULL) {
+        SockResolverWaiter *next = waiters->next;
+        waiters->callback(waiters->list, waiters->error, waiters->user_data);
+        SOCK_FREE(waiters);
+        waiters = next;
+    }
+}
+
+bool sock__conn_discard(SockConnPool *pool, SockConnHost *host, Sock *sock)
+{
+    // The pool is the client side, there is no need to drain like sock_close()
+    if (sock != NULL) {
+        close(sock->fd);
+        sock__slab_free(SOCK__SLAB_SOCK, sock);
+    }
+
+    if (host == NULL) {
+        return false;
+    }
+
+    host->open--;
+    pool->stats.open--;
+    if (host->open > 0) {
+        return false;
+    }
+
+    // Forget the host by moving the last one in its place
+    *host = pool->hosts[--pool->host_count];
+    return true;
+}
+
+void *sock__slab_alloc(SockSlabKind kind)
+{
+#if SOCK_FREELIST_CAPACITY > 0
+    SockSlab *slab = sock__slab;
+    if (slab != NULL && slab->free[kind] != NULL) {
+        SockSlabNode *node = slab->free[kind];
+        slab->free[kind] = node->next;
+        slab->count[kind]--;
+        return node;
+    }
+#endif // SOCK_FREELIST_CAPACITY
+
+    return SOCK_MALLOC(kind == SOCK__SLAB_SOCK ? sizeof(Sock)
+                                               : sizeof(SockThreadData));
+}
+
+void sock__slab_free(SockSlabKind kind, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+#if SOCK_FREELIST_CAPACITY > 0
+    SockSlab *slab = sock__slab;
+    if (slab == NULL) {
+        // The key destructor releases the slab when the thread exits
+        pthread_once(&sock__slab_once, sock__slab_init);
+        slab = (SockSlab*)SOCK_MALLOC(sizeof(*slab));
+        if (slab != NULL) {
+            memset(slab, 0, sizeof(*slab));
+            if (pthread_setspecific(sock__slab_key, slab) != 0) {
+                SOCK_FREE(slab);
+                slab = NULL;
+            }
+        }
+        sock__slab = slab;
+    }
+
+    if (slab != NULL && slab->count[kind] < SOCK_FREELIST_CAPACITY) {
+        SockSlabNode *node = (SockSlabNode*)ptr;
+        node->next = slab->free[kind];
+        slab->free[kind] = node;
+        slab->count[kind]++;
+        return;
+    }
+#else
+    (void) kind;
+#endif // SOCK_FREELIST_CAPACITY
+
+    SOCK_FREE(ptr);
+}
+
+void sock__slab_destroy(void *data)
+{
+    SockSlab *slab = (SockSlab*)data;
+
+    for (size_t i = 0; i < SOCK__SLAB_COUNT; ++i) {
+        SockSlabNode *node = slab->free[i];
+        while (node != NULL) {
+            SockSlabNode *next = node->next;
+            SOCK_FREE(node);
+            node = next;
+        }
+    }
+
+#if SOCK_FREELIST_CAPACITY > 0
+    sock__slab = NULL;
+#endif // SOCK_FREELIST_CAPACITY
+    SOCK_FREE(slab);
+}
+
+void sock__slab_init(void)
+{
+#if SOCK_FREELIST_CAPACITY > 0
+    pthread_key_create(&sock__slab_key, sock__slab_destroy);
+#endif // SOCK_FREELIST_CAPACITY
+}
+
+void sock__reaper_init(void)
+{
+    pthread_mutex_init(&sock__reaper.lock, NULL);
+
+    sock__reaper.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sock__reaper.epfd < 0) {
+        return;
+    }
+
+    sock__reaper.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sock__reaper.wakeup_fd < 0) {
+        close(sock__reaper.epfd);
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(sock__reaper.epfd, EPOLL_CTL_ADD, sock__reaper.wakeup_fd,
+                  &ev) < 0) {
+        close(sock__reaper.wakeup_fd);
+        close(sock__reaper.epfd);
+        return;
+    }
+
+    // The reaper lives as long as the process
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, sock__reaper_thread, NULL) != 0) {
+        pthread_attr_destroy(&attr);
+        close(sock__reaper.wakeup_fd);
+        close(sock__reaper.epfd);
+        return;
+    }
+    pthread_attr_destroy(&attr);
+
+    sock__reaper.started = true;
+}
+
+void *sock__reaper_thread(void *data)
+{
+    (void) data;
+
+    struct epoll_event events[SOCK_LOOP_MAX_EVENTS];
+    uint8_t buffer[4096];
+
+    while (true) {
+        pthread_mutex_lock(&sock__reaper.lock);
+        int timeout_ms = -1;
+        if (sock__reaper.head != NULL) {
+            int64_t remaining = sock__reaper.head->deadline - sock_now_ms();
+            timeout_ms = remaining <= 0 ? 0
+                         : remaining > INT32_MAX ? INT32_MAX : (int)remaining;
+        }
+        pthread_mutex_unlock(&sock__reaper.lock);
+
+        int n = epoll_wait(sock__reaper.epfd, events, SOCK_LOOP_MAX_EVENTS,
+                           timeout_ms);
+
+        for (int i = 0; i < n; ++i) {
+            SockReaperEntry *entry = (SockReaperEntry*)events[i].data.ptr;
+
+            if (entry == NULL) {
+                uint64_t value;
+                ssize_t r = read(sock__reaper.wakeup_fd, &value, sizeof(value));
+                (void) r;
+                continue;
+            }
+
+            // Discard the data until the peer closes the connection
+            bool finished = false;
+            while (true) {
+                ssize_t r = recv(entry->fd, buffer, sizeof(buffer), 0);
+                if (r > 0 || (r < 0 && errno == EINTR)) {
+                    continue;
+                }
+                finished = r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+
+            if (finished) {
+                pthread_mutex_lock(&sock__reaper.lock);
+                sock__reaper_unlink(entry);
+                pthread_mutex_unlock(&sock__reaper.lock);
+                close(entry->fd);
+                SOCK_FREE(entry);
+            }
+        }
+
+        // Close the connections whose peer did not close in time
+        pthread_mutex_lock(&sock__reaper.lock);
+        int64_t now = sock_now_ms();
+        while (sock__reaper.head != NULL && sock__reaper.head->deadline <= now) {
+            SockReaperEntry *entry = sock__reaper.head;
+            sock__reaper_unlink(entry);
+            close(entry->fd);
+            SOCK_FREE(entry);
+        }
+        pthread_mutex_unlock(&sock__reaper.lock);
+    }
+
+    return NULL;
+}
+
+void sock__reaper_unlink(SockReaperEntry *entry)
+{
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        sock__reaper.head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        sock__reaper.tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+Sock *sock__listen_reuseport(SockAddr *addr)
+{
+    Sock *sock = sock_create(addr->type, SOCK_TCP);
+    if (sock == NULL) {
+        return NULL;
+    }
+
+    int enable = 1;
+    int flags = fcntl(sock->fd, F_GETFL, 0);
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT,
+                   &enable, sizeof(enable)) < 0
+            || flags < 0 || fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) < 0
+            || !sock_bind_addr(sock, addr) || !sock_listen(sock)) {
+        int err = errno;
+        close(sock->fd);
+        sock__slab_free(SOCK__SLAB_SOCK, sock);
+        errno = err;
+        return NULL;
+    }
+
+    // The next shards have to use the port picked by the kernel
+    if (addr->port == 0) {
+        SockAddr bound;
+        memset(&bound, 0, sizeof(bound));
+        bound.len = sizeof(bound.ipv6);
+        if (getsockname(sock->fd, &bound.sockaddr, &bound.len) == 0) {
+            sock__convert_addr(&bound);
+            *addr = bound;
+            sock->addr = bound;
+        }
+    }
+
+    return sock;
+}
+
+void sock__pin_cpu(size_t index)
+{
+    // Same layout as cpu_set_t, which is only declared with _GNU_SOURCE
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+
+    long size = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+    if (size <= 0) {
+        return;
+    }
+
+    size_t bits = 8 * sizeof(unsigned long);
+    size_t allowed = 0;
+    for (size_t cpu = 0; cpu < (size_t)size * 8; ++cpu) {
+        if (mask[cpu / bits] & (1UL << (cpu % bits))) {
+            allowed++;
+        }
+    }
+    if (allowed == 0) {
+        return;
+    }
+
+    // Spread the shards over the CPUs the process may run on
+    size_t target = index % allowed;
+    for (size_t cpu = 0; cpu < (size_t)size * 8; ++cpu) {
+        if (!(mask[cpu / bits] & (1UL << (cpu % bits)))) {
+            continue;
+        }
+        if (target-- == 0) {
+            unsigned long pinned[sizeof(mask) / sizeof(unsigned long)];
+            memset(pinned, 0, sizeof(pinned));
+            pinned[cpu / bits] = 1UL << (cpu % bits);
+            syscall(SYS_sched_setaffinity, 0, sizeof(pinned), pinned);
+            return;
+        }
+    }
+}
+
+void *sock__shard_thread(void *data)
+{
+    SockShard *shard = (SockShard*)data;
+    SockShardedListener *listener = shard->owner;
+
+    sock__pin_cpu(shard->index);
+
+    Sock *clients[SOCK_BATCH_MAX];
+    struct pollfd pfds[2];
+    pfds[0].fd = shard->sock->fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = listener->stop_fd;
+    pfds[1].events = POLLIN;
+
+    while (true) {
+        pfds[0].revents = 0;
+        pfds[1].revents = 0;
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (pfds[1].revents != 0) {
+            break;
+        }
+
+        if (pfds[0].revents == 0) {
+            continue;
+        }
+
+        ssize_t n = sock_accept_batch(shard->sock, clients, SOCK_BATCH_MAX, 0);
+        for (ssize_t i = 0; i < n; ++i) {
+            listener->callback(clients[i], listener->user_data);
+        }
+    }
+
+    return NULL;
+}
+
+bool sock__reader_fill(SockReader *reader, size_t needed)
+{
+    Sock *sock = reader->sock;
+
+    if (needed > reader->capacity) {
+        sock->last_errno = EMSGSIZE;
+        return false;
+    }
+
+    // Move the pending bytes to the front, the views returned before this
+    // call are not valid anymore
+    if (reader->start == reader->end) {
+        reader->start = 0;
+        reader->end = 0;
+    } else if (reader->start + needed > reader->capacity) {
+        memmove(reader->data, reader->data + reader->start,
+                reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    ssize_t n = sock_recv(sock, reader->data + reader->end,
+                          reader->capacity - reader->end);
+    if (n < 0) {
+        return false;
+    }
+    if (n == 0) {
+        sock->last_errno = ENODATA;
+        return false;
+    }
+
+    reader->end += n;
+
+    return true;
+}
+
+ssize_t sock__sendv(Sock *sock, const struct iovec *iov, size_t count, int flags)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = count < SOCK_IOV_MAX ? count : SOCK_IOV_MAX;
+
+    while (true) {
+        ssize_t n = sendmsg(sock->fd, &msg, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sock->last_errno = errno;
+            return -1;
+        }
+        return n;
+    }
+}
+
+ssize_t sock__writer_send(SockWriter *writer, const void *buf, size_t size, int flags)
+{
+    Sock *sock = writer->sock;
+    const uint8_t *ptr = (const uint8_t*)buf;
+    size_t buffered = 0; // Bytes of the buffer sent
+    size_t consumed = 0; // Bytes of buf sent
+    bool failed = false;
+
+    // A single system call sends both the buffer and buf
+    while (buffered < writer->len || consumed < size) {
+        struct iovec iov[2];
+        size_t count = 0;
+        if (buffered < writer->len) {
+            iov[count].iov_base = writer->data + buffered;
+            iov[count].iov_len = writer->len - buffered;
+            count++;
+        }
+        if (consumed < size) {
+            iov[count].iov_base = (void*)(ptr + consumed);
+            iov[count].iov_len = size - consumed;
+            count++;
+        }
+
+        ssize_t n = sock__sendv(sock, iov, count, flags);
+        if (n < 0) {
+            failed = true;
+            break;
+        }
+
+        size_t sent = (size_t)n;
+        size_t from_buffer = writer->len - buffered;
+        if (sent <= from_buffer) {
+            buffered += sent;
+        } else {
+            buffered = writer->len;
+            consumed += sent - from_buffer;
+        }
+    }
+
+    // Keep what could not be sent for the next flush
+    writer->len -= buffered;
+    memmove(writer->data, writer->data + buffered, writer->len);
+
+    if (!failed) {
+        return consumed;
+    }
+
+    if (sock->last_errno != EAGAIN && sock->last_errno != EWOULDBLOCK) {
+        return -1;
+    }
+
+    // A non-blocking sock is full, buffer as much of buf as possible
+    size_t room = writer->capacity - writer->len;
+    size_t kept = size - consumed < room ? size - consumed : room;
+    memcpy(writer->data + writer->len, ptr + consumed, kept);
+    writer->len += kept;
+    consumed += kept;
+
+    return consumed > 0 || size == 0 ? (ssize_t)consumed : -1;
+}
+
+int sock__set_option(Sock *sock, int level, int name, int value)
+{
+    if (sock == NULL) {
+        return -1;
+    }
+
+    if (level == IPPROTO_TCP && sock->type != SOCK_TCP) {
+        sock->last_errno = EINVAL;
+        return -1;
+    }
+
+    if (setsockopt(sock->fd, level, name, &value, sizeof(value)) < 0) {
+        sock->last_errno = errno;
+        return -1;
+    }
+
+    // The kernel may round, double or clamp the value
+    bool ok = true;
+    int applied = sock__get_option(sock, level, name, &ok);
+
+    return ok ? applied : -1;
+}
+
+int sock__get_option(Sock *sock, int level, int name, bool *ok)
+{
+    int value = 0;
+    socklen_t len = sizeof(value);
+    if (getsockopt(sock->fd, level, name, &value, &len) < 0) {
+        sock->last_errno = errno;
+        *ok = false;
+        return -1;
+    }
+
+    return value;
+}
+
+void sock__fanout_ready(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    (void) loop;
+    (void) sock;
+    (void) events;
+
+    sock_fanout_dispatch((SockFanout*)user_data);
+}
+
+bool sock__subscriber_push(SockSubscriber *sub, SockMessage *message)
+{
+    // Bounded MPMC queue of Dmitry Vyukov: the sequence of a cell tells
+    // whether it is free for the current lap of the producers
+    size_t pos = __atomic_load_n(&sub->enqueue_pos, __ATOMIC_RELAXED);
+    SockFanoutCell *cell;
+
+    while (true) {
+        cell = &sub->cells[pos & sub->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&sub->enqueue_pos, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&sub->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->message = message;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+SockMessage *sock__subscriber_pop(SockSubscriber *sub)
+{
+    // Only the owner of the subscriber consumes the queue
+    size_t pos = sub->dequeue_pos;
+    SockFanoutCell *cell = &sub->cells[pos & sub->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != pos + 1) {
+        return NULL;
+    }
+
+    SockMessage *message = cell->message;
+    sub->dequeue_pos = pos + 1;
+    __atomic_store_n(&cell->sequence, pos + sub->mask + 1, __ATOMIC_RELEASE);
+
+    return message;
+}
+
+void sock__subscriber_schedule(SockSubscriber *sub)
+{
+    if (__atomic_exchange_n(&sub->scheduled, true, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    SockFanout *fanout = sub->topic->fanout;
+
+    // The ready stack holds a reference until the subscriber is flushed
+    __atomic_fetch_add(&sub->refs, 1, __ATOMIC_RELAXED);
+
+    SockSubscriber *head = __atomic_load_n(&fanout->ready, __ATOMIC_RELAXED);
+    do {
+        sub->next_ready = head;
+    } while (!__atomic_compare_exchange_n(&fanout->ready, &head, sub, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // Only the first subscriber of a batch wakes the dispatcher up
+    if (head == NULL) {
+        uint64_t one = 1;
+        ssize_t n = write(fanout->event_fd, &one, sizeof(one));
+        (void) n;
+    }
+}
+
+bool sock__subscriber_wait(SockSubscriber *sub, SockMessage *message)
+{
+    SockFanout *fanout = sub->topic->fanout;
+
+    // The subscriber has to be flushed for room to be made
+    sock__subscriber_schedule(sub);
+
+    pthread_mutex_lock(&fanout->lock);
+    __atomic_fetch_add(&fanout->waiters, 1, __ATOMIC_SEQ_CST);
+
+    bool pushed = false;
+    while (!(pushed = sock__subscriber_push(sub, message))
+           && !__atomic_load_n(&sub->closed, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&fanout->space, &fanout->lock);
+    }
+
+    __atomic_fetch_sub(&fanout->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&fanout->lock);
+
+    if (pushed) {
+        sock__subscriber_schedule(sub);
+    }
+
+    return pushed;
+}
+
+void sock__subscriber_watch(SockSubscriber *sub, bool blocked)
+{
+    SockLoop *loop = sub->topic->fanout->loop;
+    Sock *sock = sub->sock;
+    if (loop == NULL || blocked == sub->watching || sock->fd < 0
+            || (size_t)sock->fd >= loop->capacity
+            || loop->entries[sock->fd] == NULL) {
+        return;
+    }
+
+    int events = loop->entries[sock->fd]->events;
+    if (blocked) {
+        // The owner already waits for the sock to be writable
+        if (events & SOCK_EVENT_WRITE) {
+            return;
+        }
+        events |= SOCK_EVENT_WRITE;
+    } else {
+        events &= ~SOCK_EVENT_WRITE;
+    }
+
+    if (sock_loop_modify(loop, sock, events)) {
+        sub->watching = blocked;
+    }
+}
+
+void sock__subscriber_report(SockSubscriber *sub)
+{
+    SockLoop *loop = sub->topic->fanout->loop;
+    Sock *sock = sub->sock;
+    if (loop == NULL || sock->fd < 0 || (size_t)sock->fd >= loop->capacity
+            || loop->entries[sock->fd] == NULL) {
+        return;
+    }
+
+    SockLoopEntry *entry = loop->entries[sock->fd];
+    entry->callback(loop, sock, SOCK_EVENT_ERROR, entry->user_data);
+}
+
+void sock__subscriber_unref(SockSubscriber *sub)
+{
+    if (__atomic_sub_fetch(&sub->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        // A blocked publisher may have queued a message after it was
+        // unsubscribed
+        SockMessage *message;
+        while ((message = sock__subscriber_pop(sub)) != NULL) {
+            sock_message_unref(message);
+        }
+        SOCK_FREE(sub->cells);
+        SOCK_FREE(sub);
+    }
+}
+
+void sock__timer_wheel_init(SockTimerWheel *wheel, int64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->current = now;
+
+    for (size_t level = 0; level < SOCK_TIMER_LEVELS; ++level) {
+        for (size_t i = 0; i < SOCK_TIMER_SLOTS; ++i) {
+            SockTimerLink *slot = &wheel->slots[level][i];
+            slot->prev = slot;
+            slot->next = slot;
+        }
+    }
+}
+
+void sock__timer_wheel_insert(SockTimerWheel *wheel, SockTimer *timer)
+{
+    // Expired timers fire on the next tick
+    int64_t expires = timer->deadline;
+    if (expires < wheel->current) {
+        expires = wheel->current;
+    }
+
+    uint64_t delta = (uint64_t)(expires - wheel->current);
+    uint64_t max = ((uint64_t)1 << (SOCK_TIMER_LEVELS * SOCK_TIMER_BITS)) - 1;
+    if (delta > max) {
+        delta = max;
+        expires = wheel->current + (int64_t)max;
+    }
+
+    // The level is picked by how far the timer is, the slot by when it is
+    size_t level = 0;
+    while (level + 1 < SOCK_TIMER_LEVELS
+           && delta >= ((uint64_t)1 << ((level + 1) * SOCK_TIMER_BITS))) {
+        level++;
+    }
+    size_t index = (size_t)((expires >> (level * SOCK_TIMER_BITS))
+                            & SOCK_TIMER_MASK);
+
+    SockTimerLink *slot = &wheel->slots[level][index];
+    timer->link.prev = slot->prev;
+    timer->link.next = slot;
+    slot->prev->next = &timer->link;
+    slot->prev = &timer->link;
+}
+
+void sock__timer_list_take(SockTimerLink *slot, SockTimerLink *list)
+{
+    if (slot->next == slot) {
+        list->prev = list;
+        list->next = list;
+        return;
+    }
+
+    list->next = slot->next;
+    list->prev = slot->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    slot->prev = slot;
+    slot->next = slot;
+}
+
+void sock__timer_wheel_clear(SockTimerWheel *wheel)
+{
+    // Timers still armed become idle, stopping them later is harmless
+    for (size_t level = 0; level < SOCK_TIMER_LEVELS; ++level) {
+        for (size_t i = 0; i < SOCK_TIMER_SLOTS; ++i) {
+            SockTimerLink *slot = &wheel->slots[level][i];
+            while (slot->next != slot) {
+                sock_timer_stop((SockTimer*)slot->next);
+            }
+        }
+    }
+}
+
+void sock__loop_idle_expired(SockTimer *timer, void *user_data)
+{
+    SockLoop *loop = (SockLoop*)user_data;
+    SockLoopEntry *entry = (SockLoopEntry*)((uint8_t*)timer
+                           - offsetof(SockLoopEntry, idle_timer));
+
+    // Activity only records a time, the timer is moved when it expires
+    int64_t deadline = entry->last_activity + entry->idle_timeout_ms;
+    if (deadline > loop->now) {
+        sock_timer_start(&loop->timers, timer, deadline);
+        return;
+    }
+
+    entry->callback(loop, entry->sock, SOCK_EVENT_TIMEOUT, entry->user_data);
+
+    // Keep reporting the sock while it stays idle
+    if (!entry->removed && entry->idle_timeout_ms > 0
+            && timer->wheel == NULL) {
+        entry->last_activity = loop->now;
+        sock_timer_start(&loop->timers, timer,
+                         loop->now + entry->idle_timeout_ms);
+    }
+}
+
+void sock__stats_init(void)
+{
+    pthread_key_create(&sock__stats_key, sock__stats_retire);
+}
+
+void sock__stats_retire(void *data)
+{
+    SockStatsBlock *block = (SockStatsBlock*)data;
+
+    // Keep the counts of the exiting thread in the global totals
+    pthread_mutex_lock(&sock__stats_lock);
+    sock__stats_merge(&sock__stats_retired, &block->stats);
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        sock__stats_blocks = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    pthread_mutex_unlock(&sock__stats_lock);
+
+    sock__stats_block = NULL;
+    SOCK_FREE(block);
+}
+
+SockStatsBlock *sock__stats_block_get(void)
+{
+    SockStatsBlock *block = sock__stats_block;
+    if (block != NULL) {
+        return block;
+    }
+
+    // Counting must not change the errno seen by the caller
+    int saved_errno = errno;
+
+    pthread_once(&sock__stats_once, sock__stats_init);
+    block = (SockStatsBlock*)SOCK_MALLOC(sizeof(*block));
+    if (block != NULL) {
+        memset(block, 0, sizeof(*block));
+        if (pthread_setspecific(sock__stats_key, block) != 0) {
+            SOCK_FREE(block);
+            block = NULL;
+        }
+    }
+
+    if (block != NULL) {
+        pthread_mutex_lock(&sock__stats_lock);
+        block->next = sock__stats_blocks;
+        if (sock__stats_blocks != NULL) {
+            sock__stats_blocks->prev = block;
+        }
+        sock__stats_blocks = block;
+        pthread_mutex_unlock(&sock__stats_lock);
+    }
+
+    sock__stats_block = block;
+    errno = saved_errno;
+    return block;
+}
+
+void sock__stats_add(Sock *sock, size_t offset, uint64_t n)
+{
+    if (sock != NULL) {
+        uint64_t *counter = (uint64_t*)((uint8_t*)&sock->stats + offset);
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+    }
+
+    // Only this thread writes its block, readers may load it concurrently
+    SockStatsBlock *block = sock__stats_block_get();
+    if (block != NULL) {
+        uint64_t *total = (uint64_t*)((uint8_t*)&block->stats.io + offset);
+        __atomic_store_n(total, __atomic_load_n(total, __ATOMIC_RELAXED) + n,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+void sock__stats_io(Sock *sock, size_t offset, uint64_t bytes)
+{
+    // The bytes counter directly follows the calls counter
+    sock__stats_add(sock, offset, 1);
+    sock__stats_add(sock, offset + sizeof(uint64_t), bytes);
+}
+
+void sock__stats_latency(size_t offset, int64_t start_us)
+{
+    SockStatsBlock *block = sock__stats_block_get();
+    if (block == NULL) {
+        return;
+    }
+
+    int64_t elapsed = sock__now_us() - start_us;
+    uint64_t us = elapsed > 0 ? (uint64_t)elapsed : 0;
+
+    size_t bucket = us < 2 ? 0 : (size_t)(63 - __builtin_clzll(us));
+    if (bucket >= SOCK_HISTOGRAM_BUCKETS) {
+        bucket = SOCK_HISTOGRAM_BUCKETS - 1;
+    }
+
+    SockHistogram *histogram = (SockHistogram*)((uint8_t*)&block->stats + offset);
+    __atomic_store_n(&histogram->buckets[bucket],
+                     __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->count,
+                     __atomic_load_n(&histogram->count, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->sum_us,
+                     __atomic_load_n(&histogram->sum_us, __ATOMIC_RELAXED) + us,
+                     __ATOMIC_RELAXED);
+}
+
+void sock__stats_merge(SockGlobalStats *dst, const SockGlobalStats *src)
+{
+    // Every field of SockGlobalStats is a counter that can be summed
+    uint64_t *d = (uint64_t*)dst;
+    const uint64_t *s = (const uint64_t*)src;
+    for (size_t i = 0; i < sizeof(*dst) / sizeof(uint64_t); ++i) {
+        d[i] += __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+    }
+}
+
+int64_t sock__now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void *sock__accept_thread(void *data)
+{
+    if (data == NULL) {
+        return NULL;
+    }
+
+    SockThreadData *thread_data = (SockThreadData*) data;
+
+    SockThreadCallback callback = thread_data->callback;
+    Sock *sock = thread_data->sock;
+    void *user_data = thread_data->user_data;
+
+    sock__slab_free(SOCK__SLAB_THREAD_DATA, thread_data);
+
+    callback(sock, user_data);
+
+    return NULL;
 }
 
-ssize_t sock_recvfrom(Sock *sock, void *buf, size_t size, SockAddr *addr)
+void *sock__pool_worker(void *data)
 {
-    if (sock == NULL || buf == NULL || sock->type != SOCK_UDP) {
-        if (sock != NULL) {
-            sock->last_errno = EINVAL;
+    SockThreadPool *pool = (SockThreadPool*)data;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (pool->stats.queue_depth == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
         }
-        return -1;
+
+        // Queued jobs are still run when the pool is stopping
+        if (pool->stats.queue_depth == 0) {
+            break;
+        }
+
+        SockThreadData job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % pool->stats.queue_capacity;
+        pool->stats.queue_depth--;
+        pool->stats.busy++;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        job.callback(job.sock, job.user_data);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.busy--;
+        pool->stats.jobs_run++;
     }
 
-    struct sockaddr_storage sa_storage;
-    struct sockaddr *sa = NULL;
-    socklen_t sa_len = 0;
-    socklen_t *len_ptr = NULL;
+    pthread_mutex_unlock(&pool->lock);
 
-    if (addr != NULL) {
-        sa = (struct sockaddr*)&sa_storage;
-        sa_len = sizeof(sa_storage);
-        len_ptr = &sa_len;
+    return NULL;
+}
+
+SockUringRequest *sock__uring_request(SockUring *ring, SockUringOp op, Sock *sock, SockUringCallback fn, void *user_data)
+{
+    SockUringRequest *req = (SockUringRequest*)SOCK_MALLOC(sizeof(*req));
+    if (req == NULL) {
+        return NULL;
     }
+    memset(req, 0, sizeof(*req));
 
-    ssize_t res = 0;
-    while (true) {
-        res = recvfrom(sock->fd, buf, size, 0, sa, len_ptr);
-        if (res < 0) {
-            if (errno == EINTR) {
-                continue;
+    req->ring = ring;
+    req->op = op;
+    req->sock = sock;
+    req->callback = fn;
+    req->user_data = user_data;
+
+    req->next = ring->pending;
+    if (ring->pending != NULL) {
+        ring->pending->prev = req;
+    }
+    ring->pending = req;
+
+    return req;
+}
+
+void sock__uring_unlink(SockUring *ring, SockUringRequest *req)
+{
+    if (req->prev != NULL) {
+        req->prev->next = req->next;
+    } else {
+        ring->pending = req->next;
+    }
+    if (req->next != NULL) {
+        req->next->prev = req->prev;
+    }
+    req->prev = NULL;
+    req->next = NULL;
+}
+
+void sock__uring_release(SockUring *ring, SockUringRequest *req)
+{
+    sock__uring_unlink(ring, req);
+    SOCK_FREE(req);
+}
+
+void sock__uring_complete(SockUring *ring, SockUringRequest *req)
+{
+    // Completions are dispatched in the order the requests completed
+    sock__uring_unlink(ring, req);
+    if (ring->completed_last != NULL) {
+        ring->completed_last->next = req;
+    } else {
+        ring->completed = req;
+    }
+    ring->completed_last = req;
+}
+
+Sock *sock__uring_client(Sock *sock, int fd)
+{
+    Sock *client = (Sock*)sock__slab_alloc(SOCK__SLAB_SOCK);
+    if (client == NULL) {
+        return NULL;
+    }
+    memset(client, 0, sizeof(*client));
+
+    client->type = SOCK_TCP;
+    client->fd = fd;
+    client->flags = sock->flags & SOCK__LAZY_ADDR;
+    client->addr.len = sizeof(client->addr.ipv6);
+    if (getpeername(fd, &client->addr.sockaddr, &client->addr.len) == 0) {
+        sock__received_addr(client, &client->addr);
+    }
+
+    return client;
+}
+
+void sock__uring_emulated_ready(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    SockUringRequest *req = (SockUringRequest*)user_data;
+    SockUring *ring = req->ring;
+
+    // Sends waiting for room share the registration of the sock, and fail
+    // on errors and hang ups
+    if (ring->blocked_sends > 0
+            && (events & (SOCK_EVENT_WRITE | SOCK_EVENT_ERROR | SOCK_EVENT_HUP))) {
+        sock__uring_emulated_flush(ring, sock);
+    }
+    if (req->op == SOCK_URING_SEND || !(events & ~SOCK_EVENT_WRITE)) {
+        return;
+    }
+
+    SockUringCompletion completion;
+    memset(&completion, 0, sizeof(completion));
+    completion.op = req->op;
+    completion.sock = sock;
+    completion.more = true;
+
+    if (req->op == SOCK_URING_ACCEPT) {
+        // Drain the backlog like a multishot accept would
+        while (true) {
+            Sock *client = sock_accept(sock);
+            if (client == NULL) {
+                if (sock->last_errno == EAGAIN
+                        || sock->last_errno == EWOULDBLOCK) {
+                    return;
+                }
+                completion.client = NULL;
+                completion.error = sock->last_errno;
+            } else {
+                completion.client = client;
+                completion.error = 0;
+            }
+            req->callback(ring, &completion, req->user_data);
+            if (completion.error != 0) {
+                return;
             }
-            sock->last_errno = errno;
-            return -1;
         }
-        break;
     }
 
-    if (addr != NULL) {
-        memset(addr, 0, sizeof(*addr));
-        memcpy(&addr->sockaddr, sa, sa_len);
-        addr->len = sa_len;
-        sock__convert_addr(addr);
+    ssize_t n = recv(sock->fd, ring->buffers, ring->buffer_size, 0);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return;
+        }
+        completion.error = errno;
+        sock->last_errno = errno;
     }
 
-    return res;
+    completion.buf = ring->buffers;
+    completion.size = n > 0 ? (size_t)n : 0;
+    completion.more = n > 0;
+
+    if (!completion.more) {
+        // Sends still waiting for room take the registration over
+        SockUringRequest *send = ring->blocked_sends > 0
+                                 ? sock__uring_blocked_send(ring, sock) : NULL;
+        if (send != NULL) {
+            sock__uring_emulated_entry(ring, sock)->user_data = send;
+            sock_loop_modify(loop, sock, SOCK_EVENT_WRITE);
+        } else {
+            sock_loop_remove(loop, sock);
+        }
+        sock__uring_unlink(ring, req);
+        req->callback(ring, &completion, req->user_data);
+        SOCK_FREE(req);
+        return;
+    }
+
+    req->callback(ring, &completion, req->user_data);
 }
 
-void sock_close(Sock *sock)
+SockLoopEntry *sock__uring_emulated_entry(SockUring *ring, Sock *sock)
 {
-    if (sock == NULL) {
-        return;
+    SockLoop *loop = ring->loop;
+    if (sock->fd < 0 || (size_t)sock->fd >= loop->capacity) {
+        return NULL;
     }
 
-    shutdown(sock->fd, SHUT_WR);
-    uint8_t buffer[1024];
-    while (true) {
-        ssize_t n = sock_recv(sock, buffer, sizeof(buffer));
-        if (n <= 0) {
-            break;
+    return loop->entries[sock->fd];
+}
+
+bool sock__uring_emulated_watch(SockUring *ring, SockUringRequest *req, int events)
+{
+    Sock *sock = req->sock;
+    SockLoopEntry *entry = sock__uring_emulated_entry(ring, sock);
+    if (entry == NULL) {
+        return sock_loop_add(ring->loop, sock, events,
+                             sock__uring_emulated_ready, req);
+    }
+
+    // A sock has a single registration, owned by its accept or receive if
+    // any, and otherwise by its oldest send waiting for room
+    SockUringRequest *owner = (SockUringRequest*)entry->user_data;
+    if (req->op != SOCK_URING_SEND) {
+        if (owner->op != SOCK_URING_SEND) {
+            sock->last_errno = EEXIST;
+            return false;
         }
+        entry->user_data = req;
     }
 
-    close(sock->fd);
-    free(sock);
+    return sock_loop_modify(ring->loop, sock, entry->events | events);
 }
 
-void sock_log_error(const Sock *sock)
+bool sock__uring_emulated_send(SockUring *ring, SockUringRequest *req)
 {
-    if (sock == NULL) {
-        fprintf(stderr, "SOCK ERROR: socket is NULL. errno says: %s\n",
-                strerror(errno));
-        return;
+    ssize_t n;
+    do {
+        n = send(req->sock->fd, req->buf, req->size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
     }
 
-    fprintf(stderr, "SOCK ERROR: %s\n", strerror(sock->last_errno));
+    if (n < 0) {
+        req->error = errno;
+    } else {
+        req->size = (size_t)n;
+    }
+
+    if (req->blocked) {
+        req->blocked = false;
+        ring->blocked_sends--;
+    }
+    sock__uring_complete(ring, req);
+
+    return true;
 }
 
-void *sock__accept_thread(void *data)
+SockUringRequest *sock__uring_blocked_send(SockUring *ring, Sock *sock)
 {
-    if (data == NULL) {
-        return NULL;
+    // Requests are pushed at the head of the list, the oldest comes last
+    SockUringRequest *oldest = NULL;
+    for (SockUringRequest *req = ring->pending; req != NULL; req = req->next) {
+        if (req->blocked && req->sock == sock) {
+            oldest = req;
+        }
     }
 
-    SockThreadData *thread_data = (SockThreadData*) data;
+    return oldest;
+}
 
-    SockThreadCallback callback = thread_data->callback;
-    Sock *sock = thread_data->sock;
-    void *user_data = thread_data->user_data;
+void sock__uring_emulated_flush(SockUring *ring, Sock *sock)
+{
+    // Sends are finished in the order they were queued
+    SockUringRequest *req;
+    while ((req = sock__uring_blocked_send(ring, sock)) != NULL
+           && sock__uring_emulated_send(ring, req));
+
+    SockLoopEntry *entry = sock__uring_emulated_entry(ring, sock);
+    SockUringRequest *owner = (SockUringRequest*)entry->user_data;
+    if (owner->op != SOCK_URING_SEND) {
+        if (req == NULL) {
+            sock_loop_modify(ring->loop, sock, entry->events & ~SOCK_EVENT_WRITE);
+        }
+    } else if (req != NULL) {
+        entry->user_data = req;
+    } else {
+        sock_loop_remove(ring->loop, sock);
+    }
+}
 
-    free(thread_data);
+#ifdef SOCK_IO_URING
+bool sock__uring_setup(SockUring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
 
-    callback(sock, user_data);
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+    ring->ring_fd = fd;
+
+    // Multishot receives appeared together with IORING_OP_SEND_ZC, so the
+    // support of the latter tells whether the kernel is recent enough
+    size_t probe_size = sizeof(struct io_uring_probe)
+                        + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe*)SOCK_MALLOC(probe_size);
+    if (probe == NULL) {
+        close(fd);
+        return false;
+    }
+    memset(probe, 0, probe_size);
+    bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                             probe, 256) == 0
+                     && probe->last_op >= IORING_OP_SEND_ZC
+                     && (probe->ops[IORING_OP_SEND_ZC].flags
+                         & IO_URING_OP_SUPPORTED);
+    SOCK_FREE(probe);
+    if (!supported || !(params.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return false;
+    }
 
-    return NULL;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes
+                    + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        sock__uring_teardown(ring);
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            sock__uring_teardown(ring);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+            IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        sock__uring_teardown(ring);
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t*)ring->sq_ptr;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    uint8_t *cq = (uint8_t*)ring->cq_ptr;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Register the receive buffers as provided buffer group 0
+    ring->buf_ring_size = ring->buffer_count * sizeof(struct io_uring_buf);
+    void *buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        sock__uring_teardown(ring);
+        return false;
+    }
+    ring->buf_ring = (struct io_uring_buf_ring*)buf_ring;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+    reg.ring_entries = (uint32_t)ring->buffer_count;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+        sock__uring_teardown(ring);
+        return false;
+    }
+
+    for (size_t i = 0; i < ring->buffer_count; ++i) {
+        sock__uring_provide(ring, (uint16_t)i);
+    }
+
+    return true;
+}
+
+void sock__uring_teardown(SockUring *ring)
+{
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->ring_fd >= 0) {
+        close(ring->ring_fd);
+    }
+
+    ring->buf_ring = NULL;
+    ring->sqes = NULL;
+    ring->cq_ptr = NULL;
+    ring->sq_ptr = NULL;
+    ring->ring_fd = -1;
+}
+
+struct io_uring_sqe *sock__uring_sqe(SockUring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        // The submission queue is full, submit it without waiting
+        if (sock__uring_enter(ring, 0, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+
+    return sqe;
+}
+
+int sock__uring_enter(SockUring *ring, unsigned min_complete, int timeout_ms)
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    void *arg = NULL;
+    size_t arg_size = 0;
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg ext;
+    memset(&ext, 0, sizeof(ext));
+
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            ext.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            arg = &ext;
+            arg_size = sizeof(ext);
+        }
+    }
+
+    // Do not wait if completions are already available
+    if (*ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        min_complete = 0;
+    }
+
+    if (ring->to_submit == 0 && min_complete == 0) {
+        return 0;
+    }
+
+    int n = (int)syscall(__NR_io_uring_enter, ring->ring_fd, ring->to_submit,
+                         min_complete, flags, arg, arg_size);
+    if (n < 0) {
+        if (errno == EINTR || errno == ETIME) {
+            return 0;
+        }
+        return -1;
+    }
+    ring->to_submit -= (unsigned)n;
+
+    return n;
+}
+
+void sock__uring_provide(SockUring *ring, uint16_t bid)
+{
+    uint16_t mask = (uint16_t)(ring->buffer_count - 1);
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_ring_tail & mask];
+    buf->addr = (uint64_t)(uintptr_t)(ring->buffers + bid * ring->buffer_size);
+    buf->len = (uint32_t)ring->buffer_size;
+    buf->bid = bid;
+    ring->buf_ring_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_ring_tail,
+                     __ATOMIC_RELEASE);
+}
+
+bool sock__uring_arm_wakeup(SockUring *ring)
+{
+    struct io_uring_sqe *sqe = sock__uring_sqe(ring);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    // The wakeup poll is the only request carrying the ring as user data
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = ring->wakeup_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t)(uintptr_t)ring;
+
+    return true;
+}
+
+bool sock__uring_arm_recv(SockUring *ring, SockUringRequest *req)
+{
+    struct io_uring_sqe *sqe = sock__uring_sqe(ring);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = req->sock->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    return true;
+}
+
+void sock__uring_dispatch(SockUring *ring, const struct io_uring_cqe *cqe)
+{
+    // Completions of cancel requests carry no user data
+    if (cqe->user_data == 0) {
+        return;
+    }
+
+    if (cqe->user_data == (uint64_t)(uintptr_t)ring) {
+        uint64_t value;
+        while (read(ring->wakeup_fd, &value, sizeof(value)) > 0);
+        if (__atomic_load_n(&ring->running, __ATOMIC_ACQUIRE)) {
+            sock__uring_arm_wakeup(ring);
+        }
+        return;
+    }
+
+    SockUringRequest *req = (SockUringRequest*)(uintptr_t)cqe->user_data;
+
+    SockUringCompletion completion;
+    memset(&completion, 0, sizeof(completion));
+    completion.op = req->op;
+    completion.sock = req->sock;
+    completion.more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (cqe->res < 0) {
+        completion.error = -cqe->res;
+        req->sock->last_errno = completion.error;
+    }
+
+    bool has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+    switch (req->op) {
+        case SOCK_URING_ACCEPT: {
+            if (cqe->res >= 0) {
+                completion.client = sock__uring_client(req->sock, cqe->res);
+                if (completion.client == NULL) {
+                    close(cqe->res);
+                    completion.error = ENOMEM;
+                }
+            }
+        } break;
+
+        case SOCK_URING_RECV: {
+            if (cqe->res > 0 && has_buffer) {
+                completion.buf = ring->buffers + bid * ring->buffer_size;
+                completion.size = (size_t)cqe->res;
+            }
+
+            // The multishot receive ends when the kernel runs out of
+            // buffers or decides to stop it: keep it going transparently
+            if (!completion.more && (cqe->res > 0 || cqe->res == -ENOBUFS)) {
+                if (req->cancelled) {
+                    completion.error = ECANCELED;
+                } else {
+                    completion.more = sock__uring_arm_recv(ring, req);
+                    if (cqe->res == -ENOBUFS && completion.more) {
+                        return;
+                    }
+                }
+            }
+        } break;
+
+        case SOCK_URING_SEND: {
+            completion.buf = req->buf;
+            if (cqe->res >= 0) {
+                completion.size = (size_t)cqe->res;
+            }
+        } break;
+    }
+
+    if (!completion.more) {
+        sock__uring_unlink(ring, req);
+    }
+
+    req->callback(ring, &completion, req->user_data);
+
+    if (has_buffer) {
+        sock__uring_provide(ring, bid);
+    }
+
+    if (!completion.more) {
+        SOCK_FREE(req);
+    }
 }
+#endif // SOCK_IO_URING
 
 void sock__convert_addr(SockAddr *addr)
 {
@@ -787,22 +8549,41 @@ void sock__convert_addr(SockAddr *addr)
         return;
     }
 
+    sock__parse_addr(addr);
+
+    switch (addr->type) {
+        case SOCK_IPV4: {
+            inet_ntop(AF_INET, &addr->ipv4.sin_addr, addr->str,
+                      sizeof(addr->str));
+        } break;
+
+        case SOCK_IPV6: {
+            inet_ntop(AF_INET6, &addr->ipv6.sin6_addr, addr->str,
+                      sizeof(addr->str));
+        } break;
+
+        default: break;
+    }
+}
+
+void sock__parse_addr(SockAddr *addr)
+{
+    if (addr == NULL) {
+        return;
+    }
+
     sa_family_t family = addr->sockaddr.sa_family;
     switch (family) {
         case AF_INET: {
-            struct sockaddr_in *ipv4 = &addr->ipv4;
             addr->type = SOCK_IPV4;
-            addr->port = ntohs(ipv4->sin_port);
-            addr->len = sizeof(*ipv4);
-            inet_ntop(family, &ipv4->sin_addr, addr->str, sizeof(addr->str));
+            addr->port = ntohs(addr->ipv4.sin_port);
+            addr->len = sizeof(addr->ipv4);
         } break;
 
         case AF_INET6: {
-            struct sockaddr_in6 *ipv6 = &addr->ipv6;
             addr->type = SOCK_IPV6;
-            addr->port = ntohs(ipv6->sin6_port);
-            addr->len = sizeof(*ipv6);
-            inet_ntop(family, &ipv6->sin6_addr, addr->str, sizeof(addr->str));
+            addr->port = ntohs(addr->ipv6.sin6_port);
+            addr->len = sizeof(addr->ipv6);
         } break;
 
         default: {
@@ -811,6 +8592,46 @@ void sock__convert_addr(SockAddr *addr)
     }
 }
 
+void sock__received_addr(const Sock *sock, SockAddr *addr)
+{
+    if (sock->flags & SOCK__LAZY_ADDR) {
+        sock__parse_addr(addr);
+        addr->str[0] = '\0';
+    } else {
+        sock__convert_addr(addr);
+    }
+}
+
+uint32_t sock__loop_to_epoll(int events)
+{
+    uint32_t res = 0;
+    if (events & SOCK_EVENT_READ) {
+        res |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & SOCK_EVENT_WRITE) {
+        res |= EPOLLOUT;
+    }
+    return res;
+}
+
+int sock__loop_from_epoll(uint32_t events)
+{
+    int res = 0;
+    if (events & EPOLLIN) {
+        res |= SOCK_EVENT_READ;
+    }
+    if (events & EPOLLOUT) {
+        res |= SOCK_EVENT_WRITE;
+    }
+    if (events & EPOLLERR) {
+        res |= SOCK_EVENT_ERROR;
+    }
+    if (events & (EPOLLHUP | EPOLLRDHUP)) {
+        res |= SOCK_EVENT_HUP;
+    }
+    return res;
+}
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -820,6 +8641,70 @@ void sock__convert_addr(SockAddr *addr)
 /*
     Revision history:
 
+        1.30.0 (2026-10-16) Opt-in I/O statistics with SOCK_STATS: per sock
+                            and per thread counters, connect and accept
+                            latency histograms, sock_stats(),
+                            sock_global_stats() and
+                            sock_histogram_percentile()
+        1.29.0 (2026-10-16) New hierarchical SockTimerWheel; SockLoop idle
+                            timeouts reported with SOCK_EVENT_TIMEOUT,
+                            sock_loop_set_timeout() and sock_loop_add_timer()
+        1.28.0 (2026-10-16) New SockFanout for publishing refcounted
+                            SockMessage to the subscribers of topics
+        1.27.0 (2026-10-16) New tuning functions sock_set_nodelay(),
+                            sock_set_quickack(), sock_set_send_buffer(),
+                            sock_set_recv_buffer(), sock_set_busy_poll(),
+                            sock_set_notsent_lowat(), sock_set_keepalive(),
+                            sock_set_profile() and sock_get_tuning()
+        1.26.0 (2026-10-16) New buffered SockWriter: sock_writer_create(),
+                            sock_write(), sock_flush(), sock_writer_cork()
+                            and sock_writer_destroy(); new function
+                            sock_set_cork()
+        1.25.0 (2026-10-16) New buffered SockReader: sock_reader_create(),
+                            sock_read_until(), sock_read_exact(),
+                            sock_read_frame() and sock_reader_destroy()
+        1.24.0 (2026-10-16) New functions sock_accept_batch(),
+                            sock_listen_sharded() and
+                            sock_sharded_listener_destroy()
+        1.23.0 (2026-10-16) New functions sock_close_async() and
+                            sock_close_abort(); sock_close() no longer waits
+                            for a peer on UDP socks
+        1.22.0 (2026-10-16) New SOCK_MALLOC, SOCK_REALLOC and SOCK_FREE
+                            allocator macros; Sock and SockThreadData objects
+                            are recycled through per-thread freelists
+        1.21.0 (2026-10-16) New lazy address formatting with sock_set_lazy_addr()
+                            and sock_addr_str(); new functions
+                            sock_bind_addr(), sock_connect_addr() and
+                            sock_sendto_addr() taking addresses by pointer
+        1.20.0 (2026-10-16) New built-in stub resolver: sock_dns_query(),
+                            sock_dns_config_load() and sock_dns_config_free()
+        1.19.0 (2026-10-16) New caching SockResolver: sock_resolver_create(),
+                            sock_resolve(), sock_resolve_async(),
+                            sock_resolver_stats() and sock_resolver_destroy();
+                            sock_dns() sets errno on error
+        1.18.0 (2026-10-16) New SockConnPool to reuse client connections:
+                            sock_conn_pool_create(), sock_conn_pool_get(),
+                            sock_conn_pool_put(), sock_conn_pool_stats() and
+                            sock_conn_pool_destroy()
+        1.17.0 (2026-10-16) New deadline aware functions sock_connect_timeout(),
+                            sock_send_all_until() and sock_recv_all_until();
+                            new function sock_now_ms()
+        1.16.0 (2026-10-16) New Happy Eyeballs function sock_connect_any()
+        1.15.0 (2026-10-16) New functions sock_sendfile() and
+                            sock_sendfile_all()
+        1.14.0 (2026-10-16) New zero-copy functions sock_set_zerocopy(),
+                            sock_send_zerocopy() and sock_zerocopy_poll()
+        1.13.0 (2026-10-16) New UDP offload functions sock_sendto_gso(),
+                            sock_set_gro() and sock_recvfrom_gro()
+        1.12.0 (2026-10-16) New batched UDP functions sock_sendto_batch() and
+                            sock_recvfrom_batch()
+        1.11.0 (2026-10-16) New vectored I/O functions sock_sendv(),
+                            sock_sendv_all() and sock_recvv()
+        1.10.0 (2026-10-16) New SockUring completion based API with optional
+                            io_uring backend (SOCK_IO_URING)
+        1.9.0 (2026-10-16) New SockThreadPool and sock_pool_accept() function
+        1.8.0 (2026-10-16) New SockLoop epoll based event loop; new function
+                           sock_set_nonblocking()
         1.7.3 (2025-09-20) Changed sock_send_all() signature; drain buffers on
                            sock_close() to prevent data loss
         1.7.2 (2025-09-17) New functions sock_recv_all() and sock_send_all();
@@ -0,0 +1,103 @@
+// Checks of sock_close_async() over loopback: the reaper thread must close the
+// connection once the peer closes it too, and close it anyway at the deadline
+// when the peer never does. The descriptors of the closed socks are watched
+// directly, nothing else opens files meanwhile.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+#define DEADLINE_MS 200
+#define LONG_DEADLINE_MS 5000
+
+// Opens a connection, returning the client and setting the peer
+Sock *connect_pair(Sock *server, Sock **peer)
+{
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(client != NULL);
+    CHECK(sock_connect(client, server->addr));
+    *peer = sock_accept(server);
+    CHECK(*peer != NULL);
+
+    return client;
+}
+
+bool fd_open(int fd)
+{
+    return fcntl(fd, F_GETFD) >= 0 || errno != EBADF;
+}
+
+// Waits for a descriptor to be closed, returning when it was or -1
+int64_t wait_closed(int fd, int64_t deadline)
+{
+    while (sock_now_ms() < deadline) {
+        if (!fd_open(fd)) {
+            return sock_now_ms();
+        }
+        usleep(1000);
+    }
+
+    return -1;
+}
+
+// The peer keeps the connection open: its data is discarded until the
+// deadline, then the connection is closed and further data is refused
+void test_deadline(Sock *server)
+{
+    Sock *peer = NULL;
+    Sock *client = connect_pair(server, &peer);
+    int fd = client->fd;
+
+    int64_t start = sock_now_ms();
+    sock_close_async(client, DEADLINE_MS);
+
+    char buf[16];
+    CHECK(sock_recv(peer, buf, sizeof(buf)) == 0);
+    CHECK(sock_send(peer, "data", 4) == 4);
+    usleep(DEADLINE_MS * 1000 / 2);
+    CHECK(fd_open(fd));
+
+    int64_t closed = wait_closed(fd, start + 4 * DEADLINE_MS);
+    CHECK(closed >= start + DEADLINE_MS);
+
+    // The closed connection answers with a reset
+    CHECK(sock_send(peer, "late", 4) == 4);
+    usleep(10 * 1000);
+    CHECK(send(peer->fd, "late", 4, MSG_NOSIGNAL) < 0);
+    CHECK(errno == ECONNRESET || errno == EPIPE);
+
+    sock_close(peer);
+}
+
+// The peer closes the connection: it is reaped long before the deadline
+void test_peer_close(Sock *server)
+{
+    Sock *peer = NULL;
+    Sock *client = connect_pair(server, &peer);
+    int fd = client->fd;
+
+    int64_t start = sock_now_ms();
+    sock_close_async(client, LONG_DEADLINE_MS);
+
+    CHECK(sock_send(peer, "data", 4) == 4);
+    sock_close(peer);
+
+    int64_t closed = wait_closed(fd, start + LONG_DEADLINE_MS / 5);
+    CHECK(closed >= 0);
+}
+
+int main(void)
+{
+    // A reaper that never closes fails the check instead of hanging it
+    alarm(10);
+
+    Sock *server = bench_listen(SOCK_TCP);
+    CHECK(server != NULL);
+
+    test_deadline(server);
+    test_peer_close(server);
+
+    sock_close(server);
+
+    printf("OK: close_async\n");
+    return 0;
+}
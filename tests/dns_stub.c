@@ -0,0 +1,250 @@
+// Checks of the stub resolver of sock_dns_query() against a stand-in name
+// server on loopback, which answers over UDP and TCP on the same port. How it
+// answers depends on the queried name:
+//
+//     a.test        A and AAAA answers
+//     missing.test  NXDOMAIN
+//     drop.test     the first datagram is dropped, the query must be sent again
+//     big.test      truncated over UDP, the answers come over TCP
+//     spoof.test    a reply with another id and one from another port come
+//                   before the real one, and must be ignored
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+#define SERVER_POLL_MS 20
+
+typedef struct {
+    Sock *udp;
+    Sock *tcp;
+    Sock *spoofer;   // Sends replies from another port
+    volatile bool stop;
+    int udp_queries; // Datagrams received
+    int tcp_queries; // Queries received over TCP
+    int dropped;     // Datagrams not answered
+} Server;
+
+static const uint8_t addr_a[4] = { 192, 0, 2, 1 };
+static const uint8_t addr_aaaa[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+static const uint8_t addr_bogus[4] = { 198, 51, 100, 66 };
+
+// Reads the dotted name of a query and returns the offset of its type, or 0
+// if the query is malformed
+size_t query_name(const uint8_t *msg, size_t len, char *name, size_t size)
+{
+    size_t off = 12;
+    size_t out = 0;
+
+    while (off < len && msg[off] != 0) {
+        size_t label_len = msg[off++];
+        if (off + label_len > len || out + label_len + 2 > size) {
+            return 0;
+        }
+        if (out > 0) {
+            name[out++] = '.';
+        }
+        memcpy(name + out, msg + off, label_len);
+        out += label_len;
+        off += label_len;
+    }
+    name[out] = '\0';
+
+    return off + 5 <= len ? off + 1 : 0;
+}
+
+// Builds the reply to a query in msg, which holds the query on entry, and
+// returns its length. With rcode 0 and no truncation, the answer holds addr
+// if it matches the queried type.
+size_t build_reply(uint8_t *msg, size_t type_off, int rcode, bool truncated,
+                   const uint8_t *addr, size_t addr_len)
+{
+    size_t len = type_off + 4;
+    uint16_t type = (msg[type_off] << 8) | msg[type_off + 1];
+
+    msg[2] = 0x81 | (truncated ? 0x02 : 0);
+    msg[3] = 0x80 | rcode;
+    memset(msg + 6, 0, 6);
+
+    bool matches = (type == 1 && addr_len == 4) || (type == 28 && addr_len == 16);
+    if (rcode != 0 || truncated || addr == NULL || !matches) {
+        return len;
+    }
+
+    // A single record whose name points to the question
+    const uint8_t header[] = { 0xc0, 12, type >> 8, type & 0xff, 0, 1,
+                               0, 0, 0, 60, 0, (uint8_t)addr_len };
+    memcpy(msg + len, header, sizeof(header));
+    len += sizeof(header);
+    memcpy(msg + len, addr, addr_len);
+    msg[7] = 1;
+
+    return len + addr_len;
+}
+
+// Length of the full answer to the query in msg, for a type and a name
+size_t answer(uint8_t *msg, size_t type_off, const char *name, bool tcp)
+{
+    uint16_t type = (msg[type_off] << 8) | msg[type_off + 1];
+    const uint8_t *addr = type == 28 ? addr_aaaa : addr_a;
+    size_t addr_len = type == 28 ? sizeof(addr_aaaa) : sizeof(addr_a);
+
+    if (strcmp(name, "missing.test") == 0) {
+        return build_reply(msg, type_off, 3, false, NULL, 0);
+    }
+    if (strcmp(name, "big.test") == 0 && !tcp) {
+        return build_reply(msg, type_off, 0, true, NULL, 0);
+    }
+    return build_reply(msg, type_off, 0, false, addr, addr_len);
+}
+
+void serve_udp(Server *server)
+{
+    uint8_t msg[SOCK_DNS_UDP_BUFFER_SIZE];
+    SockAddr from;
+    ssize_t n = sock_recvfrom(server->udp, msg, sizeof(msg), &from);
+    if (n < 0) {
+        return;
+    }
+    server->udp_queries++;
+
+    char name[256];
+    size_t type_off = query_name(msg, n, name, sizeof(name));
+    if (type_off == 0) {
+        return;
+    }
+
+    if (strcmp(name, "drop.test") == 0 && server->dropped == 0) {
+        server->dropped++;
+        return;
+    }
+
+    if (strcmp(name, "spoof.test") == 0) {
+        uint8_t fake[SOCK_DNS_UDP_BUFFER_SIZE];
+        memcpy(fake, msg, n);
+        size_t len = build_reply(fake, type_off, 0, false, addr_bogus,
+                                 sizeof(addr_bogus));
+        sock_sendto_addr(server->spoofer, fake, len, &from);
+        fake[0] ^= 0xff;
+        sock_sendto_addr(server->udp, fake, len, &from);
+    }
+
+    size_t len = answer(msg, type_off, name, false);
+    sock_sendto_addr(server->udp, msg, len, &from);
+}
+
+void serve_tcp(Server *server)
+{
+    Sock *client = sock_accept(server->tcp);
+    if (client == NULL) {
+        return;
+    }
+
+    int64_t deadline = sock_now_ms() + 1000;
+    uint8_t msg[2 + SOCK_DNS_MAX_QUERY + 64];
+    while (sock_recv_all_until(client, msg, 2, deadline) == 2) {
+        size_t len = ((size_t)msg[0] << 8) | msg[1];
+        if (len > SOCK_DNS_MAX_QUERY
+                || sock_recv_all_until(client, msg + 2, len, deadline) != (ssize_t)len) {
+            break;
+        }
+        server->tcp_queries++;
+
+        char name[256];
+        size_t type_off = query_name(msg + 2, len, name, sizeof(name));
+        if (type_off == 0) {
+            break;
+        }
+        len = answer(msg + 2, type_off, name, true);
+        msg[0] = len >> 8;
+        msg[1] = len & 0xff;
+        sock_send_all_until(client, msg, len + 2, deadline);
+    }
+
+    sock_close_abort(client);
+}
+
+void *server_thread(void *data)
+{
+    Server *server = (Server*)data;
+
+    while (!server->stop) {
+        struct pollfd pfds[2] = {
+            { .fd = server->udp->fd, .events = POLLIN, .revents = 0 },
+            { .fd = server->tcp->fd, .events = POLLIN, .revents = 0 },
+        };
+        if (poll(pfds, 2, SERVER_POLL_MS) <= 0) {
+            continue;
+        }
+        if (pfds[0].revents & POLLIN) {
+            serve_udp(server);
+        }
+        if (pfds[1].revents & POLLIN) {
+            serve_tcp(server);
+        }
+    }
+
+    return NULL;
+}
+
+// Resolves a name with the stand-in server, checking the addresses returned
+void check_query(const SockDnsConfig *config, const char *name,
+                 const char *ipv6, const char *ipv4)
+{
+    SockAddrList list = sock_dns_query(name, 80, SOCK_ADDR_INVALID, config);
+    CHECK(list.count == 2);
+    CHECK(list.items[0].type == SOCK_IPV6 && strcmp(list.items[0].str, ipv6) == 0);
+    CHECK(list.items[1].type == SOCK_IPV4 && strcmp(list.items[1].str, ipv4) == 0);
+    CHECK(list.items[0].port == 80 && list.items[1].port == 80);
+    sock_addr_list_free(&list);
+}
+
+int main(void)
+{
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.udp = bench_listen(SOCK_UDP);
+    server.spoofer = bench_listen(SOCK_UDP);
+    CHECK(server.udp != NULL && server.spoofer != NULL);
+    CHECK(sock_set_nonblocking(server.udp, true));
+
+    server.tcp = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(server.tcp != NULL);
+    CHECK(sock_bind(server.tcp, sock_addr("127.0.0.1", server.udp->addr.port)));
+    CHECK(sock_listen(server.tcp));
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, server_thread, &server) == 0);
+
+    SockDnsConfig config;
+    sock_dns_config_load(&config, "/nonexistent/resolv.conf");
+    CHECK(config.servers.count == 1);
+    config.servers.items[0] = sock_addr("127.0.0.1", server.udp->addr.port);
+    config.timeout_ms = 300;
+    config.attempts = 2;
+
+    check_query(&config, "a.test", "2001:db8::1", "192.0.2.1");
+
+    SockAddrList list = sock_dns_query("missing.test", 0, SOCK_ADDR_INVALID, &config);
+    CHECK(list.count == 0 && errno == ENOENT);
+
+    // The first attempt times out on the dropped question
+    int udp_queries = server.udp_queries;
+    check_query(&config, "drop.test", "2001:db8::1", "192.0.2.1");
+    CHECK(server.dropped == 1);
+    CHECK(server.udp_queries - udp_queries == 3);
+
+    check_query(&config, "big.test", "2001:db8::1", "192.0.2.1");
+    CHECK(server.tcp_queries == 2);
+
+    check_query(&config, "spoof.test", "2001:db8::1", "192.0.2.1");
+
+    server.stop = true;
+    pthread_join(thread, NULL);
+    sock_dns_config_free(&config);
+    sock_close(server.tcp);
+    sock_close(server.udp);
+    sock_close(server.spoofer);
+
+    printf("OK: dns_stub\n");
+    return 0;
+}
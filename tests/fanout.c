@@ -0,0 +1,136 @@
+// Checks of a SockFanout with SOCK_FANOUT_BLOCK: while a publisher of another
+// thread waits for a subscriber whose peer does not read, the thread of the
+// loop must still be able to subscribe and unsubscribe socks.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+#define MESSAGE_SIZE (64 * 1024)
+#define MESSAGE_COUNT 256
+#define ROUNDS 20
+#define TICK_MS 5
+
+typedef struct {
+    SockLoop *loop;
+    SockTopic *topic;
+    SockSubscriber *slow; // Subscriber whose peer does not read
+    Sock *other;          // Sock subscribed and unsubscribed in turn
+    SockTimer timer;
+    int rounds;
+    bool published;       // Set by the publisher once done
+} Context;
+
+static uint8_t payload[MESSAGE_SIZE];
+
+void handle_sock(SockLoop *loop, Sock *sock, int events, void *user_data)
+{
+    (void) loop;
+    (void) sock;
+    (void) events;
+    (void) user_data;
+}
+
+void *publisher_thread(void *data)
+{
+    Context *context = (Context*)data;
+
+    SockMessage *message = sock_message_create(payload, sizeof(payload));
+    CHECK(message != NULL);
+    for (int i = 0; i < MESSAGE_COUNT; ++i) {
+        sock_fanout_publish(context->topic, message, NULL);
+    }
+    sock_message_unref(message);
+
+    __atomic_store_n(&context->published, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void on_tick(SockTimer *timer, void *user_data)
+{
+    Context *context = (Context*)user_data;
+    SockFanout *fanout = context->topic->fanout;
+
+    if (__atomic_load_n(&context->published, __ATOMIC_ACQUIRE)) {
+        sock_loop_stop(context->loop);
+        return;
+    }
+
+    // (Un)subscriptions while the publisher waits, then the slow subscriber
+    // goes away to let it finish
+    if (__atomic_load_n(&fanout->waiters, __ATOMIC_SEQ_CST) > 0) {
+        if (context->rounds < ROUNDS) {
+            SockSubscriber *sub = sock_fanout_subscribe(context->topic,
+                                                        context->other);
+            CHECK(sub != NULL);
+            sock_fanout_unsubscribe(sub);
+            context->rounds++;
+        } else if (context->slow != NULL) {
+            sock_fanout_unsubscribe(context->slow);
+            context->slow = NULL;
+        }
+    }
+
+    CHECK(sock_loop_add_timer(context->loop, timer, TICK_MS));
+}
+
+int main(void)
+{
+    // A deadlock fails the check instead of hanging it
+    alarm(10);
+
+    Sock *server = bench_listen(SOCK_TCP);
+    CHECK(server != NULL);
+
+    Sock *slow = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(slow != NULL);
+    sock_set_send_buffer(slow, 4096);
+    CHECK(sock_connect(slow, server->addr));
+    Sock *slow_peer = sock_accept(server);
+    CHECK(slow_peer != NULL);
+    sock_set_recv_buffer(slow_peer, 4096);
+    CHECK(sock_set_nonblocking(slow, true));
+
+    Sock *other = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(other != NULL);
+    CHECK(sock_connect(other, server->addr));
+    Sock *other_peer = sock_accept(server);
+    CHECK(other_peer != NULL);
+
+    Context context;
+    memset(&context, 0, sizeof(context));
+    context.loop = sock_loop_create();
+    CHECK(context.loop != NULL);
+    context.other = other;
+
+    SockFanout *fanout = sock_fanout_create(2, SOCK_FANOUT_BLOCK);
+    CHECK(fanout != NULL);
+    CHECK(sock_fanout_attach(fanout, context.loop));
+    context.topic = sock_fanout_topic(fanout, "updates");
+    CHECK(context.topic != NULL);
+    CHECK(sock_loop_add(context.loop, slow, SOCK_EVENT_READ, handle_sock, NULL));
+    context.slow = sock_fanout_subscribe(context.topic, slow);
+    CHECK(context.slow != NULL);
+
+    sock_timer_init(&context.timer, on_tick, &context);
+    CHECK(sock_loop_add_timer(context.loop, &context.timer, TICK_MS));
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, publisher_thread, &context) == 0);
+    sock_loop_run(context.loop);
+    pthread_join(thread, NULL);
+
+    CHECK(context.rounds == ROUNDS);
+    CHECK(context.slow == NULL);
+
+    sock_loop_remove(context.loop, slow);
+    sock_fanout_destroy(fanout);
+    sock_loop_destroy(context.loop);
+    sock_close_abort(slow_peer);
+    sock_close_abort(other_peer);
+    sock_close(slow);
+    sock_close(other);
+    sock_close(server);
+
+    printf("OK: fanout\n");
+    return 0;
+}
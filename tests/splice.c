@@ -0,0 +1,120 @@
+// Checks of the splice() path of sock_sendfile() over loopback: a file moved
+// into a non-blocking sock that keeps blocking must reach the peer exactly
+// once, whether it is sent from an explicit offset or from the file position,
+// and files that cannot seek must be refused instead of blocking.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+#define FILE_SIZE (1024 * 1024)
+
+static uint8_t content[FILE_SIZE];
+static uint8_t received[FILE_SIZE];
+
+// Receives what is available, returning the new count of received bytes
+size_t drain(Sock *peer, size_t count)
+{
+    while (count < FILE_SIZE) {
+        ssize_t n = sock_recv(peer, received + count, FILE_SIZE - count);
+        if (n <= 0) {
+            CHECK(n < 0 && peer->last_errno == EAGAIN);
+            break;
+        }
+        count += n;
+    }
+
+    return count;
+}
+
+// Sends the whole file with sock__splice(), as sock_sendfile() does when
+// sendfile() cannot be used, reading from the file position when offset is
+// NULL
+void send_file(Sock *client, Sock *peer, int file_fd, off_t *offset)
+{
+    size_t sent = 0;
+    size_t count = 0;
+    size_t blocked = 0;
+
+    while (count < FILE_SIZE) {
+        if (sent < FILE_SIZE) {
+            ssize_t n = sock__splice(client, file_fd, offset, FILE_SIZE - sent);
+            if (n > 0) {
+                sent += n;
+            } else {
+                CHECK(n < 0 && client->last_errno == EAGAIN);
+                blocked++;
+            }
+            if (offset != NULL) {
+                CHECK(*offset == (off_t)sent);
+            } else {
+                CHECK(lseek(file_fd, 0, SEEK_CUR) == (off_t)sent);
+            }
+        }
+
+        struct pollfd pfd = { .fd = peer->fd, .events = POLLIN, .revents = 0 };
+        poll(&pfd, 1, sent < FILE_SIZE ? 0 : 1000);
+        count = drain(peer, count);
+    }
+
+    CHECK(sent == FILE_SIZE);
+    CHECK(blocked > 0);
+    CHECK(memcmp(content, received, FILE_SIZE) == 0);
+}
+
+int main(void)
+{
+    Sock *server = bench_listen(SOCK_TCP);
+    CHECK(server != NULL);
+
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(client != NULL);
+    sock_set_send_buffer(client, 4096);
+    CHECK(sock_connect(client, server->addr));
+    Sock *peer = sock_accept(server);
+    CHECK(peer != NULL);
+    CHECK(sock_set_nonblocking(client, true));
+    CHECK(sock_set_nonblocking(peer, true));
+
+    char path[] = "/tmp/sock-splice-XXXXXX";
+    int file_fd = mkstemp(path);
+    CHECK(file_fd >= 0);
+    unlink(path);
+    for (size_t i = 0; i < FILE_SIZE; ++i) {
+        content[i] = (uint8_t)(i * 7 + i / 251);
+    }
+    CHECK(write(file_fd, content, FILE_SIZE) == FILE_SIZE);
+
+    off_t offset = 0;
+    send_file(client, peer, file_fd, &offset);
+
+    memset(received, 0, sizeof(received));
+    CHECK(lseek(file_fd, 0, SEEK_SET) == 0);
+    send_file(client, peer, file_fd, NULL);
+
+    // A pipe has no offset to send from
+    int pipe_fds[2];
+    CHECK(pipe(pipe_fds) == 0);
+    CHECK(write(pipe_fds[1], content, 16) == 16);
+    CHECK(sock_sendfile(client, pipe_fds[0], 0, 16) < 0);
+    CHECK(client->last_errno == ESPIPE);
+    CHECK(sock_sendfile(client, pipe_fds[0], -1, 16) == 16);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    // Nor can a sock, whose data could not be put back if the client blocked
+    int pair[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    CHECK(write(pair[1], content, 16) == 16);
+    CHECK(sock_sendfile(client, pair[0], -1, 16) < 0);
+    CHECK(client->last_errno == EINVAL);
+    close(pair[0]);
+    close(pair[1]);
+
+    close(file_fd);
+    sock_close_abort(peer);
+    sock_close(client);
+    sock_close(server);
+
+    printf("OK: splice\n");
+    return 0;
+}
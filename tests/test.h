@@ -0,0 +1,21 @@
+// test.h - Helpers shared by the checks of sock.h.
+//
+// Every check is a program that exits with 0 once all of its checks passed,
+// printing "OK: <name>" on stdout. A failed check prints its location on
+// stderr and exits with 1. The loopback fixtures of bench.h, like
+// bench_listen(), are used by the checks as well.
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include "../bench/bench.h"
+
+#define CHECK(cond)                                                       \
+    do {                                                                  \
+        if (!(cond)) {                                                    \
+            fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                      \
+        }                                                                 \
+    } while (0)
+
+#endif // TEST_H_
@@ -0,0 +1,122 @@
+// Checks of SockTimerWheel. Times are simulated: the wheel is advanced by
+// exactly the timeout it asks for, as a SockLoop sleeping in epoll would do.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+typedef struct {
+    int64_t now;   // Simulated time, set before advancing the wheel
+    int64_t fired; // When the timer fired, -1 if it did not
+} Probe;
+
+void on_expired(SockTimer *timer, void *user_data)
+{
+    (void) timer;
+    Probe *probe = (Probe*)user_data;
+    probe->fired = probe->now;
+}
+
+// Runs the wheel like a loop would until no timer is left, returning false if
+// it never stops
+bool run_wheel(SockTimerWheel *wheel, int64_t *now, Probe **probes, size_t count)
+{
+    for (size_t rounds = 0; rounds < 100000; ++rounds) {
+        int timeout = sock_timer_wheel_timeout(wheel, *now);
+        if (timeout < 0) {
+            return true;
+        }
+        *now += timeout;
+        for (size_t i = 0; i < count; ++i) {
+            probes[i]->now = *now;
+        }
+        sock_timer_wheel_advance(wheel, *now);
+    }
+
+    return false;
+}
+
+// A timer of the second level is moved down to the first one when its period
+// begins, while the first level may hold a later timer of the current period
+void test_timeout_across_period(void)
+{
+    SockTimerWheel *wheel = sock_timer_wheel_create();
+    CHECK(wheel != NULL);
+
+    // Align the wheel on the start of a period
+    int64_t period = (wheel->current | SOCK_TIMER_MASK) + 1;
+    sock_timer_wheel_advance(wheel, period - 1);
+    CHECK(wheel->current == period);
+
+    Probe far = { .now = 0, .fired = -1 };
+    SockTimer far_timer;
+    sock_timer_init(&far_timer, on_expired, &far);
+    int64_t far_deadline = period + SOCK_TIMER_SLOTS + 1;
+    CHECK(sock_timer_start(wheel, &far_timer, far_deadline));
+
+    // Just before the next period, with a later timer on the first level
+    int64_t now = period + SOCK_TIMER_SLOTS - 6;
+    sock_timer_wheel_advance(wheel, now - 1);
+
+    Probe near = { .now = 0, .fired = -1 };
+    SockTimer near_timer;
+    sock_timer_init(&near_timer, on_expired, &near);
+    int64_t near_deadline = now + 50;
+    CHECK(sock_timer_start(wheel, &near_timer, near_deadline));
+
+    int timeout = sock_timer_wheel_timeout(wheel, now);
+    CHECK(timeout >= 0 && now + timeout <= far_deadline);
+
+    Probe *probes[] = { &far, &near };
+    CHECK(run_wheel(wheel, &now, probes, 2));
+    CHECK(far.fired == far_deadline);
+    CHECK(near.fired == near_deadline);
+
+    sock_timer_wheel_destroy(wheel);
+}
+
+// Timers spread over several levels fire at their deadline, never earlier nor
+// later, whatever the position of the wheel in its period when they start
+void test_deadlines(int64_t offset)
+{
+    SockTimerWheel *wheel = sock_timer_wheel_create();
+    CHECK(wheel != NULL);
+
+    enum { COUNT = 512 };
+    static SockTimer timers[COUNT];
+    static Probe probes[COUNT];
+    static Probe *probe_ptrs[COUNT];
+    static int64_t deadlines[COUNT];
+
+    int64_t period = (wheel->current | SOCK_TIMER_MASK) + 1;
+    sock_timer_wheel_advance(wheel, period + offset - 1);
+    CHECK(wheel->current == period + offset);
+
+    int64_t now = wheel->current;
+    srand(42);
+    for (size_t i = 0; i < COUNT; ++i) {
+        probes[i].fired = -1;
+        probe_ptrs[i] = &probes[i];
+        deadlines[i] = now + 1 + rand() % (1 << 18);
+        sock_timer_init(&timers[i], on_expired, &probes[i]);
+        CHECK(sock_timer_start(wheel, &timers[i], deadlines[i]));
+    }
+
+    CHECK(run_wheel(wheel, &now, probe_ptrs, COUNT));
+    for (size_t i = 0; i < COUNT; ++i) {
+        CHECK(probes[i].fired == deadlines[i]);
+    }
+
+    sock_timer_wheel_destroy(wheel);
+}
+
+int main(void)
+{
+    test_timeout_across_period();
+    test_deadlines(0);
+    test_deadlines(1);
+    test_deadlines(SOCK_TIMER_SLOTS / 2);
+    test_deadlines(SOCK_TIMER_SLOTS - 1);
+
+    printf("OK: timer_wheel\n");
+    return 0;
+}
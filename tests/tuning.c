@@ -0,0 +1,106 @@
+// Checks of the tuning functions over loopback: what they return matches what
+// getsockopt() reports, and sock_get_tuning() reads the same values back.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+int get_option(Sock *sock, int level, int name)
+{
+    int value = -1;
+    socklen_t len = sizeof(value);
+    CHECK(getsockopt(sock->fd, level, name, &value, &len) == 0);
+    return value;
+}
+
+void test_setters(Sock *sock)
+{
+    CHECK(sock_set_nodelay(sock, true) == 1);
+    CHECK(get_option(sock, IPPROTO_TCP, TCP_NODELAY) != 0);
+    CHECK(sock_set_nodelay(sock, false) == 0);
+    CHECK(get_option(sock, IPPROTO_TCP, TCP_NODELAY) == 0);
+
+    CHECK(sock_set_notsent_lowat(sock, 32 * 1024) == 32 * 1024);
+    CHECK(get_option(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT) == 32 * 1024);
+
+    // The kernel doubles the requested size for its bookkeeping
+    int size = sock_set_send_buffer(sock, 64 * 1024);
+    CHECK(size == 2 * 64 * 1024);
+    CHECK(get_option(sock, SOL_SOCKET, SO_SNDBUF) == size);
+
+    CHECK(sock_set_keepalive(sock, 30, 5, 3));
+    CHECK(get_option(sock, SOL_SOCKET, SO_KEEPALIVE) == 1);
+    CHECK(get_option(sock, IPPROTO_TCP, TCP_KEEPIDLE) == 30);
+    CHECK(get_option(sock, IPPROTO_TCP, TCP_KEEPINTVL) == 5);
+    CHECK(get_option(sock, IPPROTO_TCP, TCP_KEEPCNT) == 3);
+    CHECK(sock_set_keepalive(sock, 0, 0, 0));
+    CHECK(get_option(sock, SOL_SOCKET, SO_KEEPALIVE) == 0);
+    CHECK(!sock_set_keepalive(sock, -1, 0, 0) && sock->last_errno == EINVAL);
+}
+
+void test_profiles(Sock *sock)
+{
+    SockTuning tuning;
+
+    CHECK(!sock_set_profile(sock, SOCK_PROFILE_LOW_LATENCY | SOCK_PROFILE_THROUGHPUT,
+                            NULL));
+    CHECK(sock->last_errno == EINVAL);
+
+    CHECK(sock_set_profile(sock, SOCK_PROFILE_LOW_LATENCY | SOCK_PROFILE_KEEPALIVE,
+                           &tuning));
+    CHECK(tuning.nodelay == 1);
+    CHECK(tuning.notsent_lowat == SOCK_PROFILE_NOTSENT_LOWAT);
+    CHECK(tuning.keepalive == 1);
+    CHECK(tuning.keepalive_idle == SOCK_PROFILE_KEEPALIVE_IDLE);
+    CHECK(tuning.keepalive_interval == SOCK_PROFILE_KEEPALIVE_INTERVAL);
+    CHECK(tuning.keepalive_count == SOCK_PROFILE_KEEPALIVE_COUNT);
+
+    CHECK(sock_set_profile(sock, SOCK_PROFILE_THROUGHPUT, NULL));
+    CHECK(sock_get_tuning(sock, &tuning));
+    CHECK(tuning.nodelay == 0);
+    CHECK(tuning.send_buffer == get_option(sock, SOL_SOCKET, SO_SNDBUF));
+    CHECK(tuning.recv_buffer == get_option(sock, SOL_SOCKET, SO_RCVBUF));
+}
+
+// The TCP options do not apply to UDP socks, and are reported as -1
+void test_udp(void)
+{
+    Sock *sock = sock_create(SOCK_IPV4, SOCK_UDP);
+    CHECK(sock != NULL);
+
+    SockTuning tuning;
+    CHECK(sock_get_tuning(sock, &tuning));
+    CHECK(tuning.nodelay == -1);
+    CHECK(tuning.quickack == -1);
+    CHECK(tuning.notsent_lowat == -1);
+    CHECK(tuning.keepalive_idle == -1);
+    CHECK(tuning.keepalive_interval == -1);
+    CHECK(tuning.keepalive_count == -1);
+    CHECK(tuning.send_buffer > 0 && tuning.recv_buffer > 0);
+
+    CHECK(sock_set_profile(sock, SOCK_PROFILE_LOW_LATENCY, &tuning));
+    CHECK(tuning.nodelay == -1);
+
+    sock_close(sock);
+}
+
+int main(void)
+{
+    Sock *server = bench_listen(SOCK_TCP);
+    CHECK(server != NULL);
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(client != NULL);
+    CHECK(sock_connect(client, server->addr));
+    Sock *peer = sock_accept(server);
+    CHECK(peer != NULL);
+
+    test_setters(client);
+    test_profiles(client);
+    test_udp();
+
+    sock_close_abort(peer);
+    sock_close(client);
+    sock_close(server);
+
+    printf("OK: tuning\n");
+    return 0;
+}
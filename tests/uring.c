@@ -0,0 +1,124 @@
+// Checks of the sends of an emulated SockUring over loopback: sends to a peer
+// that does not read must not block the ring, still complete in order once
+// the peer reads, and leave receives on the same sock working meanwhile.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+#define SEND_SIZE (1024 * 1024)
+#define SEND_COUNT 4
+
+typedef struct {
+    size_t sizes[SEND_COUNT]; // Bytes sent by each send, in completion order
+    int order[SEND_COUNT];    // Index of each send, in completion order
+    int sends;                // Completed sends
+    size_t received;          // Bytes received by the sock
+    int cancelled;            // Completions with ECANCELED
+} Context;
+
+static Context context;
+static uint8_t buffers[SEND_COUNT][SEND_SIZE];
+static uint8_t stream[SEND_COUNT * SEND_SIZE];
+
+void on_send(SockUring *ring, const SockUringCompletion *completion, void *user_data)
+{
+    (void) ring;
+    if (completion->error == ECANCELED) {
+        context.cancelled++;
+        return;
+    }
+    CHECK(completion->error == 0);
+    context.order[context.sends] = (int)(intptr_t)user_data;
+    context.sizes[context.sends] = completion->size;
+    context.sends++;
+}
+
+void on_recv(SockUring *ring, const SockUringCompletion *completion, void *user_data)
+{
+    (void) ring;
+    (void) user_data;
+    if (completion->error == ECANCELED) {
+        context.cancelled++;
+        return;
+    }
+    CHECK(completion->error == 0);
+    context.received += completion->size;
+}
+
+int main(void)
+{
+    // A send blocking the ring fails the check instead of hanging it
+    alarm(10);
+
+    Sock *server = bench_listen(SOCK_TCP);
+    CHECK(server != NULL);
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(client != NULL);
+    sock_set_send_buffer(client, 4096);
+    CHECK(sock_connect(client, server->addr));
+    Sock *peer = sock_accept(server);
+    CHECK(peer != NULL);
+    sock_set_recv_buffer(peer, 4096);
+    CHECK(sock_set_nonblocking(client, true));
+    CHECK(sock_set_nonblocking(peer, true));
+
+    SockUring *ring = sock_uring_create(0, 0, 0);
+    CHECK(ring != NULL && !sock_uring_native(ring));
+    CHECK(sock_uring_recv(ring, client, on_recv, NULL));
+
+    for (int i = 0; i < SEND_COUNT; ++i) {
+        memset(buffers[i], 'a' + i, SEND_SIZE);
+        CHECK(sock_uring_send(ring, client, buffers[i], SEND_SIZE, on_send,
+                              (void*)(intptr_t)i));
+    }
+    CHECK(sock_uring_poll(ring, 10) >= 0);
+    CHECK(context.sends < SEND_COUNT);
+
+    // The receive goes on while the sends wait
+    CHECK(sock_send(peer, "ping", 4) == 4);
+    for (int i = 0; i < 100 && context.received < 4; ++i) {
+        CHECK(sock_uring_poll(ring, 10) >= 0);
+    }
+    CHECK(context.received == 4);
+
+    // The sends complete in order as the peer reads
+    size_t total = 0;
+    size_t received = 0;
+    while (context.sends < SEND_COUNT || received < total) {
+        ssize_t n = sock_recv(peer, stream + received, sizeof(stream) - received);
+        if (n > 0) {
+            received += n;
+        } else {
+            CHECK(n < 0 && peer->last_errno == EAGAIN);
+        }
+        CHECK(sock_uring_poll(ring, 1) >= 0);
+
+        total = 0;
+        for (int i = 0; i < context.sends; ++i) {
+            total += context.sizes[i];
+        }
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < SEND_COUNT; ++i) {
+        CHECK(context.order[i] == i);
+        CHECK(context.sizes[i] > 0);
+        for (size_t j = 0; j < context.sizes[i]; ++j) {
+            CHECK(stream[offset + j] == 'a' + i);
+        }
+        offset += context.sizes[i];
+    }
+    CHECK(offset == received);
+
+    CHECK(sock_uring_cancel(ring, client));
+    CHECK(sock_uring_poll(ring, 0) >= 0);
+    CHECK(context.cancelled == 1);
+
+    sock_uring_destroy(ring);
+    sock_close_abort(peer);
+    sock_close(client);
+    sock_close(server);
+
+    printf("OK: uring\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Checks of the ids of sock_send_zerocopy() over loopback, where the kernel
+// reports every zero-copy send as copied.
+
+#define SOCK_IMPLEMENTATION
+#include "test.h"
+
+// Polls until the send id is released, returning false if it never is
+bool wait_released(Sock *sock, uint32_t id)
+{
+    SockZerocopyRange ranges[16];
+    struct pollfd pfd = { .fd = sock->fd, .events = 0, .revents = 0 };
+
+    for (int rounds = 0; rounds < 100; ++rounds) {
+        ssize_t count = sock_zerocopy_poll(sock, ranges, 16);
+        if (count < 0) {
+            return false;
+        }
+        for (ssize_t i = 0; i < count; ++i) {
+            if (ranges[i].lo <= id && id <= ranges[i].hi) {
+                return true;
+            }
+        }
+        poll(&pfd, 1, 10);
+    }
+
+    return false;
+}
+
+int main(void)
+{
+    Sock *server = bench_listen(SOCK_TCP);
+    CHECK(server != NULL);
+
+    Sock *client = sock_create(SOCK_IPV4, SOCK_TCP);
+    CHECK(client != NULL);
+    CHECK(sock_connect(client, server->addr));
+    Sock *peer = sock_accept(server);
+    CHECK(peer != NULL);
+
+    char data[64] = { 0 };
+    uint32_t id = 0;
+
+    // Copied sends are released as soon as they are polled
+    CHECK(sock_send_zerocopy(client, data, sizeof(data), &id) == sizeof(data));
+    CHECK(id == 0);
+    CHECK(sock_send_zerocopy(client, data, sizeof(data), &id) == sizeof(data));
+    CHECK(id == 1);
+
+    if (!sock_set_zerocopy(client, true)) {
+        CHECK(client->last_errno == EBUSY);
+        CHECK(wait_released(client, 1));
+        if (!sock_set_zerocopy(client, true)) {
+            printf("SKIP: zerocopy: %s\n", strerror(client->last_errno));
+            return 0;
+        }
+    } else {
+        CHECK(!"copied sends were not reported before enabling zero-copy");
+    }
+
+    // The ids follow the numbering of the kernel, which starts with
+    // SO_ZEROCOPY
+    CHECK(sock_send_zerocopy(client, data, sizeof(data), &id) == sizeof(data));
+    CHECK(id == 0);
+    CHECK(sock_send_zerocopy(client, data, sizeof(data), &id) == sizeof(data));
+    CHECK(id == 1);
+    CHECK(wait_released(client, 1));
+
+    // Copied sends continue the sequence while zero-copy is disabled and are
+    // still reported once it is enabled again
+    CHECK(sock_set_zerocopy(client, false));
+    CHECK(sock_send_zerocopy(client, data, sizeof(data), &id) == sizeof(data));
+    CHECK(id == 2);
+    CHECK(!sock_set_zerocopy(client, true) && client->last_errno == EBUSY);
+    CHECK(wait_released(client, 2));
+    CHECK(sock_set_zerocopy(client, true));
+    CHECK(sock_send_zerocopy(client, data, sizeof(data), &id) == sizeof(data));
+    CHECK(id == 2);
+    CHECK(wait_released(client, 2));
+
+    // A graceful close would wait for the other end, closed by this thread
+    sock_close_abort(peer);
+    sock_close(client);
+    sock_close(server);
+
+    printf("OK: zerocopy\n");
+    return 0;
+}